@@ -0,0 +1,259 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the bulk (memcpy and byte swap) paths of binary::encoder and
+// binary::decoder with the byte by byte loops they replaced.
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/random_generator.hpp>
+#include <debug/ASSERT.h>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+#include <binary/serialize/vector.h>
+#include <binary/serialize/flat_set.h>
+#include <binary/serialize/uuid.h>
+
+namespace po = boost::program_options;
+using std::vector;
+using std::cout;
+using std::endl;
+using std::string;
+using boost::uuids::uuid;
+using UuidSet = boost::container::flat_set<uuid>;
+using clock_type = std::chrono::steady_clock;
+
+//------------------------------------------------------------------------------
+// The previous implementations, one bounds checked call per byte.
+namespace naive {
+
+static void encode(binary::encoder& e, const vector<char>& v) {
+  e.put<uint32_t>(v.size());
+  for (auto c : v) e.put(c);
+}
+
+static void decode(binary::decoder& d, vector<char>& v) {
+  auto size = d.get<uint32_t>();
+  v.clear();
+  v.reserve(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    v.push_back(d.get<char>());
+    if (d.error()) break;
+  }
+}
+
+static void encode(binary::encoder& e, const UuidSet& set) {
+  e.put<uint32_t>(set.size());
+  for (auto& id : set) {
+    for (auto byte : id) e.put(byte);
+  }
+}
+
+static void decode(binary::decoder& d, UuidSet& set) {
+  auto size = d.get<uint32_t>();
+  set.clear();
+  set.reserve(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    uuid id;
+    for (auto& byte : id) byte = d.get<uint8_t>();
+    if (d.error()) break;
+    set.insert(id);
+  }
+}
+
+static void encode(binary::encoder& e, uint64_t value) {
+  if (e.remaining_size() < sizeof(value)) return e.set_error();
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; ++i) bytes[i] = (value >> (56 - 8*i)) & 0xff;
+  for (auto b : bytes) e.put(b);
+}
+
+static uint64_t decode_u64(binary::decoder& d) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) value = value << 8 | d.get<uint8_t>();
+  return value;
+}
+
+} // naive namespace
+
+//------------------------------------------------------------------------------
+// Returns nanoseconds per call of `f`.
+template<class F>
+static double measure(size_t iterations, F&& f) {
+  auto start = clock_type::now();
+  for (size_t i = 0; i < iterations; ++i) f();
+  auto d = clock_type::now() - start;
+  return std::chrono::duration<double, std::nano>(d).count() / iterations;
+}
+
+static void report(const string& name, double naive_ns, double bulk_ns) {
+  cout << std::left << std::setw(24) << name << std::right << std::fixed
+       << std::setprecision(1)
+       << std::setw(12) << naive_ns << " ns"
+       << std::setw(12) << bulk_ns  << " ns"
+       << std::setw(9)  << (naive_ns / bulk_ns) << "x" << endl;
+}
+
+// Keeps the optimizer from dropping the work.
+static volatile size_t sink;
+
+//------------------------------------------------------------------------------
+int main(int argc, const char* argv[]) {
+  po::options_description desc("Options");
+
+  size_t payload_size;
+  size_t set_size;
+  size_t iterations;
+
+  desc.add_options()
+    ("help,h", "output this help")
+    ("payload-size,p", po::value<size_t>(&payload_size)->default_value(64*1024),
+     "size of the vector<char> payload (like UserData::data)")
+    ("set-size,s", po::value<size_t>(&set_size)->default_value(64),
+     "number of uuids in the set (like AckData::neighbors)")
+    ("iterations,i", po::value<size_t>(&iterations)->default_value(2000),
+     "how many times to encode/decode each");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 0;
+  }
+
+  std::mt19937 rand(0);
+
+  vector<char> payload(payload_size);
+  for (auto& c : payload) c = rand();
+
+  UuidSet uuids;
+  boost::uuids::random_generator gen;
+  while (uuids.size() < set_size) uuids.insert(gen());
+
+  vector<uint8_t> buffer(payload_size + set_size * 16 + 64);
+
+  cout << std::left << std::setw(24) << "" << std::right
+       << std::setw(15) << "byte by byte"
+       << std::setw(15) << "bulk"
+       << std::setw(10) << "speedup" << endl;
+
+  // vector<char>
+  {
+    auto naive_ns = measure(iterations, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        naive::encode(e, payload);
+        sink = e.written();
+      });
+    auto bulk_ns = measure(iterations, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        e.put(payload);
+        sink = e.written();
+      });
+    report("encode vector<char>", naive_ns, bulk_ns);
+
+    vector<char> out;
+
+    naive_ns = measure(iterations, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        naive::decode(d, out);
+        sink = out.size();
+      });
+    bulk_ns = measure(iterations, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        out = d.get<vector<char>>();
+        sink = out.size();
+      });
+    report("decode vector<char>", naive_ns, bulk_ns);
+
+    if (out != payload) {
+      std::cerr << "vector<char> doesn't round trip" << endl;
+      return 1;
+    }
+  }
+
+  // flat_set<uuid>
+  {
+    size_t n = iterations * 100;
+
+    auto naive_ns = measure(n, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        naive::encode(e, uuids);
+        sink = e.written();
+      });
+    auto bulk_ns = measure(n, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        e.put(uuids);
+        sink = e.written();
+      });
+    report("encode flat_set<uuid>", naive_ns, bulk_ns);
+
+    UuidSet out;
+
+    naive_ns = measure(n, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        naive::decode(d, out);
+        sink = out.size();
+      });
+    bulk_ns = measure(n, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        out = d.get<UuidSet>();
+        sink = out.size();
+      });
+    report("decode flat_set<uuid>", naive_ns, bulk_ns);
+
+    if (out != uuids) {
+      std::cerr << "flat_set<uuid> doesn't round trip" << endl;
+      return 1;
+    }
+  }
+
+  // uint64_t
+  {
+    const size_t count = 1024;
+    size_t n = iterations * 10;
+
+    auto naive_ns = measure(n, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        for (uint64_t i = 0; i < count; ++i) naive::encode(e, i * 0x0102030405060708);
+        sink = e.written();
+      });
+    auto bulk_ns = measure(n, [&]() {
+        binary::encoder e(buffer.data(), buffer.size());
+        for (uint64_t i = 0; i < count; ++i) e.put(i * 0x0102030405060708);
+        sink = e.written();
+      });
+    report("encode 1024 x uint64", naive_ns, bulk_ns);
+
+    naive_ns = measure(n, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; ++i) sum += naive::decode_u64(d);
+        sink = sum;
+      });
+    bulk_ns = measure(n, [&]() {
+        binary::decoder d(buffer.data(), buffer.size());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; ++i) sum += d.get<uint64_t>();
+        sink = sum;
+      });
+    report("decode 1024 x uint64", naive_ns, bulk_ns);
+  }
+}
@@ -0,0 +1,168 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the CPU cost of the message compression (see
+// hub::enable_compression) against the bytes it saves.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <binary/lz.h>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+namespace lz = binary::lz;
+using std::vector;
+using std::cout;
+using std::endl;
+using std::string;
+using clock_type = std::chrono::steady_clock;
+
+//------------------------------------------------------------------------------
+// Something resembling serialized game state: records of ids, positions
+// and flags that change a little from one record to the next.
+static vector<uint8_t> game_state(size_t size, std::mt19937& rand) {
+  vector<uint8_t> data;
+  data.reserve(size);
+
+  uint32_t id = 1000;
+  int32_t x = 0, y = 0;
+
+  while (data.size() < size) {
+    id += 1;
+    x  += rand() % 16 - 8;
+    y  += rand() % 16 - 8;
+
+    uint8_t flags = rand() % 8 == 0 ? rand() : 0;
+
+    for (auto v : { id, uint32_t(x), uint32_t(y) }) {
+      for (int i = 0; i < 4; ++i) data.push_back(v >> (8 * i));
+    }
+    data.push_back(flags);
+  }
+
+  data.resize(size);
+  return data;
+}
+
+//------------------------------------------------------------------------------
+static vector<uint8_t> noise(size_t size, std::mt19937& rand) {
+  vector<uint8_t> data(size);
+  for (auto& b : data) b = rand();
+  return data;
+}
+
+//------------------------------------------------------------------------------
+static vector<uint8_t> read_file(const string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return vector<uint8_t>( std::istreambuf_iterator<char>(file)
+                        , std::istreambuf_iterator<char>());
+}
+
+//------------------------------------------------------------------------------
+static void bench(const string& name, const vector<uint8_t>& data, size_t message_size) {
+  using namespace std::chrono;
+
+  if (data.empty()) return;
+
+  vector<uint8_t> compressed(lz::max_compressed_size(message_size));
+  vector<uint8_t> decompressed(message_size);
+
+  size_t total_in = 0, total_out = 0;
+  clock_type::duration compress_time{0}, decompress_time{0};
+
+  // Go through the data a couple of times to get a stable measurement.
+  for (int round = 0; round < 10; ++round) {
+    for (size_t start = 0; start < data.size(); start += message_size) {
+      size_t size = std::min(message_size, data.size() - start);
+      const uint8_t* in = data.data() + start;
+
+      auto t0 = clock_type::now();
+      auto n  = lz::compress(in, size, compressed.data(), compressed.size());
+      auto t1 = clock_type::now();
+      bool ok = lz::decompress(compressed.data(), n, decompressed.data(), size);
+      auto t2 = clock_type::now();
+
+      if (!ok) {
+        cout << "Decompression failed" << endl;
+        return;
+      }
+
+      compress_time   += t1 - t0;
+      decompress_time += t2 - t1;
+      total_in        += size;
+      total_out       += n;
+    }
+  }
+
+  auto mb_per_s = [&](clock_type::duration d) {
+    auto secs = duration_cast<nanoseconds>(d).count() / 1e9;
+    return secs > 0 ? total_in / secs / 1e6 : 0;
+  };
+
+  cout << std::left  << std::setw(12) << name
+       << std::right << std::setw(8)  << message_size
+       << std::setw(10) << std::fixed << std::setprecision(1)
+       << (100.0 * total_out / total_in) << "%"
+       << std::setw(12) << mb_per_s(compress_time)
+       << std::setw(12) << mb_per_s(decompress_time)
+       << endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, const char* argv[]) {
+  po::options_description desc("Options");
+
+  desc.add_options()
+    ("help,h", "output this help")
+    ("file,f", po::value<string>(), "also compress (chunks of) this file")
+    ("total,t", po::value<size_t>()->default_value(4 << 20), "bytes of generated data");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 0;
+  }
+
+  std::mt19937 rand(0);
+
+  auto total = vm["total"].as<size_t>();
+
+  vector<std::pair<string, vector<uint8_t>>> inputs;
+
+  inputs.emplace_back("game state", game_state(total, rand));
+  inputs.emplace_back("noise",      noise(total, rand));
+
+  if (vm.count("file")) {
+    inputs.emplace_back("file", read_file(vm["file"].as<string>()));
+  }
+
+  cout << std::left  << std::setw(12) << "input"
+       << std::right << std::setw(8)  << "size"
+       << std::setw(11) << "ratio"
+       << std::setw(12) << "comp MB/s"
+       << std::setw(12) << "decomp MB/s"
+       << endl;
+
+  for (const auto& input : inputs) {
+    for (size_t size : { 256, 1024, 16 * 1024, 256 * 1024 }) {
+      bench(input.first, input.second, size);
+    }
+  }
+}
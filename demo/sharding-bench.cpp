@@ -0,0 +1,223 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how the throughput of many connections sharing one UDP port
+// scales with the number of club::ShardedMultiplexer shards. Everything
+// runs over the loopback interface.
+
+#include <future>
+#include <iostream>
+#include <iomanip>
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <club/socket.h>
+#include <club/sharded_multiplexer.h>
+
+namespace asio = boost::asio;
+namespace po = boost::program_options;
+using udp = asio::ip::udp;
+using std::vector;
+using std::cout;
+using std::endl;
+using std::shared_ptr;
+using std::make_shared;
+using boost::system::error_code;
+using club::Socket;
+using club::Multiplexer;
+using club::ShardedMultiplexer;
+using SocketPtr = shared_ptr<Socket>;
+
+//------------------------------------------------------------------------------
+// Threads running the client sockets, each with its own io_service.
+class ClientThreads {
+public:
+  ClientThreads(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      _services.emplace_back(new asio::io_service());
+      _works.emplace_back(new asio::io_service::work(*_services.back()));
+    }
+    for (auto& ios : _services) {
+      auto p = ios.get();
+      _threads.emplace_back([p]() { p->run(); });
+    }
+  }
+
+  asio::io_service& operator[](size_t i) { return *_services[i]; }
+  size_t size() const { return _services.size(); }
+
+  ~ClientThreads() {
+    _works.clear();
+    for (auto& t : _threads) t.join();
+  }
+
+private:
+  vector<std::unique_ptr<asio::io_service>>       _services;
+  vector<std::unique_ptr<asio::io_service::work>> _works;
+  vector<std::thread>                             _threads;
+};
+
+//------------------------------------------------------------------------------
+struct Counters {
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<bool>     stop{false};
+};
+
+// Keep sending messages of `size` bytes, `window` of them unacked.
+static void send_loop(SocketPtr s, size_t size, shared_ptr<Counters> c) {
+  if (c->stop) return;
+  s->send_reliable(vector<uint8_t>(size), [s, size, c](error_code e) {
+      if (e) return;
+      send_loop(s, size, c);
+    });
+}
+
+static void receive_loop(SocketPtr s, shared_ptr<Counters> c) {
+  s->receive_reliable([s, c](error_code e, asio::const_buffer b) {
+      if (e) return;
+      c->bytes += asio::buffer_size(b);
+      receive_loop(s, c);
+    });
+}
+
+//------------------------------------------------------------------------------
+static double run( size_t shard_count
+                 , size_t connection_count
+                 , size_t message_size
+                 , size_t window
+                 , std::chrono::milliseconds measure_for) {
+  // Only touched from within the thread (or shard) that owns them. They
+  // are emptied there before the threads are joined.
+  vector<vector<SocketPtr>> server_sockets;
+  vector<vector<SocketPtr>> client_sockets;
+
+  ShardedMultiplexer server(shard_count);
+  ClientThreads      clients(shard_count);
+
+  server_sockets.resize(server.size());
+  client_sockets.resize(clients.size());
+
+  auto counters = make_shared<Counters>();
+
+  auto server_ep = udp::endpoint( asio::ip::address_v4::loopback()
+                                , server.local_endpoint().port());
+
+  for (size_t i = 0; i < connection_count; ++i) {
+    auto shard = i % server.size();
+    auto& ios  = clients[i % clients.size()];
+
+    // Each client has its own UDP port, so that the kernel spreads them
+    // over the server shards.
+    std::promise<std::pair<SocketPtr, udp::endpoint>> client_p;
+    ios.post([&]() {
+        auto c = make_shared<Socket>(ios);
+        client_sockets[i % clients.size()].push_back(c);
+        client_p.set_value(std::make_pair(c, c->local_endpoint()));
+      });
+    auto client = client_p.get_future().get();
+
+    std::promise<club::transport::ConnectionId> server_p;
+    server.post(shard, [&](shared_ptr<Multiplexer> m) {
+        auto s = make_shared<Socket>(m);
+        server_sockets[shard].push_back(s);
+        s->rendezvous_connect(client.second, [](error_code) {});
+        receive_loop(s, counters);
+        server_p.set_value(s->connection_id());
+      });
+    auto server_id = server_p.get_future().get();
+
+    ios.post([=]() {
+        auto c = client.first;
+        c->rendezvous_connect(server_ep, server_id, [=](error_code e) {
+            if (e) return;
+            for (size_t j = 0; j < window; ++j) {
+              send_loop(c, message_size, counters);
+            }
+          });
+      });
+  }
+
+  // Let it warm up.
+  std::this_thread::sleep_for(measure_for / 4);
+
+  auto start_bytes = counters->bytes.load();
+  auto start       = std::chrono::steady_clock::now();
+
+  std::this_thread::sleep_for(measure_for);
+
+  auto bytes   = counters->bytes.load() - start_bytes;
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  counters->stop = true;
+
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i].post([&, i]() {
+        for (auto& s : client_sockets[i]) s->close();
+        client_sockets[i].clear();
+      });
+  }
+
+  for (size_t i = 0; i < server.size(); ++i) {
+    server.post(i, [&, i](shared_ptr<Multiplexer>) {
+        for (auto& s : server_sockets[i]) s->close();
+        server_sockets[i].clear();
+      });
+  }
+
+  using namespace std::chrono;
+  return bytes / duration_cast<duration<double>>(elapsed).count();
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, const char* argv[]) {
+  po::options_description desc("Options");
+
+  desc.add_options()
+    ("help,h", "output this help")
+    ("shards,s", po::value<size_t>()->default_value(std::thread::hardware_concurrency() / 2), "the highest number of shards to try")
+    ("connections,c", po::value<size_t>()->default_value(64), "number of connections")
+    ("message-size,m", po::value<size_t>()->default_value(1000), "size of the sent messages")
+    ("window,w", po::value<size_t>()->default_value(16), "unacked messages per connection")
+    ("duration,d", po::value<size_t>()->default_value(2000), "milliseconds of each measurement");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 0;
+  }
+
+  auto max_shards = std::max<size_t>(1, vm["shards"].as<size_t>());
+
+  cout << std::setw(8) << "shards" << std::setw(12) << "MB/s"
+       << std::setw(10) << "speedup" << endl;
+
+  double base = 0;
+
+  for (size_t shards = 1; shards <= max_shards; shards *= 2) {
+    auto rate = run( shards
+                   , vm["connections"].as<size_t>()
+                   , vm["message-size"].as<size_t>()
+                   , vm["window"].as<size_t>()
+                   , std::chrono::milliseconds(vm["duration"].as<size_t>()));
+
+    if (shards == 1) base = rate;
+
+    cout << std::setw(8) << shards
+         << std::setw(12) << std::fixed << std::setprecision(1) << rate / 1e6
+         << std::setw(10) << std::setprecision(2) << (base ? rate / base : 0)
+         << endl;
+  }
+}
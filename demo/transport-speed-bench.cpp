@@ -32,6 +32,7 @@ using ClubSocket = club::Socket;
 using boost::system::error_code;
 using std::shared_ptr;
 using std::unique_ptr;
+using club::transport::CongestionControl;
 
 static constexpr uint16_t DEFAULT_SERVER_PORT = 6379;
 static constexpr int NUMBER_OF_ROUNDS = 10;
@@ -62,6 +63,35 @@ static udp::endpoint resolve(asio::io_service& ios, const string& str) {
   return *iter;
 }
 
+//------------------------------------------------------------------------------
+static bool parse_congestion_control(const string& str, CongestionControl& cc) {
+  if      (str == "ledbat") cc = CongestionControl::ledbat;
+  else if (str == "cubic")  cc = CongestionControl::cubic;
+  else if (str == "bbr")    cc = CongestionControl::bbr;
+  else return false;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+static void print_io_counters( const club::transport::IoCounters& c
+                             , std::chrono::steady_clock::duration d) {
+  using namespace std::chrono;
+
+  float secs = duration_cast<milliseconds>(d).count() / 1000.f;
+  float rx_mb = c.rx_bytes / (1024.f * 1024.f);
+  float tx_mb = c.tx_bytes / (1024.f * 1024.f);
+
+  cout << "RX: " << c.rx_packets << " packets; "
+       << (c.rx_packets / secs) << " packets/s; "
+       << c.rx_syscalls << " syscalls; "
+       << (rx_mb > 0 ? c.rx_syscalls / rx_mb : 0) << " syscalls/MB" << endl;
+
+  cout << "TX: " << c.tx_packets << " packets; "
+       << (c.tx_packets / secs) << " packets/s; "
+       << c.tx_syscalls << " syscalls; "
+       << (tx_mb > 0 ? c.tx_syscalls / tx_mb : 0) << " syscalls/MB" << endl;
+}
+
 //------------------------------------------------------------------------------
 struct Stopable {
   virtual void stop() = 0;
@@ -86,9 +116,18 @@ struct Server : public Stopable {
   size_t to_send = 30'000'000;
   size_t remaining = to_send;
   size_t counter = 0;
-
-  Server(asio::io_service& ios)
+  size_t batch_size;
+  CongestionControl cc;
+  bool pacing;
+
+  Server( asio::io_service& ios
+        , size_t batch_size
+        , CongestionControl cc
+        , bool pacing)
     : ios(ios)
+    , batch_size(batch_size)
+    , cc(cc)
+    , pacing(pacing)
     , listening_socket(ios, udp::endpoint(udp::v4(), DEFAULT_SERVER_PORT))
   {
     listening_socket.async_receive_from( asio::buffer(contact_data)
@@ -106,6 +145,9 @@ struct Server : public Stopable {
 
     cout << "Contact received " << remote_endpoint << endl;
     socket = std::make_shared<ClubSocket>(std::move(listening_socket));
+    socket->io_batch_size(batch_size);
+    socket->congestion_control(cc);
+    socket->pacing(pacing);
     socket->rendezvous_connect(remote_endpoint, [=](auto error) {
         if (error) {
           cout << "Error connecting to " << remote_endpoint << " " << error.message() << endl;
@@ -128,7 +170,9 @@ struct Server : public Stopable {
     cout << counter++ << " "
          << "TX Remaining: " << remaining << " Bytes; "
          << "Sent: " << sent << " Bytes; "
-         << "Speed: " << (sent / duration) << " Bps"
+         << "Speed: " << (sent / duration) << " Bps; "
+         << "RTT: " << duration_cast<microseconds>(socket->rtt()).count() << " us; "
+         << "MTU: " << socket->path_mtu()
          << std::endl;
 
     if (remaining == 0) {
@@ -157,6 +201,7 @@ struct Server : public Stopable {
 
   void stop() override {
     if (listening_socket.is_open()) listening_socket.close();
+    if (socket) print_io_counters(socket->io_counters(), clock::now() - start);
     if (socket) socket->close();
     socket.reset();
   }
@@ -164,15 +209,28 @@ struct Server : public Stopable {
 
 //------------------------------------------------------------------------------
 struct Client : public Stopable {
+  using clock = std::chrono::steady_clock;
+
   udp::socket udp_socket;
   shared_ptr<ClubSocket> socket;
   udp::endpoint server_ep;
   size_t received = 0;
   size_t counter = 0;
+  size_t batch_size;
+  CongestionControl cc;
+  bool pacing;
+  clock::time_point start;
 
-  Client(asio::io_service& ios, udp::endpoint server_ep)
+  Client( asio::io_service& ios
+        , udp::endpoint server_ep
+        , size_t batch_size
+        , CongestionControl cc
+        , bool pacing)
     : udp_socket(ios, udp::endpoint(udp::v4(), 0))
     , server_ep(server_ep)
+    , batch_size(batch_size)
+    , cc(cc)
+    , pacing(pacing)
   {
     static vector<uint8_t> dummy_data({0,1,2,3});
     udp_socket.async_send_to( asio::buffer(dummy_data)
@@ -190,6 +248,9 @@ struct Client : public Stopable {
 
   void on_contact_sent() {
     socket = std::make_shared<ClubSocket>(std::move(udp_socket));
+    socket->io_batch_size(batch_size);
+    socket->congestion_control(cc);
+    socket->pacing(pacing);
 
     socket->rendezvous_connect(server_ep, [=](auto error) {
         if (error) {
@@ -198,6 +259,7 @@ struct Client : public Stopable {
         }
         cout << "Rendezvous connect success to " << server_ep << endl;
         cout << "Receiving" << endl;
+        this->start = clock::now();
         this->start_receiving();
       });
   }
@@ -234,6 +296,7 @@ struct Client : public Stopable {
 
   void stop() override {
     if (udp_socket.is_open()) udp_socket.close();
+    if (socket) print_io_counters(socket->io_counters(), clock::now() - start);
     if (socket) socket->close();
     socket.reset();
   }
@@ -246,7 +309,10 @@ int main(int argc, const char* argv[]) {
 
   desc.add_options()
     ("help,h", "output this help")
-    ("connect,c", po::value<string>(), "endpoint of the server (if not set, we're the server)");
+    ("connect,c", po::value<string>(), "endpoint of the server (if not set, we're the server)")
+    ("batch,b", po::value<size_t>()->default_value(1), "max number of datagrams per recvmmsg/sendmmsg call (1 disables batching)")
+    ("cc", po::value<string>()->default_value("ledbat"), "congestion control: ledbat, cubic or bbr")
+    ("pacing,p", "spread packets over the round trip time instead of sending them in bursts");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -263,19 +329,33 @@ int main(int argc, const char* argv[]) {
 
   unique_ptr<Stopable> stopable;
 
+  auto batch_size = vm["batch"].as<size_t>();
+
+  auto pacing = vm.count("pacing") != 0;
+
+  CongestionControl cc;
+  if (!parse_congestion_control(vm["cc"].as<string>(), cc)) {
+    cout << "Unknown congestion control " << vm["cc"].as<string>() << endl;
+    return 1;
+  }
+
   if (!vm.count("connect")) {
     cout << "The 'connect' option was not set. We're the server then."
          << endl;
-    stopable.reset(new Server(ios));
+    stopable.reset(new Server(ios, batch_size, cc, pacing));
   }
   else {
     auto server_addr = vm["connect"].as<string>();
     auto server_ep = resolve(ios, server_addr);
-    stopable.reset(new Client(ios, server_ep));
+    stopable.reset(new Client(ios, server_ep, batch_size, cc, pacing));
   }
 
   ios.run();
 
+  // Print the statistics in case the other end closed the connection
+  // before we stopped.
+  stopable->stop();
+
   cout << "Finished" << endl;
 }
 
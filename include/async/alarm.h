@@ -15,46 +15,33 @@
 #ifndef ASYNC_ALARM_H
 #define ASYNC_ALARM_H
 
-#include <boost/asio/steady_timer.hpp>
+#include <functional>
+#include <memory>
+#include <async/timer_wheel.h>
 
 // Alarm is similar to the boost::steady_timer but
 // it doesn't call its on_expire handler if it was
 // stopped or destroyed.
+//
+// All alarms of an io_service share one async::timer_wheel, so starting
+// an alarm that is already running doesn't cancel or re-arm any asio
+// timer, it only updates the deadline. Alarms of sockets in different
+// strands may be used from different threads at the same time.
 namespace async {
 
-class alarm {
+class alarm : private timer_wheel::entry {
 private:
-  using clock = std::chrono::steady_clock;
-
-  enum State { idle, running, canceling, canceling_for_restart };
-
-  struct Storage {
-    bool was_destroyed = false;
-    std::function<void ()> on_expire;
-
-    Storage(std::function<void()> on_exp)
-      : on_expire(std::move(on_exp))
-    {}
-  };
-
-  using StoragePtr = std::shared_ptr<Storage>;
-  using error_code = boost::system::error_code;
+  using clock = timer_wheel::clock;
+  using Handler = timer_wheel::handler;
 
 public:
   using duration = boost::asio::steady_timer::duration;
 
 public:
-
-  uint32_t time() const {
-    using namespace std::chrono;
-    return duration_cast<milliseconds>(clock::now() - s).count();
-  }
-
   template<class H>
   alarm(boost::asio::io_service& ios, H&& on_expire)
-    : _storage(std::make_shared<Storage>(std::forward<H>(on_expire)))
-    , _state(idle)
-    , _timer(ios)
+    : timer_wheel::entry( boost::asio::use_service<timer_wheel>(ios)
+                        , std::make_shared<Handler>(std::forward<H>(on_expire)))
   { }
 
   alarm(alarm&) = delete;
@@ -62,102 +49,16 @@ public:
   alarm(alarm&& other) = delete;
 
   void start(duration timeout) {
-    //std::cout << "    " << time() << " " << this << " alarm::start_locked " << state_to_str(_state) << " " << std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count() << std::endl;
-    switch (_state) {
-      case idle:
-        _state = running;
-        {
-          auto expiration_time = clock::now() + timeout;
-          _timer.expires_at(expiration_time);
-          _timer.async_wait(
-              [this, s = _storage, expiration_time](error_code e) {
-                if (s->was_destroyed) return;
-                on_timeout(e, expiration_time);
-              });
-        }
-        break;
-      case running:
-        _state = canceling_for_restart;
-        _timer.cancel();
-        _timeout = timeout;
-        break;
-      case canceling:
-        _state = canceling_for_restart;
-        _timeout = timeout;
-        break;
-      case canceling_for_restart:
-        _timeout = timeout;
-        break;
-    }
+    wheel().schedule(*this, clock::now() + timeout);
   }
 
   void stop() {
-    //std::cout << "    " << time() << " " << this << " alarm::stop " << state_to_str(_state) << std::endl;
-    switch (_state) {
-      case idle:                  break;
-      case running:               _state = canceling;
-                                  _timer.cancel();
-                                  break;
-      case canceling:             break;
-      case canceling_for_restart: _state = canceling; break;
-    }
-  }
-
-  ~alarm() {
-    _storage->was_destroyed = true;
-    stop();
-  }
-
-private:
-  void on_timeout(error_code e, clock::time_point expiration_time) {
-    //std::cout << "    " << time() << " " << this << " alarm::on_timeout " << state_to_str(_state) << " " << e.message() << std::endl;
-    switch (_state) {
-      case idle:
-        assert(0 && "This state shouldn't be possible here");
-        break;
-      case running:
-        _state = idle;
-        {
-          auto now = clock::now();
-          if (now < expiration_time) {
-            // Very rarely it happens that the timer fires before the
-            // expiration time, seems like a bug in asio::steady_timer.
-            using namespace std::chrono;
-            std::cout << "timer fired " << duration_cast<milliseconds>(expiration_time - now).count() << " ms too soon" << std::endl;
-            assert(0);
-            return start(expiration_time - now);
-          }
-          auto s = _storage;
-          s->on_expire();
-        }
-        break;
-      case canceling:
-        _state = idle;
-        break;
-      case canceling_for_restart:
-        _state = idle;
-        start(_timeout);
-        break;
-    }
+    wheel().cancel(*this);
   }
 
-  std::string state_to_str(State s) {
-    switch (s) {
-      case idle: return "idle";
-      case running: return "running";
-      case canceling: return "canceling";
-      case canceling_for_restart: return "canceling_for_restart";
-    }
-    return "???";
-  }
-
-private:
-  StoragePtr                _storage;
-  State                     _state;
-  boost::asio::steady_timer _timer;
-  duration                  _timeout;
-
-  clock::time_point s = clock::now();
+  // The timer_wheel::entry unlinks itself on destruction, which also
+  // works after the io_service (and with it the wheel) is gone.
+  ~alarm() = default;
 };
 
 } // async namespace
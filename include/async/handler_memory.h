@@ -0,0 +1,138 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ASYNC_HANDLER_MEMORY_H
+#define ASYNC_HANDLER_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Memory that asio uses for the operation (and strand) state of handlers
+// wrapped with make_custom_alloc_handler. A single block is reused for as
+// long as at most one such operation is pending at a time, otherwise (or
+// if the operation doesn't fit) the memory comes from the heap.
+//
+// Asio releases the memory only after it has destroyed the handler, which
+// may hold the last reference to the handler_memory's owner. The block is
+// therefore reference counted and outlives the handler_memory object if it
+// is still in use.
+namespace async {
+
+class handler_memory {
+private:
+  static constexpr size_t capacity = 256;
+
+  struct block;
+
+  // Precedes every allocation so that deallocate doesn't need to touch
+  // the handler (nor the handler_memory).
+  struct alignas(std::max_align_t) header {
+    block* owner;
+  };
+
+  static_assert( sizeof(header) % alignof(std::max_align_t) == 0
+               , "Memory following the header must be suitably aligned");
+
+  struct block {
+    std::atomic<bool> in_use;
+    std::atomic<int>  refs;
+    // The header followed by the reused memory, laid out the same way
+    // as the heap allocations.
+    typename std::aligned_storage< sizeof(header) + capacity
+                                 , alignof(header)>::type storage;
+
+    block() : in_use(false), refs(1) { new (&storage) header{this}; }
+
+    void* data() { return reinterpret_cast<header*>(&storage) + 1; }
+
+    void release() {
+      if (--refs == 0) delete this;
+    }
+  };
+
+public:
+  handler_memory() : _block(new block) {}
+
+  handler_memory(const handler_memory&) = delete;
+  handler_memory& operator=(const handler_memory&) = delete;
+
+  ~handler_memory() { _block->release(); }
+
+  void* allocate(size_t size) {
+    if (size <= capacity && !_block->in_use.exchange(true)) {
+      ++_block->refs;
+      return _block->data();
+    }
+
+    auto h = static_cast<header*>(::operator new(sizeof(header) + size));
+    h->owner = nullptr;
+    return h + 1;
+  }
+
+  static void deallocate(void* pointer) {
+    auto h = static_cast<header*>(pointer) - 1;
+
+    if (auto b = h->owner) {
+      b->in_use = false;
+      return b->release();
+    }
+
+    ::operator delete(h);
+  }
+
+private:
+  block* _block;
+};
+
+//------------------------------------------------------------------------------
+template<class Handler>
+class custom_alloc_handler {
+public:
+  custom_alloc_handler(handler_memory& m, Handler h)
+    : _memory(m)
+    , _handler(std::move(h))
+  {}
+
+  template<class... Args>
+  void operator()(Args&&... args) {
+    _handler(std::forward<Args>(args)...);
+  }
+
+  friend void* asio_handler_allocate(size_t size, custom_alloc_handler* h) {
+    return h->_memory.allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, size_t, custom_alloc_handler*) {
+    handler_memory::deallocate(pointer);
+  }
+
+private:
+  handler_memory& _memory;
+  Handler         _handler;
+};
+
+template<class Handler>
+inline
+custom_alloc_handler<typename std::decay<Handler>::type>
+make_custom_alloc_handler(handler_memory& m, Handler&& h) {
+  return custom_alloc_handler<typename std::decay<Handler>::type>
+           (m, std::forward<Handler>(h));
+}
+
+} // async namespace
+
+#endif // ifndef ASYNC_HANDLER_MEMORY_H
@@ -0,0 +1,439 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ASYNC_TIMER_WHEEL_H
+#define ASYNC_TIMER_WHEEL_H
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/optional.hpp>
+
+// A hierarchical timer wheel shared by all alarms of one io_service
+// (obtained through boost::asio::use_service<async::timer_wheel>(ios)).
+//
+// Entries are kept in intrusive lists, one per slot, so (re)scheduling
+// doesn't allocate. Deadlines are lazy: when an entry is already going
+// to be examined no later than its new deadline, only the deadline is
+// updated. The entry is checked when its slot comes up and re-inserted
+// if the deadline moved in the meantime. Similarly, cancelling only
+// marks the entry. A single steady_timer drives the whole wheel and is
+// re-armed only when the earliest examination time moves closer. Once
+// no entry is armed, the wheel drops all of them and stops the timer so
+// that stopped alarms don't keep the io_service running.
+//
+// The io_service may be run by several threads, with sockets on different
+// strands using the wheel at the same time, so all of its state is guarded
+// by a mutex. The mutex is not held while entry handlers run.
+namespace async {
+
+namespace detail {
+  template<class Service> struct service_id {
+    static boost::asio::io_service::id id;
+  };
+
+  template<class Service>
+  boost::asio::io_service::id service_id<Service>::id;
+} // detail namespace
+
+class timer_wheel : public boost::asio::io_service::service
+                  , public detail::service_id<timer_wheel> {
+public:
+  using clock = std::chrono::steady_clock;
+
+  using hook = boost::intrusive::list_base_hook
+                 <boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+  using handler = std::function<void()>;
+
+  class entry : public hook {
+  public:
+    entry(timer_wheel& wheel, std::shared_ptr<handler> on_deadline)
+      : _wheel(&wheel)
+      , _mutex(wheel._mutex)
+      , _on_deadline(std::move(on_deadline))
+    {}
+
+    entry(const entry&) = delete;
+    entry& operator=(const entry&) = delete;
+
+  protected:
+    // The wheel may be processing its slots on another thread. The mutex
+    // is shared so that this also works after the wheel is gone: entries
+    // are disarmed and unlinked on shutdown, so _wheel isn't touched then.
+    ~entry() {
+      std::lock_guard<std::mutex> lock(*_mutex);
+      if (_armed) _wheel->disarm(*this);
+      unlink();
+    }
+
+    timer_wheel& wheel() const { return *_wheel; }
+
+  private:
+    friend class timer_wheel;
+
+    timer_wheel*                _wheel;
+    std::shared_ptr<std::mutex> _mutex;
+    // Copied before it's executed, so it outlives the entry if the entry
+    // is destroyed by the handler itself or by another thread.
+    std::shared_ptr<handler>    _on_deadline;
+
+    bool              _armed = false;
+    clock::time_point _deadline;
+    // The tick at which the wheel looks at this entry next.
+    uint64_t          _examine_at = 0;
+  };
+
+private:
+  using error_code = boost::system::error_code;
+  using list = boost::intrusive::list< entry
+                                     , boost::intrusive::constant_time_size<false>>;
+
+  static constexpr unsigned LEVEL_BITS = 6;
+  static constexpr uint64_t SLOTS      = 1 << LEVEL_BITS;
+  static constexpr unsigned LEVELS     = 4;
+
+public:
+  using tick_duration = std::chrono::milliseconds;
+
+  explicit timer_wheel(boost::asio::io_service&);
+
+  // (Re)start the entry so that it expires at `deadline`.
+  void schedule(entry&, clock::time_point deadline);
+
+  // Make sure the entry doesn't expire. It stays in the wheel until its
+  // slot comes up (or until it is removed or scheduled again, or until
+  // no entry is armed any more).
+  void cancel(entry&);
+
+  // Drop the entry from the wheel right away, must be called before
+  // the entry is destroyed.
+  void remove(entry&);
+
+  // Number of times the underlying steady_timer was armed, mainly useful
+  // for tests and benchmarks.
+  uint64_t wait_count() const {
+    std::lock_guard<std::mutex> lock(*_mutex);
+    return _wait_count;
+  }
+
+  void shutdown_service();
+  void shutdown();
+
+private:
+  void insert(entry&, uint64_t earliest);
+  void disarm(entry&);
+  void drop_all();
+  void arm(uint64_t tick);
+  void on_timer();
+  void advance(uint64_t to, std::unique_lock<std::mutex>&);
+  void process(uint64_t tick, std::unique_lock<std::mutex>&);
+  boost::optional<uint64_t> next_tick() const;
+
+  list& slot(unsigned level, uint64_t tick) {
+    return _slots[level][(tick >> (level * LEVEL_BITS)) & (SLOTS - 1)];
+  }
+
+  static uint64_t floor_tick(clock::time_point);
+  static uint64_t ceil_tick(clock::time_point);
+
+private:
+  std::shared_ptr<std::mutex>           _mutex;
+  boost::asio::steady_timer             _timer;
+  std::array<std::array<list, SLOTS>, LEVELS> _slots;
+  // Last tick that has been fully processed.
+  uint64_t                              _now;
+  boost::optional<uint64_t>             _armed_at;
+  // Number of entries that are going to expire.
+  size_t                                _armed_count = 0;
+  bool                                  _advancing = false;
+  uint64_t                              _wait_count = 0;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline timer_wheel::timer_wheel(boost::asio::io_service& ios)
+  : boost::asio::io_service::service(ios)
+  , _mutex(std::make_shared<std::mutex>())
+  , _timer(ios)
+  , _now(floor_tick(clock::now()))
+{}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::schedule(entry& e, clock::time_point deadline) {
+  std::lock_guard<std::mutex> lock(*_mutex);
+
+  if (!e._armed) {
+    e._armed = true;
+    ++_armed_count;
+  }
+
+  e._deadline = deadline;
+
+  if (e.is_linked()) {
+    // The entry will be looked at before the deadline, at which point
+    // it gets moved to the right slot.
+    if (e._examine_at <= ceil_tick(deadline)) return;
+    e.unlink();
+  }
+  else if (!_armed_at && !_advancing) {
+    // The wheel is empty, no need to catch up on ticks nobody waits for.
+    _now = std::max(_now, floor_tick(clock::now()));
+  }
+
+  insert(e, _now + 1);
+  arm(e._examine_at);
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::cancel(entry& e) {
+  std::lock_guard<std::mutex> lock(*_mutex);
+  disarm(e);
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::remove(entry& e) {
+  std::lock_guard<std::mutex> lock(*_mutex);
+  disarm(e);
+  e.unlink();
+}
+
+//------------------------------------------------------------------------------
+// Called with the mutex held.
+inline void timer_wheel::disarm(entry& e) {
+  if (!e._armed) return;
+
+  e._armed = false;
+
+  // The remaining (cancelled) entries would otherwise keep the timer
+  // running until their slots come up. While advancing, on_timer takes
+  // care of it once it's done.
+  if (--_armed_count == 0 && !_advancing) drop_all();
+}
+
+//------------------------------------------------------------------------------
+// Called with the mutex held.
+inline void timer_wheel::drop_all() {
+  for (auto& level : _slots) {
+    for (auto& s : level) {
+      for (auto& e : s) e._armed = false;
+      s.clear();
+    }
+  }
+
+  _armed_count = 0;
+  _armed_at    = boost::none;
+  _timer.cancel();
+}
+
+//------------------------------------------------------------------------------
+// Called with the mutex held. `earliest` is the first tick the entry may be examined at, it must not be
+// less than `_now`.
+inline void timer_wheel::insert(entry& e, uint64_t earliest) {
+  static constexpr uint64_t span = uint64_t(1) << (LEVELS * LEVEL_BITS);
+
+  uint64_t t = std::max(ceil_tick(e._deadline), earliest);
+
+  // Deadlines beyond the wheel's span are re-examined when the top
+  // level slot comes up.
+  t = std::min(t, _now + span - 1);
+
+  // The level is chosen by the slot boundaries `t` and `_now` share, not
+  // by their distance: that way the slot always starts after `_now`
+  // (or at `_now` on level zero) and is never one that has already
+  // been processed in the current period.
+  unsigned level = 0;
+
+  while (level < LEVELS - 1
+      && (t >> ((level+1) * LEVEL_BITS)) != (_now >> ((level+1) * LEVEL_BITS))) {
+    ++level;
+  }
+
+  // The tick at which the slot is processed (levels above zero are
+  // cascaded to lower levels when their first tick comes up).
+  e._examine_at = t & ~((uint64_t(1) << (level * LEVEL_BITS)) - 1);
+
+  slot(level, t).push_back(e);
+}
+
+//------------------------------------------------------------------------------
+// Called with the mutex held.
+inline void timer_wheel::arm(uint64_t tick) {
+  if (_advancing) return; // on_timer re-arms once it's done.
+  if (_armed_at && *_armed_at <= tick) return;
+
+  _armed_at = tick;
+  ++_wait_count;
+
+  _timer.expires_at(clock::time_point(tick_duration(tick)));
+  _timer.async_wait([this](error_code e) {
+      if (e == boost::asio::error::operation_aborted) return;
+      on_timer();
+    });
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::on_timer() {
+  std::unique_lock<std::mutex> lock(*_mutex);
+
+  // A wait that completed just before it was cancelled, the thread that's
+  // advancing re-arms the timer once it's done.
+  if (_advancing) return;
+
+  _armed_at   = boost::none;
+  _advancing  = true;
+
+  struct Guard {
+    bool& advancing;
+    ~Guard() { advancing = false; }
+  } guard{_advancing};
+
+  advance(floor_tick(clock::now()), lock);
+
+  _advancing = false;
+
+  if (_armed_count == 0) {
+    drop_all();
+  }
+  else if (auto t = next_tick()) {
+    arm(*t);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::advance( uint64_t to
+                                , std::unique_lock<std::mutex>& lock) {
+  while (true) {
+    auto t = next_tick();
+
+    if (!t || *t > to) {
+      _now = std::max(_now, to);
+      return;
+    }
+
+    process(*t, lock);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::process( uint64_t tick
+                                , std::unique_lock<std::mutex>& lock) {
+  // Ticks in between had nothing to do.
+  _now = tick;
+
+  // Cascade higher levels whose slot starts at this tick, from the top
+  // so that entries can fall through more than one level. Entries due
+  // at this very tick end up in the level zero slot processed below.
+  for (unsigned level = LEVELS - 1; level > 0; --level) {
+    if (tick & ((uint64_t(1) << (level * LEVEL_BITS)) - 1)) continue;
+
+    list cascading;
+    cascading.splice(cascading.end(), slot(level, tick));
+
+    while (!cascading.empty()) {
+      auto& e = cascading.front();
+      cascading.pop_front();
+      if (e._armed) insert(e, tick);
+    }
+  }
+
+  list due;
+  due.splice(due.end(), slot(0, tick));
+
+  // Handlers run without the lock and may start, stop or destroy any entry
+  // (including those still in `due`), as may other threads in the meantime,
+  // so never hold on to one across a call.
+  struct Unlock {
+    std::unique_lock<std::mutex>& lock;
+    Unlock(std::unique_lock<std::mutex>& l) : lock(l) { lock.unlock(); }
+    ~Unlock() { lock.lock(); }
+  };
+
+  while (!due.empty()) {
+    auto& e = due.front();
+    due.pop_front();
+
+    if (!e._armed) continue;
+
+    if (ceil_tick(e._deadline) > tick) {
+      // The deadline was pushed back since this entry was inserted.
+      insert(e, _now + 1);
+      continue;
+    }
+
+    e._armed = false;
+    --_armed_count;
+
+    auto h = e._on_deadline;
+    Unlock unlock(lock);
+    (*h)();
+  }
+}
+
+//------------------------------------------------------------------------------
+inline boost::optional<uint64_t> timer_wheel::next_tick() const {
+  boost::optional<uint64_t> result;
+
+  for (unsigned level = 0; level < LEVELS; ++level) {
+    const unsigned shift  = level * LEVEL_BITS;
+    const uint64_t period = uint64_t(1) << (shift + LEVEL_BITS);
+    const uint64_t base   = _now & ~(period - 1);
+
+    for (uint64_t s = 0; s < SLOTS; ++s) {
+      if (_slots[level][s].empty()) continue;
+
+      uint64_t t = base + (s << shift);
+      if (t <= _now) t += period;
+
+      if (!result || t < *result) result = t;
+    }
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+inline uint64_t timer_wheel::floor_tick(clock::time_point t) {
+  using namespace std::chrono;
+  return duration_cast<tick_duration>(t.time_since_epoch()).count();
+}
+
+inline uint64_t timer_wheel::ceil_tick(clock::time_point t) {
+  using namespace std::chrono;
+  auto d = t.time_since_epoch();
+  auto r = duration_cast<tick_duration>(d);
+  if (r < d) r += tick_duration(1);
+  return r.count();
+}
+
+//------------------------------------------------------------------------------
+inline void timer_wheel::shutdown_service() {
+  std::lock_guard<std::mutex> lock(*_mutex);
+  drop_all();
+}
+
+inline void timer_wheel::shutdown() {
+  shutdown_service();
+}
+
+//------------------------------------------------------------------------------
+} // async namespace
+
+#endif // ifndef ASYNC_TIMER_WHEEL_H
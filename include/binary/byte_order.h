@@ -0,0 +1,78 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BINARY_BYTE_ORDER_H
+#define BINARY_BYTE_ORDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <boost/detail/endian.hpp>
+
+#ifndef BOOST_LITTLE_ENDIAN
+# error Big endian architectures not supported yet
+#endif
+
+// Conversion of fixed width integers to and from the big endian (network)
+// byte order the encoders use. The compilers turn these into a single
+// (unaligned) load or store and a bswap instruction.
+namespace binary { namespace detail {
+
+inline uint8_t  byte_swap(uint8_t v)  { return v; }
+
+#if defined(__GNUC__) || defined(__clang__)
+inline uint16_t byte_swap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t byte_swap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t byte_swap(uint64_t v) { return __builtin_bswap64(v); }
+#else
+inline uint16_t byte_swap(uint16_t v) {
+  return uint16_t(v << 8 | v >> 8);
+}
+
+inline uint32_t byte_swap(uint32_t v) {
+  return (v << 24)
+       | (v << 8  & 0x00ff0000)
+       | (v >> 8  & 0x0000ff00)
+       | (v >> 24);
+}
+
+inline uint64_t byte_swap(uint64_t v) {
+  return uint64_t(byte_swap(uint32_t(v))) << 32 | byte_swap(uint32_t(v >> 32));
+}
+#endif
+
+template<class T> struct unsigned_of;
+template<> struct unsigned_of<uint16_t> { using type = uint16_t; };
+template<> struct unsigned_of<int16_t>  { using type = uint16_t; };
+template<> struct unsigned_of<uint32_t> { using type = uint32_t; };
+template<> struct unsigned_of<int32_t>  { using type = uint32_t; };
+template<> struct unsigned_of<uint64_t> { using type = uint64_t; };
+template<> struct unsigned_of<int64_t>  { using type = uint64_t; };
+
+// Write `value` to `out` in big endian, `out` needn't be aligned.
+template<class T> inline void store_big_endian(uint8_t* out, T value) {
+  using U = typename unsigned_of<T>::type;
+  U u = byte_swap(static_cast<U>(value));
+  std::memcpy(out, &u, sizeof(u));
+}
+
+template<class T> inline T load_big_endian(const uint8_t* in) {
+  using U = typename unsigned_of<T>::type;
+  U u;
+  std::memcpy(&u, in, sizeof(u));
+  return static_cast<T>(byte_swap(u));
+}
+
+}} // binary::detail namespace
+
+#endif // ifndef BINARY_BYTE_ORDER_H
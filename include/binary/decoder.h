@@ -15,11 +15,8 @@
 #ifndef BINARY_DECODER_H
 #define BINARY_DECODER_H
 
-#include <boost/detail/endian.hpp>
-
-#ifndef BOOST_LITTLE_ENDIAN
-# error Big endian architectures not supported yet
-#endif
+#include <cstring>
+#include <binary/byte_order.h>
 
 namespace binary {
 
@@ -177,8 +174,7 @@ inline std::uint16_t decoder::get<std::uint16_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  result = _current.begin[0] << 8
-         | _current.begin[1];
+  result = detail::load_big_endian<std::uint16_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -190,8 +186,7 @@ inline std::int16_t decoder::get<std::int16_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  result = _current.begin[0] << 8
-         | _current.begin[1];
+  result = detail::load_big_endian<std::int16_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -203,10 +198,7 @@ inline std::uint32_t decoder::get<std::uint32_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  result = _current.begin[0] << 24
-         | _current.begin[1] << 16
-         | _current.begin[2] << 8
-         | _current.begin[3];
+  result = detail::load_big_endian<std::uint32_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -218,10 +210,7 @@ inline std::int32_t decoder::get<std::int32_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  result = _current.begin[0] << 24
-         | _current.begin[1] << 16
-         | _current.begin[2] << 8
-         | _current.begin[3];
+  result = detail::load_big_endian<std::int32_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -233,15 +222,7 @@ inline std::int64_t decoder::get<std::int64_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  uint8_t*r = reinterpret_cast<uint8_t*>(&result);
-  *r++ = _current.begin[7];
-  *r++ = _current.begin[6];
-  *r++ = _current.begin[5];
-  *r++ = _current.begin[4];
-  *r++ = _current.begin[3];
-  *r++ = _current.begin[2];
-  *r++ = _current.begin[1];
-  *r++ = _current.begin[0];
+  result = detail::load_big_endian<std::int64_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -253,15 +234,7 @@ inline std::uint64_t decoder::get<std::uint64_t>() {
   if (size() < sizeof(result)) _was_error = true;
   if (_was_error) return 0;
 
-  uint8_t*r = reinterpret_cast<uint8_t*>(&result);
-  *r++ = _current.begin[7];
-  *r++ = _current.begin[6];
-  *r++ = _current.begin[5];
-  *r++ = _current.begin[4];
-  *r++ = _current.begin[3];
-  *r++ = _current.begin[2];
-  *r++ = _current.begin[1];
-  *r++ = _current.begin[0];
+  result = detail::load_big_endian<std::uint64_t>(_current.begin);
 
   _current.begin += sizeof(result);
   return result;
@@ -269,11 +242,10 @@ inline std::uint64_t decoder::get<std::uint64_t>() {
 
 inline void decoder::get_raw(std::uint8_t* iter, std::size_t size) {
   if (this->size() < size) _was_error = true;
-  if (_was_error) return;
+  if (_was_error || size == 0) return;
 
-  for (std::size_t i = 0; i < size; ++i) {
-    *(iter++) = *(_current.begin++);
-  }
+  std::memcpy(iter, _current.begin, size);
+  _current.begin += size;
 }
 
 template<class T, typename... Args> void decode(decoder&, Args&&...);
@@ -15,6 +15,9 @@
 #ifndef BINARY_DYNAMIC_ENCODER_H
 #define BINARY_DYNAMIC_ENCODER_H
 
+#include <cstring>
+#include <binary/byte_order.h>
+
 namespace binary {
 
 template<typename ByteType>
@@ -96,8 +99,8 @@ inline
 void encode(dynamic_encoder<B>& e, uint16_t value) {
   e.grow_to_fit(sizeof(value));
 
-  e.data[e.current++] = (value >> 8) & 0xff;
-  e.data[e.current++] = value & 0xff;
+  detail::store_big_endian(reinterpret_cast<uint8_t*>(&e.data[e.current]), value);
+  e.current += sizeof(value);
 }
 
 template<typename B>
@@ -105,10 +108,8 @@ inline
 void encode(dynamic_encoder<B>& e, uint32_t value) {
   e.grow_to_fit(sizeof(value));
 
-  e.data[e.current++] = (value >> 24) & 0xff;
-  e.data[e.current++] = (value >> 16) & 0xff;
-  e.data[e.current++] = (value >> 8)  & 0xff;
-  e.data[e.current++] = value         & 0xff;
+  detail::store_big_endian(reinterpret_cast<uint8_t*>(&e.data[e.current]), value);
+  e.current += sizeof(value);
 }
 
 template<typename B>
@@ -116,10 +117,8 @@ inline
 void encode(dynamic_encoder<B>& e, int32_t value) {
   e.grow_to_fit(sizeof(value));
 
-  e.data[e.current++] = (value >> 24) & 0xff;
-  e.data[e.current++] = (value >> 16) & 0xff;
-  e.data[e.current++] = (value >> 8)  & 0xff;
-  e.data[e.current++] = value         & 0xff;
+  detail::store_big_endian(reinterpret_cast<uint8_t*>(&e.data[e.current]), value);
+  e.current += sizeof(value);
 }
 
 template<class B>
@@ -127,11 +126,11 @@ template<class Iterator>
 inline
 void dynamic_encoder<B>::put_raw(const Iterator* iter, std::size_t size) {
   static_assert(sizeof(*iter) == 1, "");
+  if (size == 0) return;
   grow_to_fit(size);
 
-  for (std::size_t i = 0; i != size; ++i) {
-    data[current++] = *(iter++);
-  }
+  std::memcpy(&data[current], iter, size);
+  current += size;
 }
 
 } // binary namespace
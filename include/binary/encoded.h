@@ -15,10 +15,21 @@
 #ifndef BINARY_ENCODED_H
 #define BINARY_ENCODED_H
 
+#include <cstdint>
+#include <type_traits>
+
 namespace binary {
 
 template<typename T> struct encoded;
 
+// True for types whose encoding is a plain copy of their bytes. Containers
+// of these are encoded and decoded with a single bounds check and memcpy.
+template<typename T> struct is_raw
+  : std::integral_constant< bool
+                          , std::is_same<T, char>::value
+                         || std::is_same<T, int8_t>::value
+                         || std::is_same<T, uint8_t>::value > {};
+
 } // binary namespace
 
 #endif // ifndef BINARY_ENCODED_H
@@ -15,6 +15,9 @@
 #ifndef BINARY_ENCODER_H
 #define BINARY_ENCODER_H
 
+#include <cstring>
+#include <binary/byte_order.h>
+
 namespace binary {
 
 class encoder {
@@ -162,56 +165,40 @@ inline void encode(encoder& e, uint16_t value) {
   if (e._current.begin + sizeof(value) > e._current.end) e._was_error = true;
   if (e._was_error) return;
 
-  *(e._current.begin++) = (value >> 8) & 0xff;
-  *(e._current.begin++) = value & 0xff;
+  detail::store_big_endian(e._current.begin, value);
+  e._current.begin += sizeof(value);
 }
 
 inline void encode(encoder& e, uint32_t value) {
   if (e._current.begin + sizeof(value) > e._current.end) e._was_error = true;
   if (e._was_error) return;
 
-  *(e._current.begin++) = (value >> 24) & 0xff;
-  *(e._current.begin++) = (value >> 16) & 0xff;
-  *(e._current.begin++) = (value >> 8)  & 0xff;
-  *(e._current.begin++) = value         & 0xff;
+  detail::store_big_endian(e._current.begin, value);
+  e._current.begin += sizeof(value);
 }
 
 inline void encode(encoder& e, int32_t value) {
   if (e._current.begin + sizeof(value) > e._current.end) e._was_error = true;
   if (e._was_error) return;
 
-  *(e._current.begin++) = (value >> 24) & 0xff;
-  *(e._current.begin++) = (value >> 16) & 0xff;
-  *(e._current.begin++) = (value >> 8)  & 0xff;
-  *(e._current.begin++) = value         & 0xff;
+  detail::store_big_endian(e._current.begin, value);
+  e._current.begin += sizeof(value);
 }
 
 inline void encode(encoder& e, int64_t value) {
   if (e._current.begin + sizeof(value) > e._current.end) e._was_error = true;
   if (e._was_error) return;
 
-  *(e._current.begin++) = (value >> 56) & 0xff;
-  *(e._current.begin++) = (value >> 48) & 0xff;
-  *(e._current.begin++) = (value >> 40) & 0xff;
-  *(e._current.begin++) = (value >> 32) & 0xff;
-  *(e._current.begin++) = (value >> 24) & 0xff;
-  *(e._current.begin++) = (value >> 16) & 0xff;
-  *(e._current.begin++) = (value >> 8)  & 0xff;
-  *(e._current.begin++) = value         & 0xff;
+  detail::store_big_endian(e._current.begin, value);
+  e._current.begin += sizeof(value);
 }
 
 inline void encode(encoder& e, uint64_t value) {
   if (e._current.begin + sizeof(value) > e._current.end) e._was_error = true;
   if (e._was_error) return;
 
-  *(e._current.begin++) = (value >> 56) & 0xff;
-  *(e._current.begin++) = (value >> 48) & 0xff;
-  *(e._current.begin++) = (value >> 40) & 0xff;
-  *(e._current.begin++) = (value >> 32) & 0xff;
-  *(e._current.begin++) = (value >> 24) & 0xff;
-  *(e._current.begin++) = (value >> 16) & 0xff;
-  *(e._current.begin++) = (value >> 8)  & 0xff;
-  *(e._current.begin++) = value         & 0xff;
+  detail::store_big_endian(e._current.begin, value);
+  e._current.begin += sizeof(value);
 }
 
 template<typename T>
@@ -229,12 +216,11 @@ inline
 void encoder::put_raw(const Iterator* iter, std::size_t size) {
   static_assert(sizeof(*iter) == 1, "");
 
-  if (_current.begin + size > _current.end) _was_error = true;
-  if (_was_error) return;
+  if (size > std::size_t(_current.end - _current.begin)) _was_error = true;
+  if (_was_error || size == 0) return;
 
-  for (std::size_t i = 0; i != size; ++i) {
-    *(_current.begin++) = *(iter++);
-  }
+  std::memcpy(_current.begin, iter, size);
+  _current.begin += size;
 }
 
 inline std::ostream& operator<<(std::ostream& os, const encoder& e) {
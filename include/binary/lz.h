@@ -0,0 +1,271 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BINARY_LZ_H
+#define BINARY_LZ_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace binary { namespace lz {
+
+//------------------------------------------------------------------------------
+// A small LZ77 codec in the spirit of the LZ4 block format. Fast rather
+// than thorough, it is meant for messages of at most a few megabytes.
+//
+// The compressed data is a sequence of:
+//
+//   uint8_t  token               Literal count (high nibble) and match
+//                                length - 4 (low nibble).
+//   uint8_t  literal count[]     If the nibble is 15: bytes added to it,
+//                                the last one smaller than 255.
+//   uint8_t  literals[]
+//   uint16_t offset              Little endian, how far back the match is.
+//   uint8_t  match length[]      As with the literal count.
+//
+// The last sequence consists of the token and literals only.
+//------------------------------------------------------------------------------
+
+// Worst case size of compressed `size` bytes (incompressible input).
+inline std::size_t max_compressed_size(std::size_t size) {
+  return size + size / 255 + 16;
+}
+
+// Returns the size of the compressed data, or zero if `out_capacity`
+// wasn't enough.
+inline std::size_t compress( const std::uint8_t* in
+                           , std::size_t         in_size
+                           , std::uint8_t*       out
+                           , std::size_t         out_capacity);
+
+// Decompress into exactly `out_size` bytes. Returns false if the input
+// is malformed or doesn't decompress into exactly `out_size` bytes.
+inline bool decompress( const std::uint8_t* in
+                      , std::size_t         in_size
+                      , std::uint8_t*       out
+                      , std::size_t         out_size);
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+namespace detail {
+
+static constexpr std::size_t MIN_MATCH     = 4;
+// The end of the input is always left as literals, which saves the
+// compressor from bounds checks.
+static constexpr std::size_t LAST_LITERALS = 5;
+static constexpr std::size_t MAX_OFFSET    = 0xffff;
+static constexpr unsigned    HASH_BITS     = 12;
+
+inline std::uint32_t read32(const std::uint8_t* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint32_t hash(std::uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+class Writer {
+public:
+  Writer(std::uint8_t* out, std::size_t capacity)
+    : _begin(out), _current(out), _end(out + capacity) {}
+
+  bool error() const { return _error; }
+  std::size_t written() const { return _current - _begin; }
+
+  void put(std::uint8_t byte) {
+    if (_current == _end) { _error = true; return; }
+    *_current++ = byte;
+  }
+
+  void put(const std::uint8_t* data, std::size_t size) {
+    if (std::size_t(_end - _current) < size) { _error = true; return; }
+    std::memcpy(_current, data, size);
+    _current += size;
+  }
+
+  void put_length(std::size_t length) {
+    while (length >= 255) {
+      put(255);
+      length -= 255;
+    }
+    put(std::uint8_t(length));
+  }
+
+  void put_sequence( const std::uint8_t* literals
+                   , std::size_t         literal_count
+                   , std::size_t         offset
+                   , std::size_t         match_length) {
+    auto match_code = match_length ? match_length - MIN_MATCH : 0;
+
+    put(std::uint8_t( (std::min<std::size_t>(literal_count, 15) << 4)
+                    | std::min<std::size_t>(match_code, 15)));
+
+    if (literal_count >= 15) put_length(literal_count - 15);
+    put(literals, literal_count);
+
+    if (!match_length) return;
+
+    put(std::uint8_t(offset));
+    put(std::uint8_t(offset >> 8));
+
+    if (match_code >= 15) put_length(match_code - 15);
+  }
+
+private:
+  std::uint8_t* _begin;
+  std::uint8_t* _current;
+  std::uint8_t* _end;
+  bool          _error = false;
+};
+
+// Reads the continuation bytes of a length whose nibble was 15.
+inline bool get_length( const std::uint8_t*& in
+                      , const std::uint8_t*  end
+                      , std::size_t&         length) {
+  std::uint8_t byte;
+  do {
+    if (in == end) return false;
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+} // detail namespace
+
+//------------------------------------------------------------------------------
+inline std::size_t compress( const std::uint8_t* in
+                           , std::size_t         in_size
+                           , std::uint8_t*       out
+                           , std::size_t         out_capacity) {
+  using namespace detail;
+
+  Writer w(out, out_capacity);
+
+  std::size_t anchor = 0;
+
+  if (in_size >= MIN_MATCH + LAST_LITERALS) {
+    // Positions of the last occurrences of four byte sequences by their
+    // hash. Zero initialized, false candidates are sorted out by
+    // comparing the bytes.
+    std::uint32_t table[1 << HASH_BITS] = {};
+
+    const std::size_t limit = in_size - LAST_LITERALS;
+    std::size_t i = 0;
+
+    while (i + MIN_MATCH <= limit) {
+      auto h         = hash(read32(in + i));
+      std::size_t candidate = table[h];
+      table[h] = std::uint32_t(i);
+
+      if (candidate >= i || i - candidate > MAX_OFFSET
+          || read32(in + candidate) != read32(in + i)) {
+        // Skip faster through data which doesn't compress.
+        i += 1 + ((i - anchor) >> 6);
+        continue;
+      }
+
+      std::size_t length = MIN_MATCH;
+
+      while (i + length < limit && in[candidate + length] == in[i + length]) {
+        ++length;
+      }
+
+      w.put_sequence(in + anchor, i - anchor, i - candidate, length);
+
+      if (w.error()) return 0;
+
+      i += length;
+      anchor = i;
+    }
+  }
+
+  w.put_sequence(in + anchor, in_size - anchor, 0, 0);
+
+  return w.error() ? 0 : w.written();
+}
+
+//------------------------------------------------------------------------------
+inline bool decompress( const std::uint8_t* in
+                      , std::size_t         in_size
+                      , std::uint8_t*       out
+                      , std::size_t         out_size) {
+  using namespace detail;
+
+  const std::uint8_t* in_end  = in + in_size;
+  std::uint8_t*       current = out;
+  std::uint8_t*       out_end = out + out_size;
+
+  while (in != in_end) {
+    auto token = *in++;
+
+    std::size_t literal_count = token >> 4;
+
+    if (literal_count == 15 && !get_length(in, in_end, literal_count)) {
+      return false;
+    }
+
+    if (std::size_t(in_end - in) < literal_count
+        || std::size_t(out_end - current) < literal_count) {
+      return false;
+    }
+
+    std::memcpy(current, in, literal_count);
+    in      += literal_count;
+    current += literal_count;
+
+    // The last sequence has no match.
+    if (in == in_end) break;
+
+    if (in_end - in < 2) return false;
+
+    std::size_t offset = in[0] | (std::size_t(in[1]) << 8);
+    in += 2;
+
+    if (offset == 0 || offset > std::size_t(current - out)) {
+      return false;
+    }
+
+    std::size_t length = token & 0x0f;
+
+    if (length == 15 && !get_length(in, in_end, length)) {
+      return false;
+    }
+
+    length += MIN_MATCH;
+
+    if (std::size_t(out_end - current) < length) return false;
+
+    const std::uint8_t* match = current - offset;
+
+    if (offset >= length) {
+      std::memcpy(current, match, length);
+      current += length;
+    }
+    else {
+      // Overlapping match, repeats the last `offset` bytes.
+      while (length--) *current++ = *match++;
+    }
+  }
+
+  return current == out_end;
+}
+
+}} // namespaces
+
+#endif // ifndef BINARY_LZ_H
@@ -15,11 +15,43 @@
 #pragma once
 
 #include <binary/decoder.h>
+#include <binary/encoded.h>
 #include <boost/container/flat_set.hpp>
 #include "debug/ASSERT.h"
 
 namespace boost { namespace container {
 
+//------------------------------------------------------------------------------
+namespace detail_flat_set {
+  // The elements of a flat_set are contiguous, so a set of e.g. uuids
+  // is one memcpy.
+  template<typename Encoder, class T>
+  inline void put_items(Encoder& e, const flat_set<T>& set, std::true_type) {
+    if (set.empty()) return;
+    e.put_raw( reinterpret_cast<const uint8_t*>(&*set.begin())
+             , set.size() * sizeof(T));
+  }
+
+  template<typename Encoder, class T>
+  inline void put_items(Encoder& e, const flat_set<T>& set, std::false_type) {
+    for (const auto& item : set) {
+      e.template put(item);
+    }
+  }
+
+  template<class T>
+  inline T get_item(binary::decoder& d, std::true_type) {
+    T value;
+    d.get_raw(reinterpret_cast<uint8_t*>(&value), sizeof(T));
+    return value;
+  }
+
+  template<class T>
+  inline T get_item(binary::decoder& d, std::false_type) {
+    return d.get<T>();
+  }
+} // detail_flat_set namespace
+
 //------------------------------------------------------------------------------
 template<typename Encoder, class T>
 inline void encode( Encoder& e
@@ -31,9 +63,7 @@ inline void encode( Encoder& e
 
   e.template put((uint32_t) set.size());
 
-  for (const auto& item : set) {
-    e.template put(item);
-  }
+  detail_flat_set::put_items(e, set, binary::is_raw<T>());
 }
 
 //------------------------------------------------------------------------------
@@ -51,13 +81,21 @@ inline void decode( binary::decoder& d
     return d.set_error();
   }
 
+  using IsRaw = binary::is_raw<T>;
+
+  // Raw elements have a known size, so one check covers all of them.
+  if (IsRaw::value && uint64_t(size) * sizeof(T) > d.size()) {
+    return d.set_error();
+  }
+
   set.clear();
   set.reserve(size);
 
   for (uint32_t i = 0; i < size; ++i) {
-    auto value = d.get<T>();
+    auto value = detail_flat_set::get_item<T>(d, IsRaw());
     if (d.error()) break;
-    set.insert(value);
+    // Sets are encoded in order, which makes this O(1).
+    set.insert(set.end(), value);
   }
 }
 
@@ -26,19 +26,19 @@ struct encoded<boost::uuids::uuid> {
   static size_t size() { return boost::uuids::uuid::static_size(); }
 };
 
+template<> struct is_raw<boost::uuids::uuid> : std::true_type {};
+
 } // binary namespace
 
 namespace boost { namespace uuids {
 
 template<typename Encoder>
-inline void encode(Encoder& e, boost::uuids::uuid uuid) {
-  for (auto i : uuid) { e.template put(i); }
+inline void encode(Encoder& e, const boost::uuids::uuid& uuid) {
+  e.put_raw(uuid.data, uuid.static_size());
 }
 
 inline void decode(binary::decoder& d, boost::uuids::uuid& uuid) {
-  for (auto& i : uuid) {
-    i = d.get<std::remove_reference<decltype(i)>::type>();
-  }
+  d.get_raw(uuid.data, uuid.static_size());
 }
 
 }} // boost::uuids namespace
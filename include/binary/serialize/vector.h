@@ -18,40 +18,60 @@
 #include <vector>
 #include <assert.h>
 #include "binary/decoder.h"
+#include "binary/encoded.h"
+#include "debug/ASSERT.h"
 
 namespace std {
 
 //------------------------------------------------------------------------------
-template<typename Encoder, class T>
-  inline void encode( Encoder& e
-                    , const std::vector<T>& vector
-                    , size_t max_size = std::numeric_limits<uint32_t>::max()) {
-    using namespace boost;
-
-    ASSERT(vector.size() < max_size);
-
-    e.template put<uint32_t>(vector.size());
+namespace detail_vector {
+  template<typename Encoder, class T>
+  inline void put_items(Encoder& e, const std::vector<T>& vector, std::true_type) {
+    e.put_raw( reinterpret_cast<const uint8_t*>(vector.data())
+             , vector.size() * sizeof(T));
+  }
 
+  template<typename Encoder, class T>
+  inline void put_items(Encoder& e, const std::vector<T>& vector, std::false_type) {
     for (const auto& item : vector) {
       e.template put<typename std::decay<T>::type>(item);
     }
   }
 
+  template<class T>
+  inline void get_items(binary::decoder& d, std::vector<T>& vector, uint32_t size, std::true_type) {
+    if (uint64_t(size) * sizeof(T) > d.size()) {
+      return d.set_error();
+    }
+
+    vector.resize(size);
+    d.get_raw(reinterpret_cast<uint8_t*>(vector.data()), size * sizeof(T));
+  }
+
+  template<class T>
+  inline void get_items(binary::decoder& d, std::vector<T>& vector, uint32_t size, std::false_type) {
+    vector.reserve(size);
+
+    for (uint32_t i = 0; i < size; ++i) {
+      vector.push_back(d.get<T>());
+      if (d.error()) break;
+    }
+  }
+} // detail_vector namespace
+
 //------------------------------------------------------------------------------
-// TODO: Why doesn't the above use cover this special case?
-template<typename Encoder>
+template<typename Encoder, class T>
   inline void encode( Encoder& e
-                    , const std::vector<char>& vector
+                    , const std::vector<T>& vector
                     , size_t max_size = std::numeric_limits<uint32_t>::max()) {
     using namespace boost;
 
-    assert(vector.size() < max_size);
+    ASSERT(vector.size() < max_size);
 
     e.template put<uint32_t>(vector.size());
 
-    for (auto item : vector) {
-      e.template put(item);
-    }
+    // Vectors of bytes (e.g. user data) and uuids are copied in one go.
+    detail_vector::put_items(e, vector, binary::is_raw<T>());
   }
 
 //------------------------------------------------------------------------------
@@ -70,12 +90,8 @@ inline void decode( binary::decoder& d
   }
 
   vector.clear();
-  vector.reserve(size);
 
-  for (uint32_t i = 0; i < size; ++i) {
-    vector.push_back(d.get<T>());
-    if (d.error()) break;
-  }
+  detail_vector::get_items(d, vector, size, binary::is_raw<T>());
 }
 
 //------------------------------------------------------------------------------
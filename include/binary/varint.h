@@ -0,0 +1,112 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BINARY_VARINT_H
+#define BINARY_VARINT_H
+
+#include <limits>
+#include <type_traits>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+
+namespace binary {
+
+//------------------------------------------------------------------------------
+// Unsigned integer encoded in as few bytes as its value needs (LEB128):
+// seven bits per byte, least significant group first, the high bit set
+// on all but the last byte. Values below 128 take a single byte.
+//
+//   e.put(binary::varint<uint32_t>(n));
+//   auto n = d.get<binary::varint<uint32_t>>().value;
+template<class T>
+struct varint {
+  static_assert(std::is_unsigned<T>::value, "");
+
+  // Longest encoding of a T.
+  static constexpr std::size_t max_size = (sizeof(T) * 8 + 6) / 7;
+
+  T value;
+
+  varint() : value(0) {}
+  explicit varint(T v) : value(v) {}
+};
+
+//------------------------------------------------------------------------------
+inline std::size_t varint_size(std::uint64_t value) {
+  std::size_t size = 1;
+  while (value >= 0x80) { value >>= 7; ++size; }
+  return size;
+}
+
+//------------------------------------------------------------------------------
+// Map signed integers to unsigned ones so that values close to zero
+// (of either sign) get short varint encodings: 0, -1, 1, -2, ...
+inline std::uint64_t zigzag_encode(std::int64_t v) {
+  return (std::uint64_t(v) << 1) ^ std::uint64_t(v >> 63);
+}
+
+inline std::int64_t zigzag_decode(std::uint64_t v) {
+  return std::int64_t(v >> 1) ^ -std::int64_t(v & 1);
+}
+
+//------------------------------------------------------------------------------
+template<class Encoder, class T>
+inline void encode(Encoder& e, const varint<T>& v) {
+  std::uint8_t bytes[varint<T>::max_size];
+  std::size_t  size  = 0;
+  T            value = v.value;
+
+  while (value >= 0x80) {
+    bytes[size++] = std::uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+
+  bytes[size++] = std::uint8_t(value);
+
+  e.put_raw(bytes, size);
+}
+
+//------------------------------------------------------------------------------
+// Encodings longer than max_size or with bits that don't fit into T are
+// errors.
+template<class T>
+inline void decode(decoder& d, varint<T>& v) {
+  T value = 0;
+
+  for (std::size_t i = 0; i < varint<T>::max_size; ++i) {
+    auto byte  = d.get<std::uint8_t>();
+    auto shift = 7 * i;
+
+    if (d.error()) return;
+
+    T group = byte & 0x7f;
+
+    if (shift && (group >> (sizeof(T) * 8 - shift))) {
+      return d.set_error();
+    }
+
+    value |= group << shift;
+
+    if (!(byte & 0x80)) {
+      v.value = value;
+      return;
+    }
+  }
+
+  d.set_error();
+}
+
+} // binary namespace
+
+#endif // ifndef BINARY_VARINT_H
@@ -0,0 +1,197 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_INLINE_FUNCTION_H
+#define CLUB_INLINE_FUNCTION_H
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace club {
+
+// A move-only replacement of std::function which stores callables of up
+// to `Capacity` bytes (e.g. lambdas capturing a few shared_ptrs) inside
+// the object instead of on the heap. Bigger callables still work, they're
+// just allocated. Like std::function, a moved-from object is empty.
+template<class Signature, size_t Capacity = 64>
+class InlineFunction;
+
+template<class R, class... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+  using Storage = typename std::aligned_storage<Capacity>::type;
+
+  struct Ops {
+    R    (*invoke)(Storage&, Args&&...);
+    void (*move)(Storage& from, Storage& to);
+    void (*destroy)(Storage&);
+  };
+
+  template<class F> struct Inline;
+  template<class F> struct Allocated;
+
+  template<class F>
+  using Stored = typename std::conditional
+                   < sizeof(F) <= sizeof(Storage)
+                     && alignof(Storage) % alignof(F) == 0
+                     && std::is_nothrow_move_constructible<F>::value
+                   , Inline<F>
+                   , Allocated<F>>::type;
+
+  template<class F>
+  using EnableIfCallable = typename std::enable_if
+      < !std::is_same<typename std::decay<F>::type, InlineFunction>::value
+      >::type;
+
+public:
+  InlineFunction() = default;
+  InlineFunction(std::nullptr_t) {}
+
+  template<class F, class = EnableIfCallable<F>>
+  InlineFunction(F&& f) { assign(std::forward<F>(f)); }
+
+  // Callables are only stored inline if their move can't throw.
+  InlineFunction(InlineFunction&& other) noexcept { move_from(other); }
+
+  InlineFunction& operator=(InlineFunction&& other) noexcept {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  template<class F, class = EnableIfCallable<F>>
+  InlineFunction& operator=(F&& f) {
+    // `f` may be owned by the function we're replacing.
+    InlineFunction tmp(std::forward<F>(f));
+    return *this = std::move(tmp);
+  }
+
+  InlineFunction& operator=(std::nullptr_t) { reset(); return *this; }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  ~InlineFunction() { reset(); }
+
+  explicit operator bool() const { return _ops != nullptr; }
+
+  R operator()(Args... args) const {
+    assert(_ops);
+    return _ops->invoke(_storage, std::forward<Args>(args)...);
+  }
+
+  // True if a callable of type F would be stored without allocation.
+  template<class F> static constexpr bool is_inline() {
+    return std::is_same<Stored<F>, Inline<F>>::value;
+  }
+
+private:
+  template<class F> void assign(F&& f) {
+    using D = typename std::decay<F>::type;
+    if (is_empty(f)) return;
+    Stored<D>::construct(_storage, std::forward<F>(f));
+    _ops = &Stored<D>::ops;
+  }
+
+  void move_from(InlineFunction& other) {
+    if (!other._ops) return;
+    other._ops->move(other._storage, _storage);
+    _ops = other._ops;
+    other._ops = nullptr;
+  }
+
+  void reset() {
+    if (!_ops) return;
+    auto ops = _ops;
+    _ops = nullptr;
+    ops->destroy(_storage);
+  }
+
+  template<class F> static bool is_empty(const F&) { return false; }
+  template<class S> static bool is_empty(const std::function<S>& f) { return !f; }
+
+private:
+  const Ops*      _ops = nullptr;
+  mutable Storage _storage;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+template<class R, class... Args, size_t Capacity>
+template<class F>
+struct InlineFunction<R(Args...), Capacity>::Inline {
+  static F& get(Storage& s) { return *reinterpret_cast<F*>(&s); }
+
+  template<class G> static void construct(Storage& s, G&& f) {
+    new (&s) F(std::forward<G>(f));
+  }
+
+  static R invoke(Storage& s, Args&&... args) {
+    return get(s)(std::forward<Args>(args)...);
+  }
+
+  static void move(Storage& from, Storage& to) {
+    new (&to) F(std::move(get(from)));
+    get(from).~F();
+  }
+
+  static void destroy(Storage& s) { get(s).~F(); }
+
+  static const Ops ops;
+};
+
+template<class R, class... Args, size_t Capacity>
+template<class F>
+const typename InlineFunction<R(Args...), Capacity>::Ops
+InlineFunction<R(Args...), Capacity>::Inline<F>::ops
+  = { &invoke, &move, &destroy };
+
+//------------------------------------------------------------------------------
+template<class R, class... Args, size_t Capacity>
+template<class F>
+struct InlineFunction<R(Args...), Capacity>::Allocated {
+  static F*& get(Storage& s) { return *reinterpret_cast<F**>(&s); }
+
+  template<class G> static void construct(Storage& s, G&& f) {
+    new (&s) F*(new F(std::forward<G>(f)));
+  }
+
+  static R invoke(Storage& s, Args&&... args) {
+    return (*get(s))(std::forward<Args>(args)...);
+  }
+
+  static void move(Storage& from, Storage& to) {
+    new (&to) F*(get(from));
+  }
+
+  static void destroy(Storage& s) { delete get(s); }
+
+  static const Ops ops;
+};
+
+template<class R, class... Args, size_t Capacity>
+template<class F>
+const typename InlineFunction<R(Args...), Capacity>::Ops
+InlineFunction<R(Args...), Capacity>::Allocated<F>::ops
+  = { &invoke, &move, &destroy };
+
+} // namespace
+
+#endif // ifndef CLUB_INLINE_FUNCTION_H
@@ -0,0 +1,112 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_RECYCLING_ALLOCATOR_H
+#define CLUB_RECYCLING_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+namespace club {
+
+// Allocator of single objects which keeps the memory of freed ones on
+// a per thread list and hands it out again, so that once enough of them
+// were allocated (e.g. with std::allocate_shared) no more memory is taken
+// from the heap. Memory may be freed on a different thread than it was
+// allocated on, it then simply moves to that thread's list.
+template<class T>
+class RecyclingAllocator {
+public:
+  using value_type = T;
+
+  // Freed blocks above this count go back to the heap.
+  static constexpr size_t max_free = 256;
+
+  RecyclingAllocator() = default;
+
+  template<class U>
+  RecyclingAllocator(const RecyclingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+
+    auto& free = free_list();
+
+    if (!free.first) {
+      return static_cast<T*>(::operator new(block_size));
+    }
+
+    auto b = free.first;
+    free.first = b->next;
+    --free.size;
+
+    return reinterpret_cast<T*>(b);
+  }
+
+  void deallocate(T* p, size_t n) {
+    auto& free = free_list();
+
+    if (n != 1 || free.size == max_free) {
+      return ::operator delete(p);
+    }
+
+    auto b = reinterpret_cast<Block*>(p);
+    b->next = free.first;
+    free.first = b;
+    ++free.size;
+  }
+
+private:
+  struct Block {
+    Block* next;
+  };
+
+  static_assert( alignof(T) <= alignof(std::max_align_t)
+               , "Over-aligned types aren't supported");
+
+  static constexpr size_t block_size = sizeof(T) > sizeof(Block)
+                                     ? sizeof(T) : sizeof(Block);
+
+  struct FreeList {
+    Block* first = nullptr;
+    size_t size  = 0;
+
+    ~FreeList() {
+      while (first) {
+        auto next = first->next;
+        ::operator delete(first);
+        first = next;
+      }
+    }
+  };
+
+  static FreeList& free_list() {
+    thread_local FreeList list;
+    return list;
+  }
+};
+
+template<class T, class U>
+bool operator==(const RecyclingAllocator<T>&, const RecyclingAllocator<U>&) {
+  return true;
+}
+
+template<class T, class U>
+bool operator!=(const RecyclingAllocator<T>&, const RecyclingAllocator<U>&) {
+  return false;
+}
+
+} // club namespace
+
+#endif // ifndef CLUB_RECYCLING_ALLOCATOR_H
@@ -0,0 +1,116 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_RING_BUFFER_H
+#define CLUB_RING_BUFFER_H
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include <boost/optional.hpp>
+
+namespace club {
+
+// A double ended queue stored in one contiguous block of memory. Elements
+// are addressed by their distance from the front. The capacity is always
+// a power of two and grows as needed.
+template<class T>
+class RingBuffer {
+public:
+  bool   empty()    const { return _size == 0; }
+  size_t size()     const { return _size; }
+  size_t capacity() const { return _slots.size(); }
+
+  T& operator[](size_t i) { assert(i < _size); return *_slots[index(i)]; }
+  const T& operator[](size_t i) const { assert(i < _size); return *_slots[index(i)]; }
+
+  T& front() { return (*this)[0]; }
+  T& back()  { return (*this)[_size - 1]; }
+
+  const T& front() const { return (*this)[0]; }
+  const T& back()  const { return (*this)[_size - 1]; }
+
+  void push_back(T);
+  void push_front(T);
+  void pop_front();
+  void pop_back();
+  void clear();
+
+private:
+  size_t index(size_t i) const { return (_head + i) & (_slots.size() - 1); }
+  void grow();
+
+private:
+  std::vector<boost::optional<T>> _slots;
+  size_t _head = 0;
+  size_t _size = 0;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+template<class T>
+void RingBuffer<T>::push_back(T v) {
+  if (_size == _slots.size()) grow();
+  _slots[index(_size)].emplace(std::move(v));
+  ++_size;
+}
+
+template<class T>
+void RingBuffer<T>::push_front(T v) {
+  if (_size == _slots.size()) grow();
+  _head = (_head + _slots.size() - 1) & (_slots.size() - 1);
+  _slots[_head].emplace(std::move(v));
+  ++_size;
+}
+
+template<class T>
+void RingBuffer<T>::pop_front() {
+  assert(_size);
+  _slots[_head] = boost::none;
+  _head = index(1);
+  --_size;
+}
+
+template<class T>
+void RingBuffer<T>::pop_back() {
+  assert(_size);
+  _slots[index(_size - 1)] = boost::none;
+  --_size;
+}
+
+template<class T>
+void RingBuffer<T>::clear() {
+  while (!empty()) pop_front();
+  _head = 0;
+}
+
+//------------------------------------------------------------------------------
+template<class T>
+void RingBuffer<T>::grow() {
+  std::vector<boost::optional<T>> slots(std::max<size_t>(8, 2*_slots.size()));
+
+  for (size_t i = 0; i < _size; ++i) {
+    slots[i] = std::move(_slots[index(i)]);
+  }
+
+  _slots = std::move(slots);
+  _head  = 0;
+}
+
+//------------------------------------------------------------------------------
+
+} // club namespace
+
+#endif // ifndef CLUB_RING_BUFFER_H
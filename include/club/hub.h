@@ -19,6 +19,7 @@
 #include <list>
 #include <boost/asio.hpp>
 #include <boost/container/flat_map.hpp>
+#include <boost/optional.hpp>
 #include <binary/decoder.h>
 
 #include "club/graph.h"
@@ -142,6 +143,13 @@ public:
   /// that another call to `unreliable_broadcast` function can be made.
   void unreliable_broadcast(Bytes, std::function<void()> on_broadcast);
 
+  /// Compress reliable messages (such as those sent with
+  /// `total_order_broadcast`) of at least `min_size` bytes before sending
+  /// them to nodes which have enabled compression as well. Nodes tell each
+  /// other about it when they `fuse`, so this should be called before
+  /// fusing. Compression is disabled by default.
+  void enable_compression(size_t min_size = 256);
+
   boost::asio::io_service& get_io_service() { return _io_service; }
   uuid                     id()    const    { return _id; }
 
@@ -159,7 +167,7 @@ private:
   void on_recv_raw(Node&, boost::asio::const_buffer&);
   void node_received_unreliable_broadcast(boost::asio::const_buffer);
 
-  template<class Message> void on_recv(Node&, Message);
+  template<class View> void on_recv(Node&, View);
   template<class Message> void parse_message(Node&, binary::decoder&);
 
   void process(Node&, Fuse);
@@ -214,6 +222,7 @@ private:
   TimeStamp                              _time_stamp;
   std::unique_ptr<BroadcastRoutingTable> _broadcast_routing_table;
   std::shared_ptr<bool>                  _was_destroyed;
+  boost::optional<size_t>                _compress_min_size;
 
   // TODO: This must be refactored, otherwise the memory will grow indefinitely.
   //       Luckily reconfiguration doesn't happen too often, so for apps that
@@ -0,0 +1,309 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_MULTIPLEXER_H
+#define CLUB_MULTIPLEXER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/strand.hpp>
+#include <async/handler_memory.h>
+#include <club/transport/connection_id.h>
+#include <club/transport/path_mtu.h>
+#include <binary/decoder.h>
+
+namespace club {
+
+// A shared endpoint that owns one UDP socket and lets many club::Socket
+// connections use it. Incoming packets are dispatched to the connection
+// whose id is in the packet header, or (before the peer has learned our
+// connection id) by the remote endpoint.
+//
+// The multiplexer and all the sockets using it run their handlers in
+// one strand.
+//
+// Several multiplexers may share one UDP port as shards of
+// a ShardedMultiplexer, packets are then passed to the shard of the
+// connection they belong to.
+class Multiplexer : public std::enable_shared_from_this<Multiplexer> {
+  using udp = boost::asio::ip::udp;
+  using error_code = boost::system::error_code;
+
+public:
+  using ConnectionId = transport::ConnectionId;
+
+  // Executed with each packet destined to the connection. Only the first
+  // `size` bytes of the packet were received, the rest of the vector is
+  // garbage. On error (the shared socket failed or was closed) the packet
+  // is empty.
+  using OnPacket = std::function<void( const error_code&
+                                     , const udp::endpoint&
+                                     , const std::vector<uint8_t>&
+                                     , size_t size)>;
+
+public:
+  /// Create and open the multiplexer on a random UDP port.
+  Multiplexer(boost::asio::io_service&);
+
+  /// Create the multiplexer.
+  /// \param udp_socket is expected to be open.
+  Multiplexer(udp::socket);
+
+  Multiplexer(const Multiplexer&) = delete;
+  Multiplexer& operator=(const Multiplexer&) = delete;
+
+  ~Multiplexer();
+
+  udp::endpoint local_endpoint() const { return _socket.local_endpoint(); }
+
+  /// Number of connections currently using this multiplexer.
+  size_t size() const { return _connections.size(); }
+
+  /// Close the underlying UDP socket, all the connections using it
+  /// shall fail.
+  void close();
+
+  boost::asio::io_service& get_io_service() {
+    return _socket.get_io_service();
+  }
+
+  udp::socket& get_socket_impl() { return _socket; }
+
+  boost::asio::io_service::strand& strand() { return _strand; }
+
+  //----------------------------------------------------------------------------
+  // Interface used by SocketImpl.
+  ConnectionId add_connection(OnPacket);
+  void remove_connection(ConnectionId);
+
+  // Route packets without a connection id coming from `remote` to
+  // the connection `id`.
+  void expect(udp::endpoint remote, ConnectionId id);
+
+private:
+  friend class ShardedMultiplexer;
+
+  // Set by ShardedMultiplexer. Connection ids of the shard `index` are
+  // those equal to `index` modulo `count`, packets of other connections
+  // (or from unknown endpoints) are given to `forward`.
+  struct Shard {
+    using Forward = std::function<void( ConnectionId
+                                      , const udp::endpoint&
+                                      , std::vector<uint8_t>)>;
+
+    size_t  index;
+    size_t  count;
+    Forward forward;
+
+    std::function<void(const udp::endpoint&)> on_expect;
+    std::function<void(const udp::endpoint&)> on_forget;
+  };
+
+  // Executed in our strand with a packet received by another shard.
+  void on_forwarded( ConnectionId
+                   , const udp::endpoint&
+                   , const std::vector<uint8_t>&);
+
+  void start_receiving();
+  void on_receive(const error_code&, size_t);
+  void dispatch( ConnectionId
+               , const error_code&
+               , const udp::endpoint&
+               , const std::vector<uint8_t>&
+               , size_t);
+
+  bool is_ours(ConnectionId id) const {
+    return !_shard || id % _shard->count == _shard->index;
+  }
+
+private:
+  using Connections = std::map<ConnectionId, std::shared_ptr<OnPacket>>;
+
+  boost::asio::io_service::strand       _strand;
+  udp::socket                           _socket;
+  bool                                  _is_receiving = false;
+  Connections                           _connections;
+  std::map<udp::endpoint, ConnectionId> _by_endpoint;
+  ConnectionId                          _next_id;
+
+  udp::endpoint         _rx_endpoint;
+  std::vector<uint8_t>  _rx_buffer;
+  async::handler_memory _rx_handler_memory;
+
+  std::unique_ptr<Shard> _shard;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline
+Multiplexer::Multiplexer(boost::asio::io_service& ios)
+  : Multiplexer(udp::socket(ios, udp::endpoint(udp::v4(), 0)))
+{}
+
+inline
+Multiplexer::Multiplexer(udp::socket socket)
+  : _strand(socket.get_io_service())
+  , _socket(std::move(socket))
+  , _next_id(std::random_device()())
+  , _rx_buffer(transport::PathMtu::MAX())
+{}
+
+inline
+Multiplexer::~Multiplexer() {
+  close();
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::close() {
+  if (_socket.is_open()) _socket.close();
+}
+
+//------------------------------------------------------------------------------
+inline
+Multiplexer::ConnectionId Multiplexer::add_connection(OnPacket on_packet) {
+  // Don't reuse ids of recently closed connections so that their late
+  // packets are not delivered to someone else.
+  while (_next_id == transport::no_connection_id
+      || _connections.count(_next_id)
+      || !is_ours(_next_id)) {
+    ++_next_id;
+  }
+
+  auto id = _next_id++;
+
+  _connections.emplace(id, std::make_shared<OnPacket>(std::move(on_packet)));
+
+  if (!_is_receiving) start_receiving();
+
+  return id;
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::remove_connection(ConnectionId id) {
+  _connections.erase(id);
+
+  for (auto i = _by_endpoint.begin(); i != _by_endpoint.end();) {
+    if (i->second == id) {
+      if (_shard) _shard->on_forget(i->first);
+      i = _by_endpoint.erase(i);
+    }
+    else ++i;
+  }
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::expect(udp::endpoint remote, ConnectionId id) {
+  _by_endpoint[remote] = id;
+  if (_shard) _shard->on_expect(remote);
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::start_receiving() {
+  if (!_socket.is_open()) return;
+
+  _is_receiving = true;
+
+  // The connections keep us alive, once the last one is gone and the user
+  // has released us, the destructor closes the socket and aborts this.
+  std::weak_ptr<Multiplexer> weak_self = shared_from_this();
+
+  _socket.async_receive_from
+      ( boost::asio::buffer(_rx_buffer)
+      , _rx_endpoint
+      , _strand.wrap(async::make_custom_alloc_handler
+          ( _rx_handler_memory
+          , [weak_self](const error_code& e, std::size_t size) {
+              if (auto self = weak_self.lock()) {
+                self->on_receive(e, size);
+              }
+            })));
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::on_receive(const error_code& error, size_t size) {
+  _is_receiving = false;
+
+  if (error) {
+    // Handlers may remove themselves from _connections.
+    auto connections = _connections;
+    for (auto& c : connections) {
+      dispatch(c.first, error, _rx_endpoint, std::vector<uint8_t>(), 0);
+    }
+    return;
+  }
+
+  binary::decoder d(_rx_buffer.data(), size);
+  auto id = d.get<ConnectionId>();
+
+  if (!d.error()) {
+    if (id == transport::no_connection_id) {
+      auto i = _by_endpoint.find(_rx_endpoint);
+      if (i != _by_endpoint.end()) id = i->second;
+    }
+
+    bool is_foreign = id == transport::no_connection_id
+                   || (!is_ours(id) && !_connections.count(id));
+
+    if (_shard && is_foreign) {
+      _shard->forward( id
+                     , _rx_endpoint
+                     , std::vector<uint8_t>( _rx_buffer.begin()
+                                           , _rx_buffer.begin() + size));
+    }
+    else {
+      dispatch(id, error, _rx_endpoint, _rx_buffer, size);
+    }
+  }
+
+  if (!_connections.empty() || _shard) start_receiving();
+}
+
+//------------------------------------------------------------------------------
+inline
+void Multiplexer::on_forwarded( ConnectionId id
+                              , const udp::endpoint& source
+                              , const std::vector<uint8_t>& packet) {
+  if (id == transport::no_connection_id) {
+    auto i = _by_endpoint.find(source);
+    if (i == _by_endpoint.end()) return;
+    id = i->second;
+  }
+
+  dispatch(id, error_code(), source, packet, packet.size());
+}
+
+//------------------------------------------------------------------------------
+inline void Multiplexer::dispatch( ConnectionId id
+                                 , const error_code& error
+                                 , const udp::endpoint& source
+                                 , const std::vector<uint8_t>& packet
+                                 , size_t size) {
+  auto i = _connections.find(id);
+  if (i == _connections.end()) return;
+
+  // The handler may remove the connection.
+  auto on_packet = i->second;
+
+  (*on_packet)(error, source, packet, size);
+}
+
+//------------------------------------------------------------------------------
+
+} // club namespace
+
+#endif // ifndef CLUB_MULTIPLEXER_H
@@ -0,0 +1,251 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_SHARDED_MULTIPLEXER_H
+#define CLUB_SHARDED_MULTIPLEXER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <boost/asio/io_service.hpp>
+#include <club/multiplexer.h>
+
+#if defined(SO_REUSEPORT)
+#  define CLUB_HAS_REUSEPORT 1
+#else
+#  define CLUB_HAS_REUSEPORT 0
+#endif
+
+namespace club {
+
+// Spreads connections sharing one UDP port over several threads. Each
+// shard is a Multiplexer with its own UDP socket (all bound to the same
+// port with SO_REUSEPORT), io_service and thread.
+//
+// The kernel picks the socket an incoming packet lands on by hashing
+// the source and destination addresses, which need not be the shard the
+// receiving connection lives in. Connection ids tell the shard (see
+// Multiplexer::Shard), so such packets are passed over to the right one.
+// Packets without a connection id are routed by their source endpoint.
+//
+// Everything using a shard's Multiplexer (its sockets and any hub fusing
+// them) must run in that shard: create them in a handler given to
+// `post` and don't share them between shards. Shards only exchange
+// packets, never connection state.
+//
+// Without SO_REUSEPORT there is only one shard.
+class ShardedMultiplexer {
+  using udp = boost::asio::ip::udp;
+
+public:
+  /// Start `shard_count` shards on `port` (a random one if zero).
+  ShardedMultiplexer(size_t shard_count, unsigned short port = 0);
+
+  ShardedMultiplexer(const ShardedMultiplexer&) = delete;
+  ShardedMultiplexer& operator=(const ShardedMultiplexer&) = delete;
+
+  /// Stop and join the threads. Sockets using the shards must have been
+  /// destroyed by now.
+  ~ShardedMultiplexer();
+
+  size_t size() const { return _shards.size(); }
+
+  udp::endpoint local_endpoint() const;
+
+  /// Execute `f(std::shared_ptr<Multiplexer>)` in the strand of the
+  /// shard `i`.
+  template<class F> void post(size_t i, F&& f);
+
+  /// Execute `f(std::shared_ptr<Multiplexer>)` in the next shard in
+  /// a round robin fashion. This is how new connections are spread.
+  template<class F> void post(F&& f);
+
+  boost::asio::io_service& get_io_service(size_t i) {
+    return _shards[i]->io_service;
+  }
+
+  /// Close the UDP sockets (connections fail) and let the threads
+  /// finish once they run out of work.
+  void close();
+
+private:
+  struct Shard {
+    boost::asio::io_service                        io_service;
+    std::unique_ptr<boost::asio::io_service::work> work;
+    std::shared_ptr<Multiplexer>                   multiplexer;
+    std::thread                                    thread;
+  };
+
+  static udp::socket open_socket(boost::asio::io_service&, unsigned short port);
+
+  void forward( size_t from
+              , Multiplexer::ConnectionId
+              , const udp::endpoint&
+              , std::vector<uint8_t>);
+
+private:
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::atomic<size_t>                 _next_shard{0};
+
+  // Which shard expects packets without a connection id from an endpoint.
+  std::mutex                     _mutex;
+  std::map<udp::endpoint, size_t> _by_endpoint;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline
+ShardedMultiplexer::ShardedMultiplexer(size_t shard_count, unsigned short port) {
+  if (!CLUB_HAS_REUSEPORT) shard_count = 1;
+
+  shard_count = std::max<size_t>(shard_count, 1);
+
+  for (size_t i = 0; i < shard_count; ++i) {
+    _shards.emplace_back(new Shard());
+    auto& shard = *_shards.back();
+
+    shard.work.reset(new boost::asio::io_service::work(shard.io_service));
+
+    auto socket = open_socket(shard.io_service, port);
+    // All the others bind to the port the first one got.
+    port = socket.local_endpoint().port();
+
+    shard.multiplexer = std::make_shared<Multiplexer>(std::move(socket));
+
+    auto s = std::unique_ptr<Multiplexer::Shard>(new Multiplexer::Shard());
+
+    s->index = i;
+    s->count = shard_count;
+
+    s->forward = [this, i]( Multiplexer::ConnectionId id
+                          , const udp::endpoint& source
+                          , std::vector<uint8_t> packet) {
+      forward(i, id, source, std::move(packet));
+    };
+
+    s->on_expect = [this, i](const udp::endpoint& remote) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _by_endpoint[remote] = i;
+    };
+
+    s->on_forget = [this, i](const udp::endpoint& remote) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      auto j = _by_endpoint.find(remote);
+      if (j != _by_endpoint.end() && j->second == i) _by_endpoint.erase(j);
+    };
+
+    shard.multiplexer->_shard = std::move(s);
+  }
+
+  for (auto& shard : _shards) {
+    auto m = shard->multiplexer;
+    m->strand().post([m]() { m->start_receiving(); });
+
+    auto ios = &shard->io_service;
+    shard->thread = std::thread([ios]() { ios->run(); });
+  }
+}
+
+//------------------------------------------------------------------------------
+inline ShardedMultiplexer::~ShardedMultiplexer() {
+  close();
+
+  for (auto& shard : _shards) {
+    if (shard->thread.joinable()) shard->thread.join();
+  }
+}
+
+//------------------------------------------------------------------------------
+inline
+ShardedMultiplexer::udp::socket
+ShardedMultiplexer::open_socket( boost::asio::io_service& ios
+                               , unsigned short port) {
+  udp::socket socket(ios);
+
+  socket.open(udp::v4());
+
+#if CLUB_HAS_REUSEPORT
+  using reuse_port = boost::asio::detail::socket_option::boolean
+                       <SOL_SOCKET, SO_REUSEPORT>;
+  socket.set_option(reuse_port(true));
+#endif
+
+  socket.bind(udp::endpoint(udp::v4(), port));
+
+  return socket;
+}
+
+//------------------------------------------------------------------------------
+inline ShardedMultiplexer::udp::endpoint
+ShardedMultiplexer::local_endpoint() const {
+  return _shards.front()->multiplexer->local_endpoint();
+}
+
+//------------------------------------------------------------------------------
+template<class F> inline void ShardedMultiplexer::post(size_t i, F&& f) {
+  auto m = _shards[i]->multiplexer;
+  m->strand().post([m, f = std::forward<F>(f)]() mutable { f(m); });
+}
+
+//------------------------------------------------------------------------------
+template<class F> inline void ShardedMultiplexer::post(F&& f) {
+  post(_next_shard++ % _shards.size(), std::forward<F>(f));
+}
+
+//------------------------------------------------------------------------------
+inline void ShardedMultiplexer::close() {
+  for (auto& shard : _shards) {
+    auto m = shard->multiplexer;
+    m->strand().post([m]() { m->close(); });
+    shard->work.reset();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Executed in the strand of the shard `from`.
+inline void ShardedMultiplexer::forward( size_t from
+                                       , Multiplexer::ConnectionId id
+                                       , const udp::endpoint& source
+                                       , std::vector<uint8_t> packet) {
+  size_t to;
+
+  if (id != transport::no_connection_id) {
+    to = id % _shards.size();
+  }
+  else {
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto i = _by_endpoint.find(source);
+    if (i == _by_endpoint.end()) return;
+    to = i->second;
+  }
+
+  // Not known in its own shard either.
+  if (to == from) return;
+
+  auto m = _shards[to]->multiplexer;
+
+  m->strand().post([ m
+                   , id
+                   , source
+                   , packet = std::move(packet)]() {
+      m->on_forwarded(id, source, packet);
+    });
+}
+
+//------------------------------------------------------------------------------
+
+} // club namespace
+
+#endif // ifndef CLUB_SHARDED_MULTIPLEXER_H
@@ -17,33 +17,53 @@
 
 #include <iostream>
 #include <array>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/strand.hpp>
 #include <club/transport/transmit_queue.h>
 #include <club/debug/ostream_uuid.h>
 #include <club/transport/out_message.h>
+#include <club/transport/out_stream.h>
+#include <club/transport/channel.h>
 #include <async/alarm.h>
+#include <async/handler_memory.h>
+#include <club/generic/inline_function.h>
+#include <club/generic/recycling_allocator.h>
 #include <club/transport/error.h>
 #include <club/transport/punch_hole.h>
 #include <club/transport/quality_of_service.h>
 #include <club/transport/packet.h>
+#include <club/transport/batch_io.h>
+#include <club/transport/socket_stats.h>
+#include <club/transport/pacer.h>
+#include <club/multiplexer.h>
 #include <club/debug/log.h>
 
 namespace club {
 
 class SocketImpl : public std::enable_shared_from_this<SocketImpl> {
 private:
-  enum class SendState { sending, pending };
+  // `paced` means we're waiting for the pacing timer.
+  enum class SendState { sending, pending, paced };
 
 public:
-  static constexpr size_t packet_size = transport::QualityOfService::MSS();
-
-  using OnReceive = std::function<void( const boost::system::error_code&
-                                      , boost::asio::const_buffer )>;
-  using OnSend = std::function<void(const boost::system::error_code&)>;
-  using OnFlush = std::function<void()>;
+  static constexpr size_t packet_size = transport::PathMtu::DEFAULT();
+
+  // The channel header takes a few bytes of what a message can carry.
+  static constexpr size_t max_reliable_message_size
+    = transport::OutMessage::max_payload_size - transport::ChannelHeader::size;
+
+  // Handlers are stored inline (see InlineFunction) so that sending and
+  // receiving messages doesn't allocate memory for them.
+  using OnReceive = InlineFunction<void( const boost::system::error_code&
+                                       , boost::asio::const_buffer )>;
+  using OnReceiveStream = InlineFunction<void( const boost::system::error_code&
+                                             , boost::asio::const_buffer
+                                             , bool is_last )>;
+  using OnSend = InlineFunction<void(const boost::system::error_code&)>;
+  using OnFlush = InlineFunction<void()>;
 
 private:
   using clock = std::chrono::steady_clock;
@@ -61,10 +81,21 @@ public:
   using AckSet = transport::AckSet;
   using MessageType = transport::MessageType;
   using error = transport::error;
+  using IoCounters = transport::IoCounters;
+  using ConnectionId = transport::ConnectionId;
+  using CongestionControl = transport::CongestionControl;
+  using OutStream = transport::OutStream;
+  using StreamSource = transport::StreamSource;
+  using ChannelId = transport::ChannelId;
+  using Priority = transport::Priority;
+  using MessageKey = TransmitQueue::Key;
+  using CongestionController = transport::CongestionController;
+  using SocketStats = transport::SocketStats;
 
 public:
   SocketImpl(boost::asio::io_service&);
   SocketImpl(udp::socket);
+  SocketImpl(std::shared_ptr<Multiplexer>);
 
   SocketImpl( udp::socket   socket
             , udp::endpoint remote_endpoint);
@@ -80,15 +111,31 @@ public:
   template<class OnConnect>
   void rendezvous_connect(udp::endpoint, OnConnect);
 
+  template<class OnConnect>
+  void rendezvous_connect(udp::endpoint, ConnectionId, OnConnect);
+
+  ConnectionId connection_id();
+
   void receive_unreliable(OnReceive);
-  void receive_reliable(OnReceive);
+  void receive_reliable(ChannelId, OnReceive);
   void send_unreliable(std::vector<uint8_t>, OnSend);
-  void send_reliable(std::vector<uint8_t>, OnSend);
+  void send_unreliable( std::vector<uint8_t>
+                      , OutMessage::SharedPayload
+                      , OnSend);
+  void send_unreliable( MessageKey
+                      , std::vector<uint8_t>
+                      , OutMessage::SharedPayload
+                      , OnSend);
+  void send_reliable(ChannelId, std::vector<uint8_t>, OnSend);
+  void send_reliable(ChannelId, OutMessage::SharedPayload, OnSend);
+  void receive_stream(ChannelId, OnReceiveStream);
+  void send_stream(ChannelId, StreamSource, OnSend);
+  void send_stream(ChannelId, OutMessage::SharedPayload, OnSend);
   void flush(OnFlush);
   void close();
 
   udp::socket& get_socket_impl() {
-    return _socket;
+    return udp_socket();
   }
 
   // If we don't receive any packet during this duration, the socket
@@ -102,6 +149,8 @@ public:
     return _socket.get_io_service();
   }
 
+  bool is_multiplexed() const { return _multiplexer != nullptr; }
+
   async::alarm::duration keepalive_period() const {
     return _keepalive_period;
   }
@@ -111,7 +160,72 @@ public:
     _send_keepalive_alarm.start(_keepalive_period);
   }
 
+  size_t io_batch_size() const { return _io_batch_size; }
+  void io_batch_size(size_t);
+
+  const IoCounters& io_counters() const { return _io_counters; }
+
+  void congestion_control(CongestionControl cc) {
+    _qos.congestion_controller(
+        transport::make_congestion_controller(cc, _qos.mss()));
+  }
+
+  void congestion_controller(std::unique_ptr<CongestionController> cc) {
+    _qos.congestion_controller(std::move(cc));
+  }
+
+  const CongestionController& congestion_controller() const {
+    return _qos.congestion_controller();
+  }
+
+  bool pacing() const { return _pacing; }
+  void pacing(bool enable) { _pacing = enable; }
+
+  clock::duration rtt() const { return _qos.rtt(); }
+  clock::duration rto() const { return _qos.rto(); }
+  boost::optional<clock::duration> min_rtt() const { return _qos.min_rtt(); }
+
+  size_t path_mtu() const { return _qos.mss(); }
+
+  bool fec() const { return _fec_encoder.enabled(); }
+  void fec(bool enable) { _fec_encoder.enable(enable); }
+  size_t fec_group_size() const { return _fec_encoder.group_size(); }
+
+  // Priority class of reliable messages and streams sent over the channel.
+  void priority(ChannelId channel, Priority p) {
+    _out_channels[channel].priority = p;
+  }
+
+  void unreliable_priority(Priority p) { _unreliable_priority = p; }
+
+  const TransmitQueue::ClassStats& transmit_stats(Priority p) const {
+    return _transmit_queue.stats(p);
+  }
+
+  SocketStats stats() const;
+
 private:
+  // When multiplexed, the UDP socket is owned by the multiplexer.
+  udp::socket& udp_socket() {
+    return _multiplexer ? _multiplexer->get_socket_impl() : _socket;
+  }
+
+  bool is_open() const {
+    return _multiplexer ? _is_multiplexed_open : _socket.is_open();
+  }
+
+  void close_udp_socket();
+
+  template<class OnConnect>
+  void multiplexed_connect(udp::endpoint, OutMessage, OnConnect);
+
+  void send_syn();
+
+  void on_multiplexed_receive( const boost::system::error_code&
+                             , const udp::endpoint&
+                             , const std::vector<uint8_t>&
+                             , size_t);
+
   void handle_error(const boost::system::error_code&);
 
   void start_receiving();
@@ -119,7 +233,17 @@ private:
   void on_receive( boost::system::error_code
                  , std::size_t);
 
+  bool handle_packet(const udp::endpoint&, const std::vector<uint8_t>&);
+  void handle_fec_message(const InMessagePart&);
+
   void start_sending();
+  void start_sending_batch();
+  void fill_out_streams();
+  void send_tx_batch(size_t first);
+  bool wait_for_pacer();
+  bool try_send_probe();
+  boost::optional<size_t> encode_next_packet(std::vector<uint8_t>&);
+  void on_nothing_to_send();
 
   void on_send(const boost::system::error_code&, size_t);
 
@@ -134,17 +258,23 @@ private:
   void handle_unreliable_message(const InMessagePart&);
   void handle_reliable_message(const InMessagePart&);
 
-  void replay_pending_messages();
+  void replay_pending_messages(ChannelId);
+  void post_replay(ChannelId);
 
   bool user_handle_reliable_msg(InMessageFull&);
 
+  void add_reliable_message( ChannelId
+                           , std::vector<uint8_t>
+                           , OutMessage::SharedPayload);
+
   template<typename ...Ts>
-  void add_message(Ts&&... params) {
-    _transmit_queue.insert(OutMessage(std::forward<Ts>(params)...));
+  void add_message(Priority priority, Ts&&... params) {
+    _transmit_queue.insert(OutMessage(std::forward<Ts>(params)...), priority);
   }
 
   void on_recv_timeout_alarm();
   void on_send_keepalive_alarm();
+  void on_tail_loss_alarm();
 
   void sync_send_close_message();
 
@@ -160,6 +290,7 @@ private:
   }
 
   void exec_on_send_handlers(boost::system::error_code);
+  void post_send_error(OnSend, boost::system::error_code);
   bool can_exec_on_send_handlers() const;
 
   template<class... Ts> void print(Ts&&...) const;
@@ -168,10 +299,19 @@ private:
   using PendingMessages = std::map<SequenceNumber, PendingMessage>;
 
   struct Sync {
-    SequenceNumber last_used_reliable_sn;
     SequenceNumber last_used_unreliable_sn;
   };
 
+  // State of a rendezvous connect through a multiplexer. The multiplexer
+  // is already receiving, so instead of punch_hole we only resend the
+  // syn packet until the first packet from the remote arrives.
+  struct Connecting {
+    std::function<void(const boost::system::error_code&)> on_connect;
+    OutMessage           syn_message;
+    std::vector<uint8_t> syn_packet;
+    unsigned             attempts_left;
+  };
+
   boost::asio::strand              _strand;
   async::alarm::duration           _keepalive_period = std::chrono::milliseconds(500);
   SendState                        _send_state;
@@ -180,9 +320,32 @@ private:
   TransmitQueue                    _transmit_queue;
 
   udp::endpoint        rx_endpoint;
-  std::vector<uint8_t> rx_buffer = std::vector<uint8_t>(packet_size);
+  // The remote may be sending packets up to the maximum size the
+  // path MTU discovery may find.
+  std::vector<uint8_t> rx_buffer = std::vector<uint8_t>(transport::PathMtu::MAX());
   std::vector<uint8_t> tx_buffer = std::vector<uint8_t>(packet_size);
 
+  // Used only when _io_batch_size > 1. The receive batch holds the
+  // datagrams drained after the first one arrived into rx_buffer.
+  size_t                 _io_batch_size = 1;
+  size_t                 _rx_drain_backoff = 0;
+  size_t                 _rx_drain_countdown = 0;
+  transport::PacketBatch _rx_batch;
+  transport::PacketBatch _tx_batch;
+  IoCounters             _io_counters;
+
+  uint64_t _duplicate_chunks_received = 0;
+  uint64_t _keepalives_sent = 0;
+  uint64_t _keepalives_received = 0;
+
+  // Set when the UDP port is shared with other connections. The remote
+  // learns our connection id from the sync message and we learn its.
+  std::shared_ptr<Multiplexer> _multiplexer;
+  bool                         _is_multiplexed_open = false;
+  ConnectionId                 _local_connection_id  = transport::no_connection_id;
+  ConnectionId                 _remote_connection_id = transport::no_connection_id;
+  std::unique_ptr<Connecting>  _connecting;
+
   // If this is not set, then we haven't yet received sync
   boost::optional<Sync>            _sync;
   PendingMessages                  _pending_reliable_messages;
@@ -192,16 +355,63 @@ private:
   SequenceNumber _next_reliable_sn   = 0;
   SequenceNumber _next_unreliable_sn = 1;
 
-  OnReceive _on_receive_reliable;
   OnReceive _on_receive_unreliable;
-  std::queue<OnSend> _on_send;
+  // Executed in order by exec_on_send_handlers, which swaps the two
+  // vectors so that their capacity is reused.
+  std::vector<OnSend> _on_send;
+  std::vector<OnSend> _on_send_spare;
+
+  Priority _unreliable_priority = Priority::normal;
+
+  // Streams waiting to be cut into frames, only the front one is
+  // being sent. Reliable messages sent while a stream is in progress
+  // wait here as well so that they're not interleaved with its frames.
+  // The handler is queued in _on_send once the entry is fully in the
+  // transmit queue.
+  struct QueuedReliable {
+    boost::optional<OutStream> stream;
+    std::vector<uint8_t>       data;
+    OutMessage::SharedPayload  shared_data;
+    OnSend                     on_send;
+  };
+
+  struct OutChannel {
+    Priority                   priority = Priority::normal;
+    SequenceNumber             next_sn = 0;
+    std::deque<QueuedReliable> queued;
+  };
+
+  struct InChannel {
+    SequenceNumber  next_sn = 0;
+    // Complete messages (channel sn -> message sn) waiting in
+    // _pending_reliable_messages for their predecessors.
+    std::map<SequenceNumber, SequenceNumber> complete;
+    OnReceive       on_receive;
+    OnReceiveStream on_receive_stream;
+  };
+
+  std::map<ChannelId, OutChannel> _out_channels;
+  std::map<ChannelId, InChannel>  _in_channels;
 
   OnFlush _on_flush;
 
   async::alarm                     _recv_timeout_alarm;
   async::alarm                     _send_keepalive_alarm;
+  async::alarm                     _tail_loss_alarm;
 
   transport::QualityOfService _qos;
+
+  transport::FecEncoder _fec_encoder;
+  transport::FecDecoder _fec_decoder;
+
+  bool                      _pacing = false;
+  transport::Pacer          _pacer;
+  boost::asio::steady_timer _pacing_timer;
+
+  // There is at most one receive and one send (or pacing wait) pending
+  // at any time, so asio gets to reuse the same memory for them.
+  async::handler_memory _recv_handler_memory;
+  async::handler_memory _send_handler_memory;
 };
 
 //------------------------------------------------------------------------------
@@ -214,6 +424,8 @@ SocketImpl::SocketImpl(boost::asio::io_service& ios)
   , _socket(ios, udp::endpoint(udp::v4(), 0))
   , _recv_timeout_alarm(_socket.get_io_service(), [this]() { on_recv_timeout_alarm(); })
   , _send_keepalive_alarm(_socket.get_io_service(), [=]() { on_send_keepalive_alarm(); })
+  , _tail_loss_alarm(_socket.get_io_service(), [this]() { on_tail_loss_alarm(); })
+  , _pacing_timer(_socket.get_io_service())
 {
 }
 
@@ -224,6 +436,22 @@ SocketImpl::SocketImpl(udp::socket udp_socket)
   , _socket(std::move(udp_socket))
   , _recv_timeout_alarm(_socket.get_io_service(), [this]() { on_recv_timeout_alarm(); })
   , _send_keepalive_alarm(_socket.get_io_service(), [=]() { on_send_keepalive_alarm(); })
+  , _tail_loss_alarm(_socket.get_io_service(), [this]() { on_tail_loss_alarm(); })
+  , _pacing_timer(_socket.get_io_service())
+{
+}
+
+inline
+SocketImpl::SocketImpl(std::shared_ptr<Multiplexer> multiplexer)
+  : _strand(multiplexer->strand())
+  , _send_state(SendState::pending)
+  , _socket(multiplexer->get_io_service())
+  , _multiplexer(std::move(multiplexer))
+  , _is_multiplexed_open(true)
+  , _recv_timeout_alarm(_socket.get_io_service(), [this]() { on_recv_timeout_alarm(); })
+  , _send_keepalive_alarm(_socket.get_io_service(), [=]() { on_send_keepalive_alarm(); })
+  , _tail_loss_alarm(_socket.get_io_service(), [this]() { on_tail_loss_alarm(); })
+  , _pacing_timer(_socket.get_io_service())
 {
 }
 
@@ -231,6 +459,17 @@ SocketImpl::SocketImpl(udp::socket udp_socket)
 template<class OnConnect>
 inline
 void SocketImpl::rendezvous_connect(udp::endpoint remote_ep, OnConnect on_connect) {
+  rendezvous_connect( std::move(remote_ep)
+                    , transport::no_connection_id
+                    , std::move(on_connect));
+}
+
+//------------------------------------------------------------------------------
+template<class OnConnect>
+inline
+void SocketImpl::rendezvous_connect( udp::endpoint remote_ep
+                                   , ConnectionId  remote_connection_id
+                                   , OnConnect     on_connect) {
   using std::move;
   using boost::system::error_code;
 
@@ -238,10 +477,31 @@ void SocketImpl::rendezvous_connect(udp::endpoint remote_ep, OnConnect on_connec
 
   remote_ep = sanitize_address(remote_ep);
 
+  _remote_connection_id = remote_connection_id;
+
+  if (transport::set_dont_fragment(udp_socket())) {
+    _qos.path_mtu().enable();
+  }
+
+  if (_multiplexer && connection_id() != transport::no_connection_id) {
+    _multiplexer->expect(remote_ep, _local_connection_id);
+  }
+
+  // The sync message tells the remote which connection id to put
+  // into the packets it sends to us.
+  std::vector<uint8_t> syn_payload(sizeof(ConnectionId));
+  binary::encoder(syn_payload).put(_local_connection_id);
+
   auto syn_message = OutMessage( true
                                , MessageType::sync
                                , _next_reliable_sn++
-                               , std::vector<uint8_t>());
+                               , std::move(syn_payload));
+
+  if (_multiplexer) {
+    return multiplexed_connect( remote_ep
+                              , std::move(syn_message)
+                              , std::move(on_connect));
+  }
 
   auto packet = construct_packet_with_one_message(syn_message);
 
@@ -255,7 +515,7 @@ void SocketImpl::rendezvous_connect(udp::endpoint remote_ep, OnConnect on_connec
                   (error_code error, udp::endpoint remote_ep) mutable {
     if (error) return on_connect(error);
     _remote_endpoint = remote_ep;
-    _transmit_queue.insert(std::move(syn_message));
+    _transmit_queue.insert(std::move(syn_message), Priority::high);
     start_sending();
     start_receiving();
     _send_keepalive_alarm.start(_keepalive_period);
@@ -265,9 +525,133 @@ void SocketImpl::rendezvous_connect(udp::endpoint remote_ep, OnConnect on_connec
   transport::punch_hole(_socket, remote_ep, std::move(packet), std::move(on_punch));
 }
 
+//------------------------------------------------------------------------------
+inline
+SocketImpl::ConnectionId SocketImpl::connection_id() {
+  using boost::system::error_code;
+
+  if (!_multiplexer || !_is_multiplexed_open) return _local_connection_id;
+  if (_local_connection_id != transport::no_connection_id) {
+    return _local_connection_id;
+  }
+
+  std::weak_ptr<SocketImpl> weak_self = shared_from_this();
+
+  _local_connection_id = _multiplexer->add_connection(
+      [weak_self]( const error_code& error
+                 , const udp::endpoint& source
+                 , const std::vector<uint8_t>& packet
+                 , size_t size) {
+        if (auto self = weak_self.lock()) {
+          self->on_multiplexed_receive(error, source, packet, size);
+        }
+      });
+
+  return _local_connection_id;
+}
+
+//------------------------------------------------------------------------------
+template<class OnConnect>
+inline
+void SocketImpl::multiplexed_connect( udp::endpoint remote_ep
+                                    , OutMessage    syn_message
+                                    , OnConnect     on_connect) {
+  using boost::system::error_code;
+
+  if (!_is_multiplexed_open) {
+    return get_io_service().post([on_connect = std::move(on_connect)]() mutable {
+        on_connect(error_code(boost::asio::error::bad_descriptor));
+      });
+  }
+
+  _remote_endpoint = remote_ep;
+
+  auto h = std::make_shared<OnConnect>(std::move(on_connect));
+
+  auto packet = construct_packet_with_one_message(syn_message);
+
+  _connecting.reset(new Connecting{ [h](const error_code& e) { (*h)(e); }
+                                  , std::move(syn_message)
+                                  , std::move(packet)
+                                  , 10 });
+
+  _strand.dispatch([this, self = shared_from_this()]() { send_syn(); });
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_syn() {
+  if (!_connecting) return;
+
+  if (_connecting->attempts_left-- == 0) {
+    auto c = std::move(_connecting);
+    close_udp_socket();
+    return c->on_connect(boost::asio::error::host_unreachable);
+  }
+
+  // The packet may get lost, that's why we keep retrying.
+  boost::system::error_code ignored;
+  udp_socket().send_to( boost::asio::buffer(_connecting->syn_packet)
+                      , _remote_endpoint
+                      , 0
+                      , ignored);
+
+  // While connecting, the keepalive alarm drives syn retransmission.
+  _send_keepalive_alarm.start(std::chrono::milliseconds(200));
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::on_multiplexed_receive( const boost::system::error_code& error
+                                       , const udp::endpoint& source
+                                       , const std::vector<uint8_t>& packet
+                                       , size_t size) {
+  using boost::system::error_code;
+
+  if (_connecting) {
+    if (error) {
+      auto c = std::move(_connecting);
+      close();
+      return c->on_connect(error);
+    }
+
+    if (source != _remote_endpoint) return;
+
+    auto c = std::move(_connecting);
+
+    _transmit_queue.insert(std::move(c->syn_message), Priority::high);
+    start_sending();
+    start_receiving();
+    _send_keepalive_alarm.start(_keepalive_period);
+
+    c->on_connect(error_code());
+
+    if (!is_open()) return;
+  }
+
+  _recv_timeout_alarm.stop();
+
+  if (error) {
+    return handle_error(error);
+  }
+
+  ++_io_counters.rx_packets;
+  _io_counters.rx_bytes += size;
+
+  if (!handle_packet(source, packet)) return;
+
+  if (can_exec_on_send_handlers()) {
+    exec_on_send_handlers(error);
+  }
+
+  start_receiving();
+  start_sending();
+}
+
 //------------------------------------------------------------------------------
 inline
 boost::asio::ip::udp::endpoint SocketImpl::local_endpoint() const {
+  if (_multiplexer) return _multiplexer->local_endpoint();
   return _socket.local_endpoint();
 }
 
@@ -292,23 +676,219 @@ void SocketImpl::receive_unreliable(OnReceive on_recv) {
 
 //------------------------------------------------------------------------------
 inline
-void SocketImpl::receive_reliable(OnReceive on_recv) {
-  _on_receive_reliable = std::move(on_recv);
+void SocketImpl::receive_reliable(ChannelId channel, OnReceive on_recv) {
+  _in_channels[channel].on_receive = std::move(on_recv);
+  post_replay(channel);
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::receive_stream(ChannelId channel, OnReceiveStream on_recv) {
+  _in_channels[channel].on_receive_stream = std::move(on_recv);
+  post_replay(channel);
+}
+
+//------------------------------------------------------------------------------
+// Complete messages which were already acked may be waiting for the user
+// to provide a handler, the peer won't resend them to trigger the replay.
+inline
+void SocketImpl::post_replay(ChannelId channel_id) {
+  auto& channel = _in_channels[channel_id];
+
+  if (channel.complete.count(channel.next_sn) == 0) return;
+
+  _strand.post([this, self = shared_from_this(), channel_id]() {
+    if (is_open()) replay_pending_messages(channel_id);
+  });
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_stream( ChannelId    channel
+                            , StreamSource source
+                            , OnSend       on_send) {
+  _out_channels[channel].queued.push_back(
+      QueuedReliable{ OutStream(std::move(source)), {}, {}, std::move(on_send) });
+  start_sending();
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_stream( ChannelId                 channel
+                            , OutMessage::SharedPayload data
+                            , OnSend                    on_send) {
+  _out_channels[channel].queued.push_back(
+      QueuedReliable{ OutStream(std::move(data)), {}, {}, std::move(on_send) });
+  start_sending();
+}
+
+//------------------------------------------------------------------------------
+// Move frames of the queued streams (and the reliable messages waiting
+// behind them) into the transmit queue for as long as the congestion
+// window has room for them. Channels take turns.
+inline
+void SocketImpl::fill_out_streams() {
+  bool progress = true;
+
+  while (progress) {
+    progress = false;
+
+    for (auto& pair : _out_channels) {
+      if (_transmit_queue.size_in_bytes() >= _qos.cwnd()) return;
+
+      auto& channel = pair.second;
+
+      if (channel.queued.empty()) continue;
+
+      auto& q = channel.queued.front();
+      progress = true;
+
+      if (!q.stream) {
+        add_reliable_message( pair.first
+                            , std::move(q.data)
+                            , std::move(q.shared_data));
+      }
+      else {
+        auto head = transport::encode_channel_header
+                      ( pair.first
+                      , channel.next_sn++
+                      , transport::ChannelHeader::size + 1 + OutStream::frame_size);
+
+        _transmit_queue.insert(q.stream->next_frame( _next_reliable_sn++
+                                                   , std::move(head))
+                              , channel.priority);
+
+        if (!q.stream->finished()) continue;
+      }
+
+      _on_send.push_back(std::move(q.on_send));
+      channel.queued.pop_front();
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::add_reliable_message( ChannelId                 channel
+                                     , std::vector<uint8_t>      data
+                                     , OutMessage::SharedPayload shared_data) {
+  auto& c = _out_channels[channel];
+
+  transport::ChannelHeader head{channel, c.next_sn++};
+
+  if (!data.empty()) {
+    assert(shared_data.empty());
+    // Share rather than copy the data behind the header. The shared state
+    // is recycled so that this doesn't allocate once warmed up.
+    using Data = std::vector<uint8_t>;
+    shared_data = std::allocate_shared<Data>( RecyclingAllocator<Data>()
+                                            , std::move(data));
+  }
+
+  add_message( c.priority
+             , true
+             , MessageType::reliable
+             , _next_reliable_sn++
+             , head
+             , std::move(shared_data));
 }
 
 //------------------------------------------------------------------------------
 inline
 void SocketImpl::send_unreliable(std::vector<uint8_t> data, OnSend on_send) {
-  _on_send.push(std::move(on_send));
-  add_message(false, MessageType::unreliable, _next_unreliable_sn++, std::move(data));
+  _on_send.push_back(std::move(on_send));
+  add_message( _unreliable_priority
+             , false
+             , MessageType::unreliable
+             , _next_unreliable_sn++
+             , std::move(data));
+  start_sending();
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_unreliable( std::vector<uint8_t>      head
+                                , OutMessage::SharedPayload tail
+                                , OnSend                    on_send) {
+  _on_send.push_back(std::move(on_send));
+  add_message( _unreliable_priority
+             , false
+             , MessageType::unreliable
+             , _next_unreliable_sn++
+             , std::move(head)
+             , std::move(tail));
+  start_sending();
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_unreliable( MessageKey                key
+                                , std::vector<uint8_t>      head
+                                , OutMessage::SharedPayload tail
+                                , OnSend                    on_send) {
+  _on_send.push_back(std::move(on_send));
+
+  // The previous value with this key is still waiting in the queue, send
+  // the new one in its place.
+  if (_transmit_queue.reset_payload(key, std::move(head), std::move(tail))) {
+    return start_sending();
+  }
+
+  _transmit_queue.insert( key
+                        , OutMessage( false
+                                    , MessageType::unreliable
+                                    , _next_unreliable_sn++
+                                    , std::move(head)
+                                    , std::move(tail))
+                        , _unreliable_priority);
+  start_sending();
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::send_reliable( ChannelId            channel
+                              , std::vector<uint8_t> data
+                              , OnSend               on_send) {
+  if (data.size() > max_reliable_message_size) {
+    return post_send_error( std::move(on_send)
+                          , boost::asio::error::message_size);
+  }
+
+  auto& queued = _out_channels[channel].queued;
+
+  if (!queued.empty()) {
+    queued.push_back(QueuedReliable{ boost::none
+                                   , std::move(data), {}
+                                   , std::move(on_send) });
+    return start_sending();
+  }
+
+  _on_send.push_back(std::move(on_send));
+  add_reliable_message(channel, std::move(data), {});
   start_sending();
 }
 
 //------------------------------------------------------------------------------
 inline
-void SocketImpl::send_reliable(std::vector<uint8_t> data, OnSend on_send) {
-  _on_send.push(std::move(on_send));
-  add_message(true, MessageType::reliable, _next_reliable_sn++, std::move(data));
+void SocketImpl::send_reliable( ChannelId                 channel
+                              , OutMessage::SharedPayload data
+                              , OnSend                    on_send) {
+  if (data.size() > max_reliable_message_size) {
+    return post_send_error( std::move(on_send)
+                          , boost::asio::error::message_size);
+  }
+
+  auto& queued = _out_channels[channel].queued;
+
+  if (!queued.empty()) {
+    queued.push_back(QueuedReliable{ boost::none
+                                   , {}, std::move(data)
+                                   , std::move(on_send) });
+    return start_sending();
+  }
+
+  _on_send.push_back(std::move(on_send));
+  add_reliable_message(channel, {}, std::move(data));
   start_sending();
 }
 
@@ -321,13 +901,18 @@ void SocketImpl::start_receiving()
 
   _recv_timeout_alarm.start(recv_timeout_duration());
 
+  // The multiplexer receives for us.
+  if (_multiplexer) return;
+
   _socket.async_receive_from
       ( boost::asio::buffer(rx_buffer)
       , rx_endpoint
-      , _strand.wrap([self = shared_from_this()]
-                     (const error_code& e, std::size_t size) {
-                       self->on_receive(e, size);
-                     })
+      , _strand.wrap(async::make_custom_alloc_handler
+          ( _recv_handler_memory
+          , [self = shared_from_this()]
+            (const error_code& e, std::size_t size) {
+              self->on_receive(e, size);
+            }))
       );
 }
 
@@ -351,12 +936,29 @@ inline void SocketImpl::flush(OnFlush on_flush) {
 
 //------------------------------------------------------------------------------
 inline void SocketImpl::close() {
-  if (_socket.is_open()) {
+  if (is_open()) {
     sync_send_close_message();
-    _socket.close();
+    close_udp_socket();
   }
+  _connecting.reset();
   _recv_timeout_alarm.stop();
   _send_keepalive_alarm.stop();
+  _tail_loss_alarm.stop();
+  _pacing_timer.cancel();
+}
+
+//------------------------------------------------------------------------------
+inline void SocketImpl::close_udp_socket() {
+  if (!_multiplexer) {
+    return _socket.close();
+  }
+
+  if (!_is_multiplexed_open) return;
+  _is_multiplexed_open = false;
+
+  if (_local_connection_id != transport::no_connection_id) {
+    _multiplexer->remove_connection(_local_connection_id);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -366,9 +968,16 @@ void SocketImpl::handle_error(const boost::system::error_code& err) {
   close();
 
   auto r1 = std::move(_on_receive_unreliable);
-  auto r2 = std::move(_on_receive_reliable);
   if (r1) r1(err, boost::asio::const_buffer());
-  if (r2) r2(err, boost::asio::const_buffer());
+
+  auto channels = std::move(_in_channels);
+
+  for (auto& pair : channels) {
+    auto r2 = std::move(pair.second.on_receive);
+    auto r3 = std::move(pair.second.on_receive_stream);
+    if (r2) r2(err, boost::asio::const_buffer());
+    if (r3) r3(err, boost::asio::const_buffer(), false);
+  }
 
   // TODO: Should probably execute send handler as well.
 }
@@ -379,6 +988,7 @@ void SocketImpl::on_receive( boost::system::error_code error
                            , std::size_t               size)
 {
   using namespace std;
+  using boost::system::error_code;
   namespace asio = boost::asio;
 
   _recv_timeout_alarm.stop();
@@ -387,25 +997,42 @@ void SocketImpl::on_receive( boost::system::error_code error
     return handle_error(error);
   }
 
-  // Ignore packets from unknown sources.
-  if (!_remote_endpoint.address().is_unspecified()) {
-    if (rx_endpoint != _remote_endpoint) {
-      return start_receiving();
+  ++_io_counters.rx_syscalls;
+  ++_io_counters.rx_packets;
+  _io_counters.rx_bytes += size;
+
+  if (!handle_packet(rx_endpoint, rx_buffer)) return;
+
+  if (_io_batch_size > 1 && _rx_drain_countdown-- == 0) {
+    // Drain whatever else has arrived in the meantime with a single
+    // system call.
+    error_code ec;
+    auto n = transport::receive_batch(_socket, _rx_batch, ec);
+
+    ++_io_counters.rx_syscalls;
+
+    if (ec && ec != asio::error::would_block) {
+      return handle_error(ec);
     }
-  }
 
-  transport::PacketDecoder decoder(_qos, rx_buffer);
+    // If there was nothing to drain, the peer isn't sending fast enough
+    // for batching to pay off, so back off for a few packets to avoid
+    // wasting a system call on each of them.
+    if (n == 0) {
+      _rx_drain_backoff = std::min<size_t>(2*_rx_drain_backoff + 1, 16);
+    }
+    else {
+      _rx_drain_backoff = 0;
+    }
 
-  decoder.decode_header();
+    _rx_drain_countdown = _rx_drain_backoff;
 
-  if (decoder.error()) return handle_error(transport::error::parse_error);
+    for (size_t i = 0; i < n; ++i) {
+      ++_io_counters.rx_packets;
+      _io_counters.rx_bytes += _rx_batch[i].size;
 
-  while (auto m = decoder.decode_message()) {
-    if (decoder.error()) {
-      return handle_error(transport::error::parse_error);
+      if (!handle_packet(_rx_batch[i].endpoint, _rx_batch[i].data)) return;
     }
-    handle_message(std::move(*m));
-    if (!_socket.is_open()) return;
   }
 
   if (can_exec_on_send_handlers()) {
@@ -417,91 +1044,267 @@ void SocketImpl::on_receive( boost::system::error_code error
 }
 
 //------------------------------------------------------------------------------
+// Return false if the socket has been closed while handling the packet.
 inline
-void SocketImpl::handle_message(InMessagePart msg) {
-  switch (msg.type) {
-    case MessageType::sync:       handle_sync_message(msg); break;
-    case MessageType::keep_alive: break;
-    case MessageType::unreliable: handle_unreliable_message(msg); break;
-    case MessageType::reliable:   handle_reliable_message(msg); break;
-    case MessageType::close:      handle_close_message(); break;
-    default: return handle_error(error::parse_error);
+bool SocketImpl::handle_packet( const udp::endpoint&        source
+                              , const std::vector<uint8_t>& packet) {
+  // Ignore packets from unknown sources.
+  if (!_remote_endpoint.address().is_unspecified()) {
+    if (source != _remote_endpoint) {
+      return true;
+    }
   }
-}
 
-//------------------------------------------------------------------------------
-inline
-void SocketImpl::handle_close_message() {
-  _socket.close();
-  handle_error(boost::asio::error::connection_reset);
-}
+  transport::PacketDecoder decoder(_qos, packet);
 
-//------------------------------------------------------------------------------
-inline
-void SocketImpl::handle_sync_message(const InMessagePart& msg) {
-  if (!_sync) {
-    _received_message_ids.try_add(msg.sequence_number);
-    _sync = Sync{msg.sequence_number, msg.sequence_number};
+  decoder.decode_header();
+
+  if (decoder.unsupported_version()) {
+    handle_error(transport::error::unsupported_version);
+    return false;
   }
-}
 
-//------------------------------------------------------------------------------
-inline
-void SocketImpl::handle_reliable_message(const InMessagePart& msg) {
-  if (!_sync) return;
-  if (!_received_message_ids.can_add(msg.sequence_number)) return;
+  if (decoder.error()) {
+    handle_error(transport::error::parse_error);
+    return false;
+  }
 
-  if (msg.sequence_number == _sync->last_used_reliable_sn + 1) {
-    if (auto full_msg = msg.get_complete_message()) {
-      if (!user_handle_reliable_msg(*full_msg)) return;
-      return replay_pending_messages();
+  while (auto m = decoder.decode_message()) {
+    if (decoder.error()) {
+      handle_error(transport::error::parse_error);
+      return false;
     }
+    handle_message(std::move(*m));
+    if (!is_open()) return false;
+  }
+
+  if (auto sn = decoder.sequence_number()) {
+    auto messages = decoder.messages();
+    _fec_decoder.on_packet( *sn
+                          , decoder.message_count()
+                          , boost::asio::buffer_cast<const uint8_t*>(messages)
+                          , boost::asio::buffer_size(messages));
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Handle the messages of a lost packet if the parity lets us rebuild it.
+inline
+void SocketImpl::handle_fec_message(const InMessagePart& msg) {
+  // Parities are never split across packets.
+  if (!msg.is_complete()) return;
+
+  auto payload = _fec_decoder.on_parity(msg.payload);
+
+  if (!payload) return;
+
+  binary::decoder d(*payload);
+
+  auto count = d.get<uint16_t>();
+
+  for (uint16_t i = 0; i < count; ++i) {
+    auto m = d.get<InMessagePart>();
+
+    if (d.error()) return handle_error(transport::error::parse_error);
+
+    // Parities only protect data packets.
+    if (m.type == MessageType::fec) continue;
+
+    handle_message(std::move(m));
+    if (!is_open()) return;
+  }
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::handle_message(InMessagePart msg) {
+  switch (msg.type) {
+    case MessageType::sync:       handle_sync_message(msg); break;
+    case MessageType::keep_alive: ++_keepalives_received; break;
+    case MessageType::mtu_probe:  break;
+    case MessageType::fec:        handle_fec_message(msg); break;
+    case MessageType::unreliable: handle_unreliable_message(msg); break;
+    case MessageType::reliable:   handle_reliable_message(msg); break;
+    case MessageType::stream:     handle_reliable_message(msg); break;
+    case MessageType::close:      handle_close_message(); break;
+    default: return handle_error(error::parse_error);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::handle_close_message() {
+  close_udp_socket();
+  handle_error(boost::asio::error::connection_reset);
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::handle_sync_message(const InMessagePart& msg) {
+  if (!_sync) {
+    binary::decoder d( boost::asio::buffer_cast<const uint8_t*>(msg.payload)
+                     , boost::asio::buffer_size(msg.payload));
+
+    auto remote_connection_id = d.get<ConnectionId>();
+
+    if (!d.error()) {
+      _remote_connection_id = remote_connection_id;
+    }
+
+    _received_message_ids.try_add(msg.sequence_number);
+    _sync = Sync{msg.sequence_number};
+  }
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::handle_reliable_message(const InMessagePart& msg) {
+  if (!_sync) return;
+  if (!_received_message_ids.can_add(msg.sequence_number)) return;
+
+  // Either already delivered or complete and waiting for its predecessors
+  // in its channel, the peer resent it before our ack arrived.
+  if (_received_message_ids.is_in(msg.sequence_number)) {
+    ++_duplicate_chunks_received;
+    return;
   }
 
   auto i = _pending_reliable_messages.find(msg.sequence_number);
 
   if (i == _pending_reliable_messages.end()) {
+    // Most messages arrive whole and in order, those are delivered straight
+    // from the packet without being copied into a PendingMessage.
+    if (auto full_msg = msg.get_complete_message()) {
+      auto header = transport::decode_channel_header(full_msg->payload);
+
+      if (!header) return handle_error(transport::error::parse_error);
+
+      if (header->sequence_number == _in_channels[header->channel].next_sn) {
+        if (user_handle_reliable_msg(*full_msg)) {
+          return replay_pending_messages(header->channel);
+        }
+        // No handler yet, keep it below until there is one.
+        if (!is_open()) return;
+      }
+    }
+
     i = _pending_reliable_messages.emplace(msg.sequence_number, msg).first;
   }
   else {
-    i->second.update_payload(msg.chunk_start, msg.payload);
-    replay_pending_messages();
+    auto chunk_end = msg.chunk_start + boost::asio::buffer_size(msg.payload);
+
+    // Not returning early for duplicates: a complete message that had no
+    // handler to receive it is delivered when the peer resends it.
+    if (i->second.part_info.contains(msg.chunk_start, chunk_end)) {
+      ++_duplicate_chunks_received;
+    }
+    else {
+      i->second.update_payload(msg.chunk_start, msg.payload);
+    }
   }
+
+  auto full_msg = i->second.get_complete_message();
+
+  if (!full_msg) return;
+
+  auto header = transport::decode_channel_header(full_msg->payload);
+
+  if (!header) return handle_error(transport::error::parse_error);
+
+  auto& channel = _in_channels[header->channel];
+
+  if (header->sequence_number == channel.next_sn) {
+    if (!user_handle_reliable_msg(*full_msg)) return;
+    _pending_reliable_messages.erase(msg.sequence_number);
+    return replay_pending_messages(header->channel);
+  }
+
+  // Acknowledge complete messages selectively, so that the peer doesn't
+  // resend them while they wait here for their predecessors.
+  _received_message_ids.try_add(msg.sequence_number);
+  channel.complete.emplace(header->sequence_number, msg.sequence_number);
 }
 
 //------------------------------------------------------------------------------
 inline
-void SocketImpl::replay_pending_messages() {
+void SocketImpl::replay_pending_messages(ChannelId channel_id) {
   auto& pms = _pending_reliable_messages;
 
-  for (auto i = pms.begin(); i != pms.end();) {
-    auto& pm = i->second;
+  while (is_open()) {
+    auto& channel = _in_channels[channel_id];
 
-    if (pm.sequence_number == _sync->last_used_reliable_sn + 1) {
-      auto full_message = pm.get_complete_message();
-      if (!full_message) return;
-      if (!user_handle_reliable_msg(*full_message)) return;
-      i = pms.erase(i);
-    }
-    else {
-      ++i;
-    }
+    auto c = channel.complete.find(channel.next_sn);
+    if (c == channel.complete.end()) return;
+
+    auto csn = c->first;
+    auto sn  = c->second;
+    auto pm  = pms.find(sn);
+    assert(pm != pms.end());
+
+    auto full_message = pm->second.get_complete_message();
+    assert(full_message);
+
+    if (!user_handle_reliable_msg(*full_message)) return;
+
+    // The handler may have closed the socket (and thus cleared the
+    // channels), don't reuse the references from above.
+    pms.erase(sn);
+    _in_channels[channel_id].complete.erase(csn);
   }
 }
 
 //------------------------------------------------------------------------------
+// The message must be the next one in its channel. Returns false if there
+// is no handler for it (or if it's malformed).
 inline
 bool SocketImpl::user_handle_reliable_msg(InMessageFull& msg) {
-  if (!_on_receive_reliable) return false;
-  // The callback may hold a shared_ptr to this, so I placed the scope
-  // here so that 'f' would get destroyed and thus state->was_destroyed
-  // would be relevant in the line below.
-  {
-    auto f = std::move(_on_receive_reliable);
-    f(boost::system::error_code(), msg.payload);
+  namespace asio = boost::asio;
+
+  auto header = transport::decode_channel_header(msg.payload);
+  assert(header);
+
+  auto& channel = _in_channels[header->channel];
+  auto payload = msg.payload + transport::ChannelHeader::size;
+
+  if (msg.type == MessageType::reliable) {
+    if (!channel.on_receive) return false;
+
+    ++channel.next_sn;
+    _received_message_ids.try_add(msg.sequence_number);
+
+    // The callback may hold a shared_ptr to this, so I placed the scope
+    // here so that 'f' would get destroyed and thus state->was_destroyed
+    // would be relevant in the line below.
+    {
+      auto f = std::move(channel.on_receive);
+      f(boost::system::error_code(), payload);
+    }
+    return true;
+  }
+
+  // Stream frames share the channel sequence numbers (and thus the
+  // ordering) with other reliable messages in the same channel.
+  assert(msg.type == MessageType::stream);
+
+  if (!channel.on_receive_stream) return false;
+
+  if (asio::buffer_size(payload) < 1) {
+    handle_error(transport::error::parse_error);
+    return false;
   }
+
+  auto flags = *asio::buffer_cast<const uint8_t*>(payload);
+  bool is_last = flags & OutStream::last;
+
+  ++channel.next_sn;
   _received_message_ids.try_add(msg.sequence_number);
-  _sync->last_used_reliable_sn = msg.sequence_number;
+
+  {
+    auto f = std::move(channel.on_receive_stream);
+    f(boost::system::error_code(), payload + 1, is_last);
+  }
   return true;
 }
 
@@ -551,38 +1354,275 @@ void SocketImpl::start_sending() {
   using boost::system::error_code;
   using boost::asio::buffer;
 
-  if (!_socket.is_open()) return;
+  if (!is_open()) return;
+
+  fill_out_streams();
+
   if (_send_state != SendState::pending) return;
 
-  auto opt_encoded_size = encode_packet( _qos
-                                       , _transmit_queue
-                                       , _received_message_ids
-                                       , tx_buffer);
+  if (_pacing && wait_for_pacer()) return;
 
-  if (!opt_encoded_size) {
-    _send_keepalive_alarm.start(_keepalive_period);
+  if (try_send_probe()) return;
 
-    return _strand.dispatch([this, self = shared_from_this()]() {
-        if (_send_state != SendState::pending) return;
+  if (_io_batch_size > 1) {
+    return start_sending_batch();
+  }
 
-        if (can_exec_on_send_handlers()) {
-          exec_on_send_handlers(error_code());
-        }
-        if (_transmit_queue.empty() && _on_flush) {
-          move_exec(_on_flush);
-        }
-      });
+  auto opt_encoded_size = encode_next_packet(tx_buffer);
+
+  if (!opt_encoded_size) {
+    return on_nothing_to_send();
   }
 
   _send_state = SendState::sending;
 
-  _socket.async_send_to
+  if (_pacing) {
+    _pacer.on_sent(*opt_encoded_size, _qos.pacing_rate(), clock::now());
+  }
+
+  ++_io_counters.tx_syscalls;
+  ++_io_counters.tx_packets;
+  _io_counters.tx_bytes += *opt_encoded_size;
+
+  udp_socket().async_send_to
       ( buffer(tx_buffer.data(), *opt_encoded_size)
       , _remote_endpoint
-      , _strand.wrap([self = shared_from_this()]
-                     (const error_code& error, std::size_t size) {
-                       self->on_send(error, size);
-                     }));
+      , _strand.wrap(async::make_custom_alloc_handler
+          ( _send_handler_memory
+          , [self = shared_from_this()]
+            (const error_code& error, std::size_t size) {
+              self->on_send(error, size);
+            })));
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::on_nothing_to_send() {
+  using boost::system::error_code;
+
+  // With data in flight the alarm also declares it lost (see
+  // on_send_keepalive_alarm), which must not happen before the
+  // retransmission timeout.
+  _send_keepalive_alarm.start(_transmit_queue.empty()
+                              ? _keepalive_period
+                              : std::max<async::alarm::duration>( _keepalive_period
+                                                               , _qos.rto()));
+
+  // If the last packets of a burst get lost, no later packet is acked
+  // which would reveal it. Postponed for as long as acks keep coming.
+  if (!_transmit_queue.empty()) {
+    using namespace std::chrono;
+    _tail_loss_alarm.start(std::max<clock::duration>( 2 * _qos.rtt()
+                                                    , milliseconds(10)));
+  }
+
+  _strand.dispatch([this, self = shared_from_this()]() {
+      if (_send_state != SendState::pending) return;
+
+      if (can_exec_on_send_handlers()) {
+        exec_on_send_handlers(error_code());
+      }
+      if (_transmit_queue.empty() && _on_flush) {
+        move_exec(_on_flush);
+      }
+    });
+}
+
+//------------------------------------------------------------------------------
+inline
+void SocketImpl::start_sending_batch() {
+  _tx_batch.clear();
+
+  while (!_tx_batch.full()) {
+    auto& packet = _tx_batch.back_slot();
+
+    auto opt_encoded_size = encode_next_packet(packet.data);
+
+    if (!opt_encoded_size) break;
+
+    packet.size = *opt_encoded_size;
+    _tx_batch.push();
+  }
+
+  if (_tx_batch.empty()) {
+    return on_nothing_to_send();
+  }
+
+  _send_state = SendState::sending;
+
+  if (_pacing) {
+    // The whole batch leaves in a burst, the pacer delays the next one
+    // accordingly.
+    size_t bytes = 0;
+    for (size_t i = 0; i < _tx_batch.size(); ++i) {
+      bytes += _tx_batch[i].size;
+    }
+    _pacer.on_sent(bytes, _qos.pacing_rate(), clock::now());
+  }
+
+  send_tx_batch(0);
+}
+
+//------------------------------------------------------------------------------
+// The parity of the last group of data packets (if FEC is enabled) goes
+// out right after the group.
+inline
+boost::optional<size_t>
+SocketImpl::encode_next_packet(std::vector<uint8_t>& out_packet) {
+  if (auto parity = _fec_encoder.take_parity()) {
+    return transport::encode_parity_packet( _qos
+                                          , *parity
+                                          , _remote_connection_id
+                                          , out_packet);
+  }
+
+  return encode_packet( _qos
+                      , _transmit_queue
+                      , _fec_encoder
+                      , _received_message_ids
+                      , _remote_connection_id
+                      , out_packet);
+}
+
+//------------------------------------------------------------------------------
+// Send an MTU probe instead of the next packet if the path MTU discovery
+// wants one. Returns true if the probe has been sent.
+inline
+bool SocketImpl::try_send_probe() {
+  using boost::system::error_code;
+
+  // Wait until we hear from the remote.
+  if (!_sync) return false;
+
+  auto probe_size = _qos.path_mtu().next_probe_size(clock::now(), _qos.rtt());
+
+  if (!probe_size) return false;
+
+  auto opt_encoded_size = transport::encode_probe_packet( _qos
+                                                        , _received_message_ids
+                                                        , _remote_connection_id
+                                                        , *probe_size
+                                                        , tx_buffer);
+
+  if (!opt_encoded_size) return false;
+
+  _send_state = SendState::sending;
+
+  if (_pacing) {
+    _pacer.on_sent(*opt_encoded_size, _qos.pacing_rate(), clock::now());
+  }
+
+  ++_io_counters.tx_syscalls;
+  ++_io_counters.tx_packets;
+  _io_counters.tx_bytes += *opt_encoded_size;
+
+  udp_socket().async_send_to
+      ( boost::asio::buffer(tx_buffer.data(), *opt_encoded_size)
+      , _remote_endpoint
+      , _strand.wrap(async::make_custom_alloc_handler
+          ( _send_handler_memory
+          , [self = shared_from_this(), size = *probe_size]
+            (const error_code& error, std::size_t sent) {
+              if (error == boost::asio::error::message_size) {
+                self->_qos.path_mtu().on_probe_too_big(size);
+                return self->on_send(error_code(), sent);
+              }
+              self->on_send(error, sent);
+            })));
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// If the pacer doesn't allow sending yet, schedule start_sending for when
+// it does and return true.
+inline
+bool SocketImpl::wait_for_pacer() {
+  using boost::system::error_code;
+
+  auto delay = _pacer.delay(clock::now());
+
+  if (delay == clock::duration(0)) return false;
+
+  _send_state = SendState::paced;
+
+  _pacing_timer.expires_from_now(delay);
+  _pacing_timer.async_wait(_strand.wrap(async::make_custom_alloc_handler
+      ( _send_handler_memory
+      , [self = shared_from_this()](const error_code& error) {
+          self->_send_state = SendState::pending;
+          if (error) return self->exec_on_send_handlers(error);
+          self->start_sending();
+        })));
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Send packets [first, _tx_batch.size()) with as few system calls as
+// possible. If the socket's send buffer is full, the next packet is sent
+// asynchronously and the rest of the batch follows once that completes.
+inline
+void SocketImpl::send_tx_batch(size_t first) {
+  using boost::system::error_code;
+  namespace asio = boost::asio;
+
+  size_t bytes = 0;
+
+  while (first < _tx_batch.size()) {
+    error_code ec;
+    auto sent = transport::send_batch( udp_socket()
+                                     , _tx_batch
+                                     , first
+                                     , _remote_endpoint
+                                     , ec);
+
+    ++_io_counters.tx_syscalls;
+
+    for (size_t i = first; i < first + sent; ++i) {
+      bytes += _tx_batch[i].size;
+    }
+
+    _io_counters.tx_packets += sent;
+    first += sent;
+
+    if (ec == asio::error::would_block) {
+      auto& packet = _tx_batch[first];
+
+      ++_io_counters.tx_syscalls;
+      ++_io_counters.tx_packets;
+      _io_counters.tx_bytes += bytes + packet.size;
+
+      udp_socket().async_send_to
+          ( asio::buffer(packet.data.data(), packet.size)
+          , _remote_endpoint
+          , _strand.wrap(async::make_custom_alloc_handler
+              ( _send_handler_memory
+              , [self = shared_from_this(), first]
+                (const error_code& error, std::size_t size) {
+                  if (error) return self->on_send(error, size);
+                  self->send_tx_batch(first + 1);
+                })));
+      return;
+    }
+
+    if (ec) {
+      _io_counters.tx_bytes += bytes;
+      return _strand.post(async::make_custom_alloc_handler
+          ( _send_handler_memory
+          , [self = shared_from_this(), ec]() {
+              self->on_send(ec, 0);
+            }));
+    }
+  }
+
+  _io_counters.tx_bytes += bytes;
+
+  _strand.post(async::make_custom_alloc_handler
+      ( _send_handler_memory
+      , [self = shared_from_this(), bytes]() {
+          self->on_send(error_code(), bytes);
+        }));
 }
 
 //------------------------------------------------------------------------------
@@ -598,7 +1638,12 @@ void SocketImpl::on_send( const boost::system::error_code& error
 
   _send_state = SendState::pending;
 
-  if (error) {
+  if (error == boost::asio::error::message_size) {
+    // The packet didn't fit into the MTU of the first hop, the path
+    // must have changed.
+    _qos.path_mtu().on_packet_too_big(_qos.mss());
+  }
+  else if (error) {
     assert(error == boost::asio::error::operation_aborted);
     return exec_on_send_handlers(error);
   }
@@ -611,25 +1656,99 @@ void SocketImpl::on_send( const boost::system::error_code& error
   // re-send acks, then flush end return.
   if (_transmit_queue.empty() && _on_flush) {
     move_exec(_on_flush);
-    if (!_socket.is_open()) return;
+    if (!is_open()) return;
   }
 
   start_sending();
 }
 
+//------------------------------------------------------------------------------
+inline void SocketImpl::io_batch_size(size_t n) {
+#if CLUB_HAS_MMSG
+  _io_batch_size = std::max<size_t>(1, n);
+#else
+  _io_batch_size = 1;
+#endif
+
+  if (_io_batch_size > 1) {
+    // The first received datagram lands in rx_buffer, the batch only
+    // holds the ones drained after it.
+    _rx_batch.reset(_io_batch_size - 1, transport::PathMtu::MAX());
+    _tx_batch.reset(_io_batch_size, packet_size);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline SocketImpl::SocketStats SocketImpl::stats() const {
+  SocketStats s;
+
+  s.packets_sent     = _io_counters.tx_packets;
+  s.packets_received = _io_counters.rx_packets;
+  s.bytes_sent       = _io_counters.tx_bytes;
+  s.bytes_received   = _io_counters.rx_bytes;
+
+  s.bytes_retransmitted       = _transmit_queue.bytes_retransmitted();
+  s.duplicate_chunks_received = _duplicate_chunks_received;
+
+  s.srtt    = _qos.rtt();
+  s.min_rtt = _qos.min_rtt();
+  s.rto     = _qos.rto();
+
+  s.cwnd            = _qos.cwnd();
+  // Only broken accounting in QualityOfService can make this negative,
+  // which the stats shouldn't hide.
+  assert(_qos.bytes_in_flight() >= 0);
+  s.bytes_in_flight = _qos.bytes_in_flight();
+
+  s.transmit_queue_size  = _transmit_queue.size();
+  s.transmit_queue_bytes = _transmit_queue.size_in_bytes();
+
+  for (auto& pm : _pending_reliable_messages) {
+    s.pending_reassembly_bytes += pm.second.data.size();
+  }
+
+  if (_pending_unreliable_message) {
+    s.pending_reassembly_bytes += _pending_unreliable_message->data.size();
+  }
+
+  s.loss_events  = _qos.loss_events();
+  s.packets_lost = _qos.packets_lost();
+
+  s.keepalives_sent     = _keepalives_sent;
+  s.keepalives_received = _keepalives_received;
+
+  return s;
+}
+
 //------------------------------------------------------------------------------
 inline bool SocketImpl::can_exec_on_send_handlers() const {
   return _transmit_queue.size_in_bytes() < _qos.cwnd();
 }
 
+//------------------------------------------------------------------------------
+// For messages that are refused without being queued. The handler is
+// posted rather than executed so that it never runs inside the send call.
+inline
+void SocketImpl::post_send_error(OnSend on_send, boost::system::error_code error) {
+  auto h = std::make_shared<OnSend>(std::move(on_send));
+
+  _strand.post([h, error]() { move_exec(*h, error); });
+}
+
 //------------------------------------------------------------------------------
 inline void SocketImpl::exec_on_send_handlers(boost::system::error_code error) {
-  auto fs = move(_on_send);
-  while (!fs.empty()) {
-    auto f = std::move(fs.front());
-    f(error);
-    fs.pop();
+  // Handlers may send more messages (or recurse into here), these go
+  // to the spare vector.
+  std::vector<OnSend> fs;
+  fs.swap(_on_send);
+  _on_send.swap(_on_send_spare);
+
+  for (auto& f : fs) {
+    move_exec(f, error);
   }
+
+  fs.clear();
+  if (fs.capacity() > _on_send_spare.capacity()) _on_send_spare.swap(fs);
 }
 
 //------------------------------------------------------------------------------
@@ -641,6 +1760,7 @@ SocketImpl::construct_packet_with_one_message(OutMessage& m) {
   auto opt_encoded_size = encode_packet_with_one_message( _qos
                                                         , m
                                                         , _received_message_ids
+                                                        , _remote_connection_id
                                                         , data);
 
   return data;
@@ -656,7 +1776,9 @@ void SocketImpl::sync_send_close_message() {
 
   auto data = construct_packet_with_one_message(m);
 
-  _socket.send_to(boost::asio::buffer(data), _remote_endpoint);
+  // Best effort, the remote times out if this doesn't arrive.
+  boost::system::error_code ignored;
+  udp_socket().send_to(boost::asio::buffer(data), _remote_endpoint, 0, ignored);
 }
 
 //------------------------------------------------------------------------------
@@ -666,12 +1788,21 @@ inline void SocketImpl::on_recv_timeout_alarm() {
 }
 
 inline void SocketImpl::on_send_keepalive_alarm() {
+  if (_connecting) {
+    return send_syn();
+  }
+
   if (_transmit_queue.empty()) {
-    add_message(false, MessageType::keep_alive, 0, std::vector<uint8_t>());
+    ++_keepalives_sent;
+    add_message( Priority::high
+               , false
+               , MessageType::keep_alive
+               , 0
+               , std::vector<uint8_t>());
   }
   else {
     // There are data in the transmit queue that has not been acknowledged
-    // for a signifficant time. We clear the in_flight info of _qos to
+    // for at least the retransmission timeout. We clear the in_flight info of _qos to
     // indicate we consider the data in flight to be lost and that they need to
     // be resent.
     // TODO: Should probably also reset cwnd to its default value.
@@ -681,6 +1812,17 @@ inline void SocketImpl::on_send_keepalive_alarm() {
   start_sending();
 }
 
+//------------------------------------------------------------------------------
+// Nothing has been acked for about two round trips although there are
+// messages in flight. Resend the last one: if it gets through, its ack
+// reveals which packets before it were lost and those are resent right
+// away (see QualityOfService::lost_before).
+inline void SocketImpl::on_tail_loss_alarm() {
+  if (!_transmit_queue.retransmit_last()) return;
+  _qos.allow_tail_loss_probe();
+  start_sending();
+}
+
 //------------------------------------------------------------------------------
 inline
 boost::asio::ip::udp::endpoint
@@ -718,13 +1860,23 @@ private:
   std::shared_ptr<SocketImpl> _impl;
 
 public:
-  /// Maximum size of a packet. Note that this is not the maximum
+  /// Default maximum size of a packet. Note that this is not the maximum
   /// size of a message, but messages bigger than packet_size
   /// shall be fragmented into multiple packets. Thus to achieve
   /// low latencies a message should try to fit into packet_size.
+  /// Once connected, the actual size follows the discovered path MTU
+  /// (see path_mtu()).
   static const size_t packet_size = SocketImpl::packet_size;
 
+  /// Largest message send_reliable accepts, bigger ones fail with
+  /// boost::asio::error::message_size. Use send_stream for those.
+  static const size_t max_reliable_message_size
+    = SocketImpl::max_reliable_message_size;
+
   using OnReceive = SocketImpl::OnReceive;
+  using OnReceiveStream = SocketImpl::OnReceiveStream;
+  using ChannelId = transport::ChannelId;
+  using MessageKey = SocketImpl::MessageKey;
   using OnFlush = SocketImpl::OnFlush;
 
 public:
@@ -739,6 +1891,13 @@ public:
     : _impl(std::make_shared<SocketImpl>(std::move(udp_socket)))
   {}
 
+  /// Create the socket sharing the UDP port of the multiplexer
+  /// with other sockets. The remote end may be either multiplexed
+  /// or not.
+  Socket(std::shared_ptr<Multiplexer> multiplexer)
+    : _impl(std::make_shared<SocketImpl>(std::move(multiplexer)))
+  {}
+
   /// Move constructor
   Socket(Socket&& other)
     : _impl(std::move(other._impl)) {}
@@ -773,6 +1932,26 @@ public:
     _impl->rendezvous_connect(std::move(remote_ep), std::move(on_connect));
   }
 
+  /// Start an asynchronous rendezvous connect with a remote socket whose
+  /// connection id is known (e.g. exchanged through a rendezvous server).
+  /// This is needed when more than one multiplexed socket connects to
+  /// the same remote UDP endpoint, otherwise the first packets could
+  /// not be told apart.
+  template<class OnConnect>
+  void rendezvous_connect( udp::endpoint remote_ep
+                         , transport::ConnectionId remote_connection_id
+                         , OnConnect on_connect) {
+    _impl->rendezvous_connect( std::move(remote_ep)
+                             , remote_connection_id
+                             , std::move(on_connect));
+  }
+
+  /// Return the id which packets destined to this socket carry. Sockets
+  /// which own their UDP port return transport::no_connection_id.
+  transport::ConnectionId connection_id() {
+    return _impl->connection_id();
+  }
+
   /// Start an asynchronous read of a message that has been sent
   /// by the other end using the send_unreliable function.
   void receive_unreliable(OnReceive _1) {
@@ -782,7 +1961,12 @@ public:
   /// Start an asynchronous read of a message that has been sent
   /// by the other end using the send_reliable function.
   void receive_reliable(OnReceive _1) {
-    _impl->receive_reliable(std::move(_1));
+    _impl->receive_reliable(transport::default_channel, std::move(_1));
+  }
+
+  /// Same as above, but only for messages sent over `channel`.
+  void receive_reliable(ChannelId channel, OnReceive _1) {
+    _impl->receive_reliable(channel, std::move(_1));
   }
 
   /// Start an asynchronous send of an unreliable message.
@@ -793,13 +1977,138 @@ public:
     _impl->send_unreliable(std::move(_1), std::forward<OnSend>(on_send));
   }
 
+  /// Same as above, but the message is `head` followed by `tail`. The
+  /// two are gathered into packets without being copied into one buffer
+  /// first, and `tail` may be shared with other messages.
+  template<class OnSend>
+  void send_unreliable( std::vector<uint8_t>    head
+                      , transport::SharedBuffer tail
+                      , OnSend&& on_send) {
+    _impl->send_unreliable( std::move(head)
+                          , std::move(tail)
+                          , std::forward<OnSend>(on_send));
+  }
+
+  /// Same as send_unreliable, but only the latest value sent with `key`
+  /// matters. If the previous message with the same key hasn't left the
+  /// send queue yet, its payload is replaced by this one (a partially
+  /// sent one is dropped), so under congestion the peer receives the
+  /// freshest value instead of a backlog of stale ones.
+  template<class OnSend>
+  void send_unreliable( MessageKey           key
+                      , std::vector<uint8_t> data
+                      , OnSend&&             on_send) {
+    _impl->send_unreliable( key
+                          , std::move(data)
+                          , transport::SharedBuffer()
+                          , std::forward<OnSend>(on_send));
+  }
+
+  template<class OnSend>
+  void send_unreliable( MessageKey              key
+                      , std::vector<uint8_t>    head
+                      , transport::SharedBuffer tail
+                      , OnSend&&                on_send) {
+    _impl->send_unreliable( key
+                          , std::move(head)
+                          , std::move(tail)
+                          , std::forward<OnSend>(on_send));
+  }
+
   /// Start an asynchronous send of a reliable message.
   /// A reliable message shall be retransmitted until acknowledged and
   /// the order in which the messages will be received shall
   /// be the same as the order in which they were sent.
   template<class OnSend>
   void send_reliable(std::vector<uint8_t> _1, OnSend&& on_send) {
-    _impl->send_reliable(std::move(_1), std::forward<OnSend>(on_send));
+    send_reliable( transport::default_channel
+                 , std::move(_1)
+                 , std::forward<OnSend>(on_send));
+  }
+
+  /// Same as above, but the message is sent over `channel`. The ordering
+  /// is only kept among messages (and streams) of the same channel, so
+  /// a lost packet in one channel doesn't hold up the others. All
+  /// channels share the congestion window.
+  template<class OnSend>
+  void send_reliable( ChannelId            channel
+                    , std::vector<uint8_t> _1
+                    , OnSend&&             on_send) {
+    _impl->send_reliable( channel
+                        , std::move(_1)
+                        , std::forward<OnSend>(on_send));
+  }
+
+  /// Same as above, but the data is not copied. It must not be modified
+  /// until the message is acknowledged, which is why it is const. This
+  /// is useful when the same data is sent through many sockets.
+  template<class OnSend>
+  void send_reliable(transport::SharedBuffer _1, OnSend&& on_send) {
+    send_reliable( transport::default_channel
+                 , std::move(_1)
+                 , std::forward<OnSend>(on_send));
+  }
+
+  template<class OnSend>
+  void send_reliable( ChannelId               channel
+                    , transport::SharedBuffer _1
+                    , OnSend&&                on_send) {
+    _impl->send_reliable( channel
+                        , std::move(_1)
+                        , std::forward<OnSend>(on_send));
+  }
+
+  /// Start an asynchronous send of a reliable message of arbitrary size.
+  /// Instead of taking the whole message at once, the data is pulled
+  /// from `source` (see transport::StreamSource) only as fast as the
+  /// congestion window allows, so memory use stays bounded. The on_send
+  /// handler executes once the end of the stream has been queued.
+  /// Streams are ordered with respect to each other and to messages sent
+  /// with send_reliable over the same channel.
+  template<class OnSend>
+  void send_stream(transport::StreamSource source, OnSend&& on_send) {
+    send_stream( transport::default_channel
+               , std::move(source)
+               , std::forward<OnSend>(on_send));
+  }
+
+  template<class OnSend>
+  void send_stream( ChannelId               channel
+                  , transport::StreamSource source
+                  , OnSend&&                on_send) {
+    _impl->send_stream( channel
+                      , std::move(source)
+                      , std::forward<OnSend>(on_send));
+  }
+
+  /// Same as above, but the data is already in memory. The frames are
+  /// sent directly from it without being copied.
+  template<class OnSend>
+  void send_stream(transport::SharedBuffer data, OnSend&& on_send) {
+    send_stream( transport::default_channel
+               , std::move(data)
+               , std::forward<OnSend>(on_send));
+  }
+
+  template<class OnSend>
+  void send_stream( ChannelId               channel
+                  , transport::SharedBuffer data
+                  , OnSend&&                on_send) {
+    _impl->send_stream( channel
+                      , std::move(data)
+                      , std::forward<OnSend>(on_send));
+  }
+
+  /// Start an asynchronous read of the next part of a stream sent by the
+  /// other end using the send_stream function. Parts are delivered in
+  /// order as soon as they arrive, `is_last` is set on the last part of
+  /// each stream.
+  void receive_stream(OnReceiveStream _1) {
+    _impl->receive_stream(transport::default_channel, std::move(_1));
+  }
+
+  void receive_stream(ChannelId channel, OnReceiveStream _1) {
+    _impl->receive_stream(channel, std::move(_1));
   }
 
   /// Schedule the on_flush callback for execution once all
@@ -837,6 +2146,124 @@ public:
     _impl->keepalive_period(d);
   }
 
+  /// Set the maximum number of datagrams that may be received or sent
+  /// with a single system call (recvmmsg/sendmmsg). The default value 1
+  /// disables batching. On systems without recvmmsg/sendmmsg the value
+  /// is always 1.
+  void io_batch_size(size_t n) {
+    _impl->io_batch_size(n);
+  }
+
+  size_t io_batch_size() const {
+    return _impl->io_batch_size();
+  }
+
+  /// Return the number of system calls, packets and bytes that went
+  /// through the underlying UDP socket.
+  const transport::IoCounters& io_counters() const {
+    return _impl->io_counters();
+  }
+
+  /// Return a snapshot of the transport's counters and state: traffic,
+  /// retransmissions, round trip times, congestion window, queue depths,
+  /// losses and keepalives.
+  transport::SocketStats stats() const {
+    return _impl->stats();
+  }
+
+  /// Select the algorithm deciding how much data may be in flight.
+  /// LEDBAT (the default) yields to other traffic once it starts
+  /// delaying it, CUBIC and BBR compete for the bandwidth. Should be
+  /// set before any data is sent, the state of the previous controller
+  /// is lost.
+  void congestion_control(transport::CongestionControl cc) {
+    _impl->congestion_control(cc);
+  }
+
+  /// Same as above but with a custom implementation.
+  void congestion_controller(
+      std::unique_ptr<transport::CongestionController> cc) {
+    _impl->congestion_controller(std::move(cc));
+  }
+
+  const transport::CongestionController& congestion_controller() const {
+    return _impl->congestion_controller();
+  }
+
+  /// When enabled, packets are spread over the round trip time at
+  /// roughly cwnd/rtt (or at the rate the congestion controller asks
+  /// for) instead of being sent in bursts as soon as the window allows.
+  /// Disabled by default.
+  void pacing(bool enable) {
+    _impl->pacing(enable);
+  }
+
+  bool pacing() const {
+    return _impl->pacing();
+  }
+
+  /// Return the smoothed round trip time.
+  std::chrono::steady_clock::duration rtt() const {
+    return _impl->rtt();
+  }
+
+  /// Return the retransmission timeout (RFC 6298) after which unacked
+  /// reliable messages are resent.
+  std::chrono::steady_clock::duration rto() const {
+    return _impl->rto();
+  }
+
+  /// Return the smallest round trip time seen during the last ten
+  /// seconds, or none if nothing has been acked yet.
+  boost::optional<std::chrono::steady_clock::duration> min_rtt() const {
+    return _impl->min_rtt();
+  }
+
+  /// Return the size of the largest packet currently being sent. It
+  /// starts at packet_size and is discovered by probing the path where
+  /// the system allows us to forbid IP fragmentation.
+  size_t path_mtu() const {
+    return _impl->path_mtu();
+  }
+
+  /// Enable forward error correction of outgoing packets. After each
+  /// group of data packets a parity packet is sent from which the peer
+  /// rebuilds any single lost packet of the group, without waiting for
+  /// a retransmission and including unreliable messages. The group size
+  /// follows the observed loss rate (see fec_group_size). Disabled by
+  /// default, the peer needs no configuration.
+  void fec(bool enable) {
+    _impl->fec(enable);
+  }
+
+  bool fec() const {
+    return _impl->fec();
+  }
+
+  /// Return the current number of data packets per parity packet.
+  size_t fec_group_size() const {
+    return _impl->fec_group_size();
+  }
+
+  /// Set the priority class of reliable messages and streams sent over
+  /// `channel` (transport::Priority::normal by default). A packet only
+  /// carries messages of a lower class when no message of a higher one
+  /// is waiting, so e.g. bulk transfers on a low priority channel don't
+  /// delay anything else. Messages already queued keep their class.
+  void priority(ChannelId channel, transport::Priority p) {
+    _impl->priority(channel, p);
+  }
+
+  /// Same as above but for unreliable messages.
+  void unreliable_priority(transport::Priority p) {
+    _impl->unreliable_priority(p);
+  }
+
+  /// Return the queue depth and wait time counters of the given class.
+  const transport::TransmitQueue::ClassStats&
+  transmit_stats(transport::Priority p) const {
+    return _impl->transmit_stats(p);
+  }
 };
 
 } // namespace
@@ -16,9 +16,11 @@
 #define CLUB_TRANSPORT_ACK_SET_H
 
 #include <bitset>
+#include <vector>
 #include <binary/encoder.h>
 #include <binary/decoder.h>
 #include <binary/encoded.h>
+#include <binary/varint.h>
 
 #include "sequence_number.h"
 #include "club/debug/ostream_uuid.h"
@@ -27,235 +29,297 @@ namespace binary { class decoder; }
 
 namespace club { namespace transport {
 
+// Set of sequence numbers used for selective acknowledgements. It consists
+// of a cumulative part - every sequence number below `cumulative()` is in
+// the set - and a bitmap of up to `max_window` sequence numbers above it
+// that have been added out of order. The bitmap is only as wide as needed,
+// so is its encoding.
 class AckSet {
 public:
-  AckSet();
-  AckSet(SequenceNumber);
+  static constexpr size_t max_window = 4096;
+
+  AckSet() {}
 
   bool try_add(SequenceNumber new_sn);
   bool can_add(SequenceNumber new_sn) const;
   bool is_in(SequenceNumber sn) const;
-  bool empty() const { return bitmask == 0; }
-
-  struct iterator {
-    iterator(const AckSet& acks, int _pos)
-      : acks(acks), pos(_pos) {
-      for (;pos != -1; --pos) {
-        if (acks.get_bit(pos) == 1) {
-          break;
-        }
-      }
-    }
+  bool empty() const { return _is_empty; }
 
-    SequenceNumber operator*() const {
-      assert(!acks.empty());
-      return acks.highest_sequence_number - pos;
-    }
+  // Union. Acks may arrive reordered, merging them (as opposed to
+  // replacing the old set with the new one) doesn't lose information.
+  void merge(const AckSet&);
 
-    iterator& operator++() {// prefix
-      --pos;
-      for (;pos >= 0; --pos) {
-        if (acks.get_bit(pos) == 1) {
-          break;
-        }
-      }
-      return *this;
-    }
+  // Every sequence number below this one is in the set (unless the set
+  // is empty), the returned one is not.
+  SequenceNumber cumulative() const { return _next; }
 
-    iterator operator++(int) {// postfix
-      auto ret = *this;
-      ++(*this);
-      return ret;
-    }
+  // Execute f(sn) for each sn in the set above `cumulative()`, in
+  // ascending order.
+  template<class F> void for_each_selective(F&&) const;
 
-    bool operator==(const iterator& other) const {
-      return &acks == &other.acks && pos == other.pos;
-    }
+  size_t encoded_size() const {
+    if (_is_empty) return 1;
+    return 1 + binary::varint_size(_next)
+             + _selective.size() * sizeof(uint64_t);
+  }
 
-    bool operator!=(const iterator& other) const {
-      return !(*this == other);
-    }
+private:
+  friend std::ostream& operator<<(std::ostream&, const AckSet&);
+  friend void decode(binary::decoder&, AckSet&);
+  template<typename Encoder> friend void encode(Encoder&, const AckSet&);
 
-    const AckSet& acks;
-    int pos;
-  };
+  static constexpr size_t max_words = max_window / 64;
 
-  iterator begin() const {
-    if (empty()) return end();
-    return iterator(*this, 31);
+  bool get_bit(size_t i) const {
+    return i / 64 < _selective.size() && (_selective[i / 64] >> (i % 64)) & 1;
   }
 
-  iterator end() const { return iterator(*this, -1); }
-
-  void set_bit(int p) {
-    assert(0 <= p && p < 32);
-    bitmask |= 1 << p;
+  void set_bit(size_t i) {
+    if (i / 64 >= _selective.size()) _selective.resize(i / 64 + 1, 0);
+    _selective[i / 64] |= uint64_t(1) << (i % 64);
   }
 
-  bool get_bit(int p) const {
-    assert(0 <= p && p < 32);
-    return bitmask & (1 << p);
-  }
+  // Membership of [first, first + 64) as bits, `first` must be
+  // above _next.
+  uint64_t word_from(SequenceNumber first) const;
 
-private:
-  friend std::ostream& operator<<(std::ostream&, const AckSet&);
-  friend void decode(binary::decoder&, AckSet&);
-  template<typename Encoder> friend void encode(Encoder&, const AckSet&);
+  void advance();
+  void shift_right(size_t);
 
-  SequenceNumber highest_sequence_number;
-  SequenceNumber lowest_sequence_number;
+private:
+  bool _is_empty = true;
+  SequenceNumber _next = 0;
 
-  // i'th bit is set <=> (highest_sequence_number - i) belongs to the set
-  uint32_t bitmask;
+  // i'th bit is set <=> (_next + 1 + i) belongs to the set
+  std::vector<uint64_t> _selective;
 };
 
 //------------------------------------------------------------------------------
 // Implementation
 //------------------------------------------------------------------------------
-inline AckSet::AckSet()
-  : highest_sequence_number(0)
-  , lowest_sequence_number(0)
-  , bitmask(0)
-{}
-
-inline AckSet::AckSet(SequenceNumber sn)
-  : highest_sequence_number(sn)
-  , lowest_sequence_number(sn)
-  , bitmask(0)
-{ }
-
 inline bool AckSet::try_add(SequenceNumber new_sn) {
-  if (bitmask == 0) {
-    highest_sequence_number = new_sn;
-    lowest_sequence_number = new_sn;
-    set_bit(0);
+  if (_is_empty) {
+    _is_empty = false;
+    _next = new_sn + 1;
+    _selective.clear();
     return true;
   }
-  else {
-    auto hsn = highest_sequence_number;
 
-    if (new_sn == hsn) return true;
-    if (new_sn < hsn) {
-      if (new_sn < hsn - 31) return true;
-      set_bit(hsn - new_sn);
-      return true;
-    }
-    else {
-      if (new_sn > hsn + 31) {
-        return false;
-      }
+  if (new_sn < _next) return true;
 
-      auto shift = new_sn - hsn;
+  if (new_sn == _next) {
+    advance();
+    return true;
+  }
 
-      for (decltype(shift) i = 31; i > 31 - shift; --i) {
-        if (get_bit(i) == 1 || (hsn <= lowest_sequence_number + i)) {
-          continue;
-        }
-        return false;
-      }
+  size_t i = new_sn - _next - 1;
 
-      bitmask <<= shift;
-      set_bit(0);
-      highest_sequence_number = new_sn;
-      return true;
-    }
-  }
+  if (i >= max_window) return false;
+
+  set_bit(i);
+  return true;
 }
 
 inline bool AckSet::is_in(SequenceNumber sn) const {
-  if (empty()) return false;
-  if (sn > highest_sequence_number) return false;
-  if (sn < highest_sequence_number - 31) return true;
-  if (sn < lowest_sequence_number) return true;
-  return get_bit(highest_sequence_number - sn);
+  if (_is_empty) return false;
+  if (sn < _next) return true;
+  if (sn == _next) return false;
+  return get_bit(sn - _next - 1);
 }
 
 inline bool AckSet::can_add(SequenceNumber new_sn) const {
-  if (bitmask == 0) {
-    return true;
+  if (_is_empty) return true;
+  if (new_sn <= _next) return true;
+  return new_sn - _next - 1 < max_window;
+}
+
+//------------------------------------------------------------------------------
+inline void AckSet::merge(const AckSet& other) {
+  if (other._is_empty) return;
+  if (_is_empty) { *this = other; return; }
+
+  auto next = std::max(_next, other._next);
+
+  auto end = [](const AckSet& s) {
+    return uint64_t(s._next) + 1 + 64 * s._selective.size();
+  };
+
+  auto last = std::max(end(*this), end(other));
+
+  size_t word_count = last > next + 1 ? (last - next - 1 + 63) / 64 : 0;
+  word_count = std::min<size_t>(word_count, size_t(max_words));
+
+  std::vector<uint64_t> selective(word_count);
+
+  for (size_t i = 0; i < word_count; ++i) {
+    SequenceNumber first = next + 1 + 64 * i;
+    selective[i] = word_from(first) | other.word_from(first);
+  }
+
+  bool next_is_in = is_in(next) || other.is_in(next);
+
+  _next = next;
+  _selective = std::move(selective);
+
+  if (next_is_in) {
+    advance();
   }
   else {
-    auto hsn = highest_sequence_number;
+    shift_right(0);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline uint64_t AckSet::word_from(SequenceNumber first) const {
+  assert(first > _next);
+
+  size_t i = first - _next - 1;
+  size_t w = i / 64;
+  size_t b = i % 64;
+
+  if (w >= _selective.size()) return 0;
+
+  uint64_t r = _selective[w] >> b;
 
-    if (new_sn == hsn) return true;
-    if (new_sn < hsn) {
-      if (new_sn < hsn - 31) return true;
-      return true;
+  if (b && w + 1 < _selective.size()) {
+    r |= _selective[w + 1] << (64 - b);
+  }
+
+  return r;
+}
+
+//------------------------------------------------------------------------------
+// _next has just been added, move it and the sequence numbers
+// that follow it and are already in the set into the cumulative part.
+inline void AckSet::advance() {
+  size_t ones = 0;
+
+  for (auto w : _selective) {
+    if (w == ~uint64_t(0)) {
+      ones += 64;
+      continue;
     }
-    else {
-      if (new_sn > hsn + 31) {
-        return false;
-      }
+#if defined(__GNUC__)
+    ones += __builtin_ctzll(~w);
+#else
+    while (w & 1) { ++ones; w >>= 1; }
+#endif
+    break;
+  }
+
+  _next += ones + 1;
+  shift_right(ones + 1);
+}
+
+//------------------------------------------------------------------------------
+// Also removes trailing zero words.
+inline void AckSet::shift_right(size_t n) {
+  size_t words = n / 64;
+  size_t bits  = n % 64;
+
+  if (words >= _selective.size()) {
+    _selective.clear();
+    return;
+  }
 
-      auto shift = new_sn - hsn;
+  if (n) {
+    size_t new_size = _selective.size() - words;
 
-      for (decltype(shift) i = 31; i > 31 - shift; --i) {
-        if (get_bit(i) == 1 || (hsn <= lowest_sequence_number + i)) {
-          continue;
-        }
-        return false;
+    for (size_t i = 0; i < new_size; ++i) {
+      uint64_t w = _selective[i + words] >> bits;
+
+      if (bits && i + words + 1 < _selective.size()) {
+        w |= _selective[i + words + 1] << (64 - bits);
       }
 
-      return true;
+      _selective[i] = w;
+    }
+
+    _selective.resize(new_size);
+  }
+
+  while (!_selective.empty() && _selective.back() == 0) {
+    _selective.pop_back();
+  }
+}
+
+//------------------------------------------------------------------------------
+template<class F> void AckSet::for_each_selective(F&& f) const {
+  for (size_t w = 0; w < _selective.size(); ++w) {
+    uint64_t word = _selective[w];
+
+    for (size_t b = 0; word; ++b, word >>= 1) {
+      if (word & 1) f(SequenceNumber(_next + 1 + 64 * w + b));
     }
   }
 }
 
+//------------------------------------------------------------------------------
 inline
 std::ostream& operator<<(std::ostream& os, const AckSet& acks) {
   os << "(AckSet ";
 
   if (!acks.empty()) {
-    os << "<" << acks.highest_sequence_number << ","
-       << acks.lowest_sequence_number << "> "
-       << std::bitset<32>(acks.bitmask) << " ";
+    os << "<" << acks._next << "> ";
+
+    for (auto w : acks._selective) {
+      os << std::bitset<64>(w) << " ";
+    }
   }
   else {
     os << "empty ";
   }
 
-  //os << "{";
-  //auto cnt = 0;
-  //for (auto i = acks.begin(); i != acks.end(); ++i) {
-  //  if (cnt++) { os << ", "; }
-  //  os << *i;
-  //}
-  //os << "}";
-
   return os << ")";
 }
 
 }} // club::transport namespace
 
-//------------------------------------------------------------------------------
-namespace binary {
-  template<> struct encoded<::club::transport::AckSet> {
-    static size_t size() {
-      return sizeof(::club::transport::SequenceNumber)
-           + sizeof(uint32_t);
-    }
-  };
-} // binary namespace
-
 namespace club { namespace transport {
 
 //------------------------------------------------------------------------------
+// Encoded as a byte N followed (if N != 0) by the cumulative sequence
+// number (varint) and N - 1 64-bit words of the bitmap. N == 0 means empty.
 template<typename Encoder>
 inline void encode( Encoder& e, const AckSet& ack_set) {
-  e.put((SequenceNumber) ack_set.highest_sequence_number);
-  e.put(ack_set.bitmask);
+  if (ack_set.empty()) {
+    e.template put<uint8_t>(0);
+    return;
+  }
+
+  e.template put<uint8_t>(1 + ack_set._selective.size());
+  e.put(binary::varint<SequenceNumber>(ack_set._next));
+
+  for (auto w : ack_set._selective) {
+    e.put(w);
+  }
 }
 
 //------------------------------------------------------------------------------
 inline void decode(binary::decoder& d, AckSet& ack_set) {
   if (d.error()) return;
 
-  ack_set.highest_sequence_number = d.get<SequenceNumber>();
-  ack_set.bitmask = d.get<uint32_t>();
+  auto n = d.get<uint8_t>();
+
+  ack_set = AckSet();
+
+  if (n == 0) return;
+
+  if (size_t(n - 1) > AckSet::max_words) {
+    d.set_error();
+    return;
+  }
+
+  ack_set._is_empty = false;
+  ack_set._next = d.get<binary::varint<SequenceNumber>>().value;
+  ack_set._selective.resize(n - 1);
+
+  for (auto& w : ack_set._selective) {
+    w = d.get<uint64_t>();
+  }
 }
 
 //------------------------------------------------------------------------------
 
 }} // club::transport namespace
 #endif // ifndef CLUB_TRANSPORT_ACK_SET_H
-
@@ -0,0 +1,244 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_BATCH_IO_H
+#define CLUB_TRANSPORT_BATCH_IO_H
+
+#include <vector>
+#include <boost/asio/ip/udp.hpp>
+
+#if defined(__linux__)
+#  include <sys/socket.h>
+#  define CLUB_HAS_MMSG 1
+#else
+#  define CLUB_HAS_MMSG 0
+#endif
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Number of system calls and datagrams that went through a socket.
+struct IoCounters {
+  uint64_t rx_syscalls = 0;
+  uint64_t tx_syscalls = 0;
+  uint64_t rx_packets  = 0;
+  uint64_t tx_packets  = 0;
+  uint64_t rx_bytes    = 0;
+  uint64_t tx_bytes    = 0;
+};
+
+//------------------------------------------------------------------------------
+// A fixed number of packet buffers that are filled (or drained) by
+// a single recvmmsg (or sendmmsg) call.
+class PacketBatch {
+  using udp = boost::asio::ip::udp;
+
+public:
+  struct Packet {
+    std::vector<uint8_t> data;
+    size_t               size = 0;
+    udp::endpoint        endpoint;
+  };
+
+public:
+  void reset(size_t capacity, size_t packet_size);
+
+  size_t capacity() const { return _packets.size(); }
+  size_t size()     const { return _size; }
+  bool   empty()    const { return _size == 0; }
+  bool   full()     const { return _size == _packets.size(); }
+
+  void clear() { _size = 0; }
+
+  // Return the first unused packet, it becomes part of the batch
+  // once `push` is called.
+  Packet& back_slot() { return _packets[_size]; }
+  void push() { assert(!full()); ++_size; }
+
+  Packet&       operator[](size_t i)       { return _packets[i]; }
+  const Packet& operator[](size_t i) const { return _packets[i]; }
+
+private:
+  friend size_t receive_batch( udp::socket&
+                             , PacketBatch&
+                             , boost::system::error_code&);
+
+  friend size_t send_batch( udp::socket&
+                          , PacketBatch&
+                          , size_t
+                          , const udp::endpoint&
+                          , boost::system::error_code&);
+
+  std::vector<Packet> _packets;
+  size_t              _size = 0;
+
+#if CLUB_HAS_MMSG
+  // Scratch space for the system calls, kept here so that we don't
+  // allocate on each call.
+  std::vector<mmsghdr> _msgs;
+  std::vector<iovec>   _iovs;
+#endif
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline void PacketBatch::reset(size_t capacity, size_t packet_size) {
+  _packets.resize(capacity);
+  for (auto& p : _packets) {
+    p.data.resize(packet_size);
+    p.size = 0;
+  }
+  _size = 0;
+
+#if CLUB_HAS_MMSG
+  _msgs.resize(capacity);
+  _iovs.resize(capacity);
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Receive as many datagrams as are immediately available (but at most
+// batch.capacity()) without blocking. Returns the number of received
+// datagrams, `error` is set to would_block if there were none.
+inline size_t receive_batch( boost::asio::ip::udp::socket& socket
+                           , PacketBatch& batch
+                           , boost::system::error_code& error) {
+  batch.clear();
+
+  if (batch.capacity() == 0) return 0;
+
+#if CLUB_HAS_MMSG
+  const size_t n = batch.capacity();
+
+  auto& msgs = batch._msgs;
+  auto& iovs = batch._iovs;
+
+  for (size_t i = 0; i < n; ++i) {
+    auto& p = batch[i];
+
+    iovs[i].iov_base = p.data.data();
+    iovs[i].iov_len  = p.data.size();
+
+    msgs[i] = mmsghdr{};
+    msgs[i].msg_hdr.msg_name    = p.endpoint.data();
+    msgs[i].msg_hdr.msg_namelen = p.endpoint.capacity();
+    msgs[i].msg_hdr.msg_iov     = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen  = 1;
+  }
+
+  int r = ::recvmmsg( socket.native_handle()
+                    , msgs.data()
+                    , n
+                    , MSG_DONTWAIT
+                    , nullptr);
+
+  if (r < 0) {
+    error = boost::system::error_code( errno
+                                     , boost::asio::error::get_system_category());
+    if (error == boost::asio::error::try_again) {
+      error = boost::asio::error::would_block;
+    }
+    return 0;
+  }
+
+  for (int i = 0; i < r; ++i) {
+    auto& p = batch[i];
+    p.endpoint.resize(msgs[i].msg_hdr.msg_namelen);
+    p.size = msgs[i].msg_len;
+    batch.push();
+  }
+
+  return r;
+#else
+  while (!batch.full()) {
+    if (socket.available(error) == 0 || error) break;
+
+    auto& p = batch.back_slot();
+    p.size = socket.receive_from( boost::asio::buffer(p.data)
+                                , p.endpoint
+                                , 0
+                                , error);
+    if (error) break;
+    batch.push();
+  }
+
+  if (batch.empty() && !error) {
+    error = boost::asio::error::would_block;
+  }
+
+  return batch.size();
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Send packets [first, batch.size()) to `remote` without blocking. Returns
+// the number of packets sent, `error` is set to would_block if the socket's
+// send buffer is full.
+inline size_t send_batch( boost::asio::ip::udp::socket& socket
+                        , PacketBatch& batch
+                        , size_t first
+                        , const boost::asio::ip::udp::endpoint& remote
+                        , boost::system::error_code& error) {
+  if (first >= batch.size()) return 0;
+
+#if CLUB_HAS_MMSG
+  const size_t n = batch.size() - first;
+
+  auto& msgs = batch._msgs;
+  auto& iovs = batch._iovs;
+
+  for (size_t i = 0; i < n; ++i) {
+    auto& p = batch[first + i];
+
+    iovs[i].iov_base = p.data.data();
+    iovs[i].iov_len  = p.size;
+
+    msgs[i] = mmsghdr{};
+    msgs[i].msg_hdr.msg_name    = const_cast<sockaddr*>(remote.data());
+    msgs[i].msg_hdr.msg_namelen = remote.size();
+    msgs[i].msg_hdr.msg_iov     = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen  = 1;
+  }
+
+  int r = ::sendmmsg(socket.native_handle(), msgs.data(), n, MSG_DONTWAIT);
+
+  if (r < 0) {
+    error = boost::system::error_code( errno
+                                     , boost::asio::error::get_system_category());
+    if (error == boost::asio::error::try_again) {
+      error = boost::asio::error::would_block;
+    }
+    return 0;
+  }
+
+  return r;
+#else
+  size_t sent = 0;
+
+  for (size_t i = first; i < batch.size(); ++i) {
+    auto& p = batch[i];
+    socket.send_to(boost::asio::buffer(p.data.data(), p.size), remote, 0, error);
+    if (error) break;
+    ++sent;
+  }
+
+  return sent;
+#endif
+}
+
+//------------------------------------------------------------------------------
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_BATCH_IO_H
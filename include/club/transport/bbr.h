@@ -0,0 +1,188 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_BBR_H
+#define CLUB_TRANSPORT_BBR_H
+
+#include <algorithm>
+#include <array>
+#include <club/transport/congestion_controller.h>
+
+namespace club { namespace transport {
+
+// A simplified model based controller in the spirit of BBR:
+// https://tools.ietf.org/html/draft-cardwell-iccrg-bbr-congestion-control
+//
+// Estimates the bottleneck bandwidth (windowed maximum of the delivery
+// rate) and the propagation delay (windowed minimum of the RTT) and keeps
+// about a gain multiple of their product in flight. Losses are not
+// treated as a congestion signal.
+class Bbr : public CongestionController {
+public:
+  explicit Bbr(size_t mss);
+
+  const char* name() const override { return "bbr"; }
+
+  void on_ack(const AckSample&) override;
+
+  size_t cwnd() const override { return _cwnd; }
+
+  float pacing_rate() const override { return pacing_gain() * _btl_bw; }
+
+  // Bottleneck bandwidth estimate in bytes per second.
+  float bandwidth() const { return _btl_bw; }
+  boost::optional<clock::duration> min_rtt() const { return _min_rtt; }
+
+private:
+  enum class Mode { startup, drain, probe_bw };
+
+  static constexpr float HIGH_GAIN() { return 2.885f; } // 2/ln(2)
+  static constexpr float CWND_GAIN() { return 2.f; }
+
+  static float seconds(clock::duration d) {
+    return std::chrono::duration<float>(d).count();
+  }
+
+  float pacing_gain() const;
+  float bdp() const;
+  void update_bandwidth(const AckSample&);
+  void update_mode(const AckSample&);
+
+private:
+  Mode _mode = Mode::startup;
+  size_t _cwnd;
+
+  uint64_t _delivered = 0;
+
+  // Start of the current round, the delivery rate is sampled once
+  // per round.
+  boost::optional<clock::time_point> _round_start;
+  uint64_t _round_delivered = 0;
+  uint64_t _round_count = 0;
+
+  // Delivery rates of the last few rounds.
+  std::array<float, 10> _bw_samples = {};
+  float _btl_bw = 0;
+
+  // Taken from QualityOfService which keeps the windowed minimum.
+  boost::optional<clock::duration> _min_rtt;
+
+  // Startup ends when the bandwidth stops growing for a few rounds.
+  float _full_bw = 0;
+  unsigned _full_bw_count = 0;
+
+  size_t _cycle_index = 0;
+  clock::time_point _cycle_start;
+};
+
+//--------------------------------------------------------------------
+// Implementation
+//--------------------------------------------------------------------
+inline Bbr::Bbr(size_t mss)
+  : CongestionController(mss)
+  , _cwnd(min_cwnd())
+{}
+
+//--------------------------------------------------------------------
+inline float Bbr::pacing_gain() const {
+  static const float cycle[] = { 1.25f, 0.75f, 1, 1, 1, 1, 1, 1 };
+
+  switch (_mode) {
+    case Mode::startup:  return HIGH_GAIN();
+    case Mode::drain:    return 1 / HIGH_GAIN();
+    case Mode::probe_bw: break;
+  }
+
+  return cycle[_cycle_index];
+}
+
+//--------------------------------------------------------------------
+inline float Bbr::bdp() const {
+  if (!_min_rtt) return 0;
+  return _btl_bw * seconds(*_min_rtt);
+}
+
+//--------------------------------------------------------------------
+inline void Bbr::update_bandwidth(const AckSample& s) {
+  _delivered += s.bytes_newly_acked;
+
+  if (!_round_start) {
+    _round_start = s.now;
+    _round_delivered = _delivered;
+    return;
+  }
+
+  auto round_length = _min_rtt ? *_min_rtt : s.srtt;
+  auto elapsed = s.now - *_round_start;
+
+  if (elapsed < round_length || elapsed <= clock::duration(0)) return;
+
+  float bw = (_delivered - _round_delivered) / seconds(elapsed);
+
+  _bw_samples[_round_count++ % _bw_samples.size()] = bw;
+  _btl_bw = *std::max_element(_bw_samples.begin(), _bw_samples.end());
+
+  _round_start = s.now;
+  _round_delivered = _delivered;
+
+  if (_mode == Mode::startup) {
+    if (_btl_bw >= _full_bw * 1.25f) {
+      _full_bw = _btl_bw;
+      _full_bw_count = 0;
+    }
+    else if (++_full_bw_count >= 3) {
+      _mode = Mode::drain;
+    }
+  }
+}
+
+//--------------------------------------------------------------------
+inline void Bbr::update_mode(const AckSample& s) {
+  if (_mode == Mode::drain && s.flight_size <= bdp()) {
+    _mode = Mode::probe_bw;
+    _cycle_index = 0;
+    _cycle_start = s.now;
+  }
+
+  if (_mode == Mode::probe_bw && _min_rtt
+                              && s.now - _cycle_start > *_min_rtt) {
+    _cycle_index = (_cycle_index + 1) % 8;
+    _cycle_start = s.now;
+  }
+}
+
+//--------------------------------------------------------------------
+inline void Bbr::on_ack(const AckSample& s) {
+  if (s.min_rtt) _min_rtt = s.min_rtt;
+
+  update_bandwidth(s);
+  update_mode(s);
+
+  float target = bdp() * CWND_GAIN() * pacing_gain();
+
+  if (_mode == Mode::startup) {
+    // Grow exponentially until the pipe is estimated to be full.
+    _cwnd += s.bytes_newly_acked;
+    if (target > 0) {
+      _cwnd = std::min<size_t>(_cwnd, std::max<float>(target, min_cwnd()));
+    }
+  }
+  else {
+    _cwnd = std::max<size_t>(target, min_cwnd());
+  }
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_BBR_H
@@ -0,0 +1,96 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_CHANNEL_H
+#define CLUB_TRANSPORT_CHANNEL_H
+
+#include <algorithm>
+#include <cassert>
+#include <array>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/asio/buffer.hpp>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+#include <club/transport/sequence_number.h>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Reliable messages are sent over independent channels, each having its
+// own ordering. A lost message thus only delays messages in its channel.
+// Messages still share the (message) sequence numbers which are used for
+// acking and resending, the channel sequence number below only decides
+// the order of delivery.
+using ChannelId = uint8_t;
+
+static constexpr ChannelId default_channel = 0;
+
+struct ChannelHeader {
+  static constexpr size_t size = sizeof(ChannelId) + sizeof(SequenceNumber);
+
+  ChannelId      channel;
+  SequenceNumber sequence_number;
+};
+
+//------------------------------------------------------------------------------
+// The header is the first thing in the payload of reliable messages.
+// `capacity` may be used to reserve space for what follows it.
+inline std::vector<uint8_t>
+encode_channel_header( ChannelId      channel
+                     , SequenceNumber sequence_number
+                     , size_t         capacity = 0) {
+  std::vector<uint8_t> data(ChannelHeader::size);
+  data.reserve(std::max(capacity, size_t(ChannelHeader::size)));
+
+  binary::encoder e(data);
+  e.put(channel);
+  e.put(sequence_number);
+
+  return data;
+}
+
+//------------------------------------------------------------------------------
+// Same encoding as above in storage that doesn't need the heap.
+using EncodedChannelHeader = std::array<uint8_t, ChannelHeader::size>;
+
+inline EncodedChannelHeader
+encode_channel_header(const ChannelHeader& header) {
+  EncodedChannelHeader data;
+
+  binary::encoder e(data.data(), data.size());
+  e.put(header.channel);
+  e.put(header.sequence_number);
+
+  assert(!e.error());
+  return data;
+}
+
+//------------------------------------------------------------------------------
+inline boost::optional<ChannelHeader>
+decode_channel_header(boost::asio::const_buffer payload) {
+  binary::decoder d( boost::asio::buffer_cast<const uint8_t*>(payload)
+                   , boost::asio::buffer_size(payload));
+
+  ChannelHeader h;
+  h.channel         = d.get<ChannelId>();
+  h.sequence_number = d.get<SequenceNumber>();
+
+  if (d.error()) return boost::none;
+  return h;
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_CHANNEL_H
@@ -0,0 +1,40 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_CONGESTION_CONTROL_H
+#define CLUB_TRANSPORT_CONGESTION_CONTROL_H
+
+#include <memory>
+#include <club/transport/ledbat.h>
+#include <club/transport/cubic.h>
+#include <club/transport/bbr.h>
+
+namespace club { namespace transport {
+
+enum class CongestionControl { ledbat, cubic, bbr };
+
+inline
+std::unique_ptr<CongestionController>
+make_congestion_controller(CongestionControl cc, size_t mss) {
+  switch (cc) {
+    case CongestionControl::ledbat: break;
+    case CongestionControl::cubic:  return std::make_unique<Cubic>(mss);
+    case CongestionControl::bbr:    return std::make_unique<Bbr>(mss);
+  }
+  return std::make_unique<Ledbat>(mss);
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_CONGESTION_CONTROL_H
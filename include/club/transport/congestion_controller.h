@@ -0,0 +1,82 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_CONGESTION_CONTROLLER_H
+#define CLUB_TRANSPORT_CONGESTION_CONTROLLER_H
+
+#include <chrono>
+#include <boost/optional.hpp>
+
+namespace club { namespace transport {
+
+//--------------------------------------------------------------------
+// Decides how many bytes may be in flight at any given time.
+// QualityOfService feeds it one AckSample per received packet header
+// and reads the congestion window back through cwnd().
+class CongestionController {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct AckSample {
+    clock::time_point now;
+    // Amount of data outstanding before this ack was received.
+    size_t flight_size;
+    size_t bytes_newly_acked;
+    // The acks indicate that some packets were lost.
+    bool loss_detected;
+    // Round trip time of the most recently acked packet (if any)
+    // and the smoothed round trip time.
+    boost::optional<clock::duration> rtt;
+    clock::duration srtt;
+    // Windowed minimum of the round trip time, an estimate of the
+    // propagation delay.
+    boost::optional<clock::duration> min_rtt;
+    // One way delay as measured by the peer. It includes the
+    // difference between our clocks so only changes in it are
+    // meaningful.
+    boost::optional<int64_t> delay_mks;
+  };
+
+public:
+  explicit CongestionController(size_t mss) : _mss(mss) {}
+
+  virtual const char* name() const = 0;
+
+  virtual void on_ack(const AckSample&) = 0;
+
+  // Called before on_ack when the sample has loss_detected set.
+  virtual void on_loss(const AckSample&) {}
+
+  virtual size_t cwnd() const = 0;
+
+  // Rate in bytes per second at which packets should be paced. Zero
+  // means the rate is derived from cwnd and the round trip time.
+  virtual float pacing_rate() const { return 0; }
+
+  virtual ~CongestionController() {}
+
+  // Called when the path MTU changes.
+  void set_mss(size_t mss) { _mss = mss; }
+
+protected:
+  size_t mss() const { return _mss; }
+  size_t min_cwnd() const { return 2 * _mss; }
+
+private:
+  size_t _mss;
+};
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_CONGESTION_CONTROLLER_H
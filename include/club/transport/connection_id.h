@@ -0,0 +1,30 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_CONNECTION_ID_H
+#define CLUB_TRANSPORT_CONNECTION_ID_H
+
+namespace club { namespace transport {
+
+// Identifies a connection among those sharing one UDP port (see
+// club::Multiplexer). Every packet starts with the connection id the
+// receiver has chosen for itself. Sockets that own their UDP port use
+// (and expect) the value `no_connection_id`.
+using ConnectionId = uint32_t;
+
+static constexpr ConnectionId no_connection_id = 0;
+
+}} // club::transport namespace
+
+#endif // ifndef CLUB_TRANSPORT_CONNECTION_ID_H
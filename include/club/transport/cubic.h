@@ -0,0 +1,134 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_CUBIC_H
+#define CLUB_TRANSPORT_CUBIC_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <club/transport/congestion_controller.h>
+
+namespace club { namespace transport {
+
+// CUBIC for Fast Long-Distance Networks:
+// https://tools.ietf.org/html/rfc8312
+//
+// Loss based. After a loss the window grows along a cubic curve whose
+// plateau is the window size at which the loss happened.
+class Cubic : public CongestionController {
+public:
+  static constexpr float C()    { return 0.4f; }
+  static constexpr float BETA() { return 0.7f; }
+
+public:
+  explicit Cubic(size_t mss);
+
+  const char* name() const override { return "cubic"; }
+
+  void on_ack(const AckSample&) override;
+  void on_loss(const AckSample&) override;
+
+  size_t cwnd() const override { return _cwnd; }
+
+private:
+  static float seconds(clock::duration d) {
+    return std::chrono::duration<float>(d).count();
+  }
+
+private:
+  float _cwnd;
+  float _ssthresh = std::numeric_limits<float>::max();
+  float _w_max = 0;
+  // Window size estimate of standard TCP, used in the TCP friendly region.
+  float _w_est = 0;
+  float _origin = 0;
+  float _k = 0;
+  boost::optional<clock::time_point> _epoch_start;
+  // Losses detected before this time belong to the same congestion event.
+  boost::optional<clock::time_point> _recovery_end;
+};
+
+//--------------------------------------------------------------------
+// Implementation
+//--------------------------------------------------------------------
+inline Cubic::Cubic(size_t mss)
+  : CongestionController(mss)
+  , _cwnd(min_cwnd())
+{}
+
+//--------------------------------------------------------------------
+inline void Cubic::on_loss(const AckSample& s) {
+  if (_recovery_end && s.now < *_recovery_end) return;
+
+  _recovery_end = s.now + s.srtt;
+  _epoch_start = boost::none;
+
+  // Fast convergence: release bandwidth to new flows sooner.
+  if (_cwnd < _w_max) {
+    _w_max = _cwnd * (1 + BETA()) / 2;
+  }
+  else {
+    _w_max = _cwnd;
+  }
+
+  _cwnd = std::max<float>(_cwnd * BETA(), min_cwnd());
+  _ssthresh = _cwnd;
+}
+
+//--------------------------------------------------------------------
+inline void Cubic::on_ack(const AckSample& s) {
+  if (s.bytes_newly_acked == 0) return;
+
+  // Don't grow the window while the application isn't using it.
+  if (2 * s.flight_size < _cwnd) return;
+
+  if (_cwnd < _ssthresh) {
+    _cwnd += s.bytes_newly_acked;
+    return;
+  }
+
+  float mss = this->mss();
+
+  if (!_epoch_start) {
+    _epoch_start = s.now;
+    _w_est = _cwnd;
+
+    if (_cwnd < _w_max) {
+      _k = std::cbrt((_w_max - _cwnd) / mss / C());
+      _origin = _w_max;
+    }
+    else {
+      _k = 0;
+      _origin = _cwnd;
+    }
+  }
+
+  float t = seconds(s.now - *_epoch_start + s.srtt);
+  float target = _origin + C() * std::pow(t - _k, 3.f) * mss;
+
+  _w_est += 3 * (1 - BETA()) / (1 + BETA())
+          * s.bytes_newly_acked * mss / _cwnd;
+
+  target = std::max(target, _w_est);
+  target = std::min(target, 1.5f * _cwnd);
+
+  if (target > _cwnd) {
+    _cwnd += (target - _cwnd) * s.bytes_newly_acked / _cwnd;
+  }
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_CUBIC_H
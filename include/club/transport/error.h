@@ -22,6 +22,7 @@ namespace club { namespace transport {
 enum class error {
   parse_error = 1,
   timed_out,
+  unsupported_version,
 };
 
 inline std::ostream& operator<<(std::ostream& os, error e) {
@@ -35,6 +36,7 @@ public:
     switch (static_cast<error>(e)) {
       case error::parse_error: return "Parse error";
       case error::timed_out: return "Timed out";
+      case error::unsupported_version: return "Unsupported wire format version";
     }
     return "Unknown error";
   }
@@ -0,0 +1,321 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_FEC_H
+#define CLUB_TRANSPORT_FEC_H
+
+#include <array>
+#include <algorithm>
+#include <boost/optional.hpp>
+#include <boost/asio/buffer.hpp>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+#include <club/transport/out_message.h>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Forward error correction. The sender XORs the payloads of a group of
+// data packets into a parity message that goes out in a packet of its own.
+// A receiver which got all but one packet of the group rebuilds the missing
+// payload from the parity, without waiting for the retransmission (and
+// including unreliable messages which are never retransmitted).
+//
+// A payload is the message count of the packet followed by its encoded
+// messages. It doesn't include the packet's sequence number, so the lost
+// packet is still reported as lost to the congestion controller, but the
+// rebuilt messages are acked and delivered as if they had arrived.
+//
+// Parity message payload:
+//   uint32_t first    Packet sequence number of the first payload.
+//   uint32_t mask     Bit i is set if packet `first + i` is in the group.
+//   uint16_t size     XOR of the payload sizes.
+//   uint8_t[]         XOR of the payloads (zero padded to the longest).
+class FecEncoder {
+public:
+  static constexpr size_t MIN_GROUP_SIZE() { return 4; }
+  static constexpr size_t MAX_GROUP_SIZE() { return 32; }
+
+  static constexpr size_t HEADER_SIZE() { return 4 + 4 + 2; }
+
+  // By how much data packets must be smaller than the MSS so that the
+  // packet with their parity isn't bigger.
+  static constexpr size_t OVERHEAD() {
+    // The packet number of the parity packet may need a longer encoding
+    // than those of the data packets.
+    return OutMessage::max_header_size + HEADER_SIZE() + 4;
+  }
+
+  bool enabled() const { return _enabled; }
+  void enable(bool);
+
+  // Number of data packets per parity packet.
+  size_t group_size() const { return _group_size; }
+
+  // Adjust the group size to the loss rate, the arguments are the total
+  // numbers of acked and lost packets so far.
+  void on_packet_stats(uint64_t acked, uint64_t lost);
+
+  void add( uint32_t       sequence_number
+          , uint16_t       message_count
+          , const uint8_t* messages
+          , size_t         size);
+
+  // Parity of the last complete group, if it hasn't been taken yet.
+  boost::optional<OutMessage> take_parity();
+
+private:
+  void start_group(uint32_t first);
+  void finish_group();
+
+  static void xor_into(std::vector<uint8_t>&, size_t pos, const uint8_t*, size_t);
+
+private:
+  bool   _enabled    = false;
+  size_t _group_size = MAX_GROUP_SIZE();
+
+  float    _loss_rate   = 0;
+  uint64_t _last_acked  = 0;
+  uint64_t _last_lost   = 0;
+
+  size_t               _count = 0;
+  uint32_t             _first = 0;
+  uint32_t             _mask  = 0;
+  uint16_t             _size  = 0;
+  std::vector<uint8_t> _xor;
+
+  boost::optional<OutMessage> _parity;
+};
+
+//------------------------------------------------------------------------------
+class FecDecoder {
+public:
+  // Remember the payload of a received data packet.
+  void on_packet( uint32_t       sequence_number
+                , uint16_t       message_count
+                , const uint8_t* messages
+                , size_t         size);
+
+  // Return the rebuilt payload if exactly one packet of the parity's group
+  // is missing. If that packet arrives later anyway, its messages are
+  // filtered out as duplicates by their sequence numbers.
+  boost::optional<std::vector<uint8_t>> on_parity(boost::asio::const_buffer);
+
+private:
+  // Must be bigger than the group size (plus some reordering).
+  static constexpr size_t WINDOW() { return 64; }
+
+  struct Slot {
+    bool                 is_valid = false;
+    uint32_t             sequence_number;
+    std::vector<uint8_t> payload;
+  };
+
+  const Slot* find(uint32_t sequence_number) const;
+
+private:
+  // Payloads are only kept once we know the peer sends parities.
+  bool _is_active = false;
+
+  // Indexed by sequence_number % WINDOW(), buffers are reused.
+  std::array<Slot, 64> _slots;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline void FecEncoder::enable(bool enable) {
+  _enabled = enable;
+  _count   = 0;
+  _parity  = boost::none;
+}
+
+//------------------------------------------------------------------------------
+inline void FecEncoder::on_packet_stats(uint64_t acked, uint64_t lost) {
+  // Too few samples since the last update.
+  if ((acked - _last_acked) + (lost - _last_lost) < 2*MAX_GROUP_SIZE()) return;
+
+  float sample = float(lost - _last_lost)
+               / float((acked - _last_acked) + (lost - _last_lost));
+
+  _last_acked = acked;
+  _last_lost  = lost;
+
+  _loss_rate = 0.75f * _loss_rate + 0.25f * sample;
+
+  // Aim for about twice as many parities as there are lost packets.
+  size_t size = _loss_rate > 0 ? size_t(1 / (2 * _loss_rate))
+                               : MAX_GROUP_SIZE();
+
+  _group_size = std::min(std::max(size, MIN_GROUP_SIZE()), MAX_GROUP_SIZE());
+}
+
+//------------------------------------------------------------------------------
+inline void FecEncoder::add( uint32_t       sequence_number
+                           , uint16_t       message_count
+                           , const uint8_t* messages
+                           , size_t         size) {
+  if (!_enabled) return;
+
+  if (_count == 0) {
+    start_group(sequence_number);
+  }
+  else if (sequence_number - _first >= 32) {
+    // Too many other (e.g. probe) packets in between for the mask.
+    finish_group();
+    start_group(sequence_number);
+  }
+
+  uint8_t count[sizeof(uint16_t)];
+  binary::encoder(count, sizeof(count)).put(message_count);
+
+  xor_into(_xor, 0, count, sizeof(count));
+  xor_into(_xor, sizeof(count), messages, size);
+
+  _mask |= uint32_t(1) << (sequence_number - _first);
+  _size ^= uint16_t(sizeof(count) + size);
+
+  if (++_count == _group_size) {
+    finish_group();
+  }
+}
+
+//------------------------------------------------------------------------------
+inline boost::optional<OutMessage> FecEncoder::take_parity() {
+  auto ret = std::move(_parity);
+  _parity = boost::none;
+  return ret;
+}
+
+//------------------------------------------------------------------------------
+inline void FecEncoder::start_group(uint32_t first) {
+  _first = first;
+  _mask  = 0;
+  _size  = 0;
+  _xor.clear();
+}
+
+//------------------------------------------------------------------------------
+inline void FecEncoder::finish_group() {
+  std::vector<uint8_t> payload(HEADER_SIZE() + _xor.size());
+
+  binary::encoder e(payload);
+  e.put(_first);
+  e.put(_mask);
+  e.put(_size);
+  e.put_raw(_xor.data(), _xor.size());
+
+  assert(!e.error());
+
+  // A parity which hasn't been sent yet is outdated now.
+  _parity.emplace(false, MessageType::fec, 0, std::move(payload));
+  _count = 0;
+}
+
+//------------------------------------------------------------------------------
+inline void FecEncoder::xor_into( std::vector<uint8_t>& dst
+                                , size_t pos
+                                , const uint8_t* src
+                                , size_t size) {
+  if (dst.size() < pos + size) {
+    dst.resize(pos + size, 0);
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    dst[pos + i] ^= src[i];
+  }
+}
+
+//------------------------------------------------------------------------------
+inline void FecDecoder::on_packet( uint32_t       sequence_number
+                                 , uint16_t       message_count
+                                 , const uint8_t* messages
+                                 , size_t         size) {
+  if (!_is_active) return;
+
+  auto& slot = _slots[sequence_number % WINDOW()];
+
+  slot.is_valid        = true;
+  slot.sequence_number = sequence_number;
+
+  // Keeps the capacity.
+  slot.payload.resize(sizeof(uint16_t) + size);
+  binary::encoder(slot.payload).put(message_count);
+  std::copy_n(messages, size, slot.payload.begin() + sizeof(uint16_t));
+}
+
+//------------------------------------------------------------------------------
+inline
+const FecDecoder::Slot* FecDecoder::find(uint32_t sequence_number) const {
+  auto& slot = _slots[sequence_number % WINDOW()];
+  if (!slot.is_valid || slot.sequence_number != sequence_number) return nullptr;
+  return &slot;
+}
+
+//------------------------------------------------------------------------------
+inline boost::optional<std::vector<uint8_t>>
+FecDecoder::on_parity(boost::asio::const_buffer buffer) {
+  namespace asio = boost::asio;
+
+  _is_active = true;
+
+  binary::decoder d( asio::buffer_cast<const uint8_t*>(buffer)
+                   , asio::buffer_size(buffer));
+
+  auto first = d.get<uint32_t>();
+  auto mask  = d.get<uint32_t>();
+  auto size  = d.get<uint16_t>();
+
+  if (d.error()) return boost::none;
+
+  boost::optional<uint32_t> missing;
+
+  for (uint32_t i = 0; i < 32; ++i) {
+    if (!(mask & (uint32_t(1) << i))) continue;
+    if (find(first + i)) continue;
+    if (missing) return boost::none;
+    missing = first + i;
+  }
+
+  if (!missing) return boost::none;
+
+  std::vector<uint8_t> payload(d.current(), d.current() + d.size());
+
+  for (uint32_t i = 0; i < 32; ++i) {
+    if (!(mask & (uint32_t(1) << i))) continue;
+
+    auto slot = find(first + i);
+    if (!slot) continue;
+
+    auto& p = slot->payload;
+
+    // Malformed or the window wrapped around.
+    if (p.size() > payload.size()) return boost::none;
+
+    for (size_t j = 0; j < p.size(); ++j) {
+      payload[j] ^= p[j];
+    }
+
+    size ^= uint16_t(p.size());
+  }
+
+  if (size < sizeof(uint16_t) || size > payload.size()) return boost::none;
+
+  payload.resize(size);
+  return payload;
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_FEC_H
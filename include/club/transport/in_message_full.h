@@ -15,6 +15,8 @@
 #ifndef CLUB_TRANSPORT_IN_MESSAGE_FULL_H
 #define CLUB_TRANSPORT_IN_MESSAGE_FULL_H
 
+#include <boost/asio/buffer.hpp>
+
 namespace club { namespace transport {
 
 struct InMessageFull {
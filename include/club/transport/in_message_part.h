@@ -20,6 +20,7 @@
 #include <club/transport/sequence_number.h>
 #include <club/transport/message_type.h>
 #include <club/transport/in_message_full.h>
+#include <binary/varint.h>
 
 #include <club/debug/ostream_uuid.h>
 #include <club/debug/string_tools.h>
@@ -75,17 +76,36 @@ boost::optional<InMessageFull> InMessagePart::get_complete_message() const {
 inline void decode(binary::decoder& d, InMessagePart& m) {
   if (d.error()) return;
 
+  using binary::varint;
+
+  // See OutMessage::Header for the format.
   auto type_start = d.current();
+  auto type_byte  = d.get<uint8_t>();
+  auto type       = type_byte & ~message_fragment_flag;
+
+  if (d.error()) return;
 
-  m.type            = d.get<MessageType>();
-  m.sequence_number = d.get<SequenceNumber>();
-  m.original_size   = d.get<uint16_t>();
-  m.chunk_start     = d.get<uint16_t>();
-  m.chunk_size      = d.get<uint16_t>();
+  if (type > uint8_t(MessageType::fec)) {
+    return d.set_error();
+  }
+
+  m.type            = MessageType(type);
+  m.sequence_number = d.get<varint<SequenceNumber>>().value;
+  m.chunk_size      = d.get<varint<uint16_t>>().value;
+
+  if (type_byte & message_fragment_flag) {
+    m.original_size = d.get<varint<uint16_t>>().value;
+    m.chunk_start   = d.get<varint<uint16_t>>().value;
+  }
+  else {
+    m.original_size = m.chunk_size;
+    m.chunk_start   = 0;
+  }
 
   if (d.error()) return;
 
-  if (m.chunk_size > d.size()) {
+  if (m.chunk_size > d.size()
+      || m.chunk_start + m.chunk_size > m.original_size) {
     return d.set_error();
   }
 
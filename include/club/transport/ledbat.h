@@ -0,0 +1,100 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_LEDBAT_H
+#define CLUB_TRANSPORT_LEDBAT_H
+
+#include <algorithm>
+#include <club/transport/congestion_controller.h>
+#include <club/transport/windowed_min.h>
+
+namespace club { namespace transport {
+
+// Low Extra Delay Background Transport:
+// https://tools.ietf.org/html/rfc6817
+//
+// Grows the window as long as the queuing delay stays below TARGET and
+// backs off once it exceeds it, yielding to other traffic.
+class Ledbat : public CongestionController {
+public:
+  explicit Ledbat( size_t mss
+                 , float target = 0.01 // 10ms
+                 , float gain = 1
+                 , float allowed_increase = 1);
+
+  const char* name() const override { return "ledbat"; }
+
+  void on_ack(const AckSample&) override;
+  void on_loss(const AckSample&) override;
+
+  size_t cwnd() const override { return _cwnd; }
+
+private:
+  const float _target;
+  const float _gain;
+  const float _allowed_increase;
+
+  int32_t _cwnd;
+
+  // Minimum one way delay per minute over the last ten minutes, so that
+  // the base delay follows route changes and clock drift (RFC 6817,
+  // section 2.4.2).
+  WindowedMin<int64_t, 10> _base_delays{std::chrono::minutes(1)};
+};
+
+//--------------------------------------------------------------------
+// Implementation
+//--------------------------------------------------------------------
+inline Ledbat::Ledbat( size_t mss
+                     , float target
+                     , float gain
+                     , float allowed_increase)
+  : CongestionController(mss)
+  , _target(target)
+  , _gain(gain)
+  , _allowed_increase(allowed_increase)
+  , _cwnd(min_cwnd())
+{}
+
+//--------------------------------------------------------------------
+inline void Ledbat::on_loss(const AckSample&) {
+  int32_t min = min_cwnd();
+  _cwnd = std::min(_cwnd, std::max(_cwnd/2, min));
+}
+
+//--------------------------------------------------------------------
+inline void Ledbat::on_ack(const AckSample& s) {
+  using namespace std::chrono;
+
+  if (!s.delay_mks) return;
+
+  _base_delays.update(*s.delay_mks, s.now);
+  auto base_delay = *_base_delays.get();
+
+  float our_delay = microseconds(*s.delay_mks - base_delay).count()
+                  / 1'000'000.f;
+
+  float off_target = (_target - our_delay) / _target;
+  float window_factor = float(s.bytes_newly_acked) * mss() / _cwnd;
+
+  auto scaled_gain = _gain * off_target * window_factor;
+  auto max_allowed_cwnd = s.flight_size + _allowed_increase * mss();
+
+  _cwnd = std::min(_cwnd + scaled_gain, max_allowed_cwnd);
+  _cwnd = std::max<int32_t>(_cwnd, min_cwnd());
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_LEDBAT_H
@@ -25,8 +25,15 @@ enum class MessageType { sync       = 0
                        , unreliable = 2
                        , reliable   = 3
                        , close      = 4
+                       , mtu_probe  = 5
+                       , stream     = 6
+                       , fec        = 7
                        };
 
+// Set in the encoded type byte of message chunks which aren't the whole
+// message (see OutMessage::Header).
+static constexpr uint8_t message_fragment_flag = 0x80;
+
 //------------------------------------------------------------------------------
 template<typename Encoder>
 inline void encode(Encoder& e, const MessageType& t) {
@@ -37,7 +44,7 @@ inline void encode(Encoder& e, const MessageType& t) {
 inline void decode(binary::decoder& d, MessageType& t) {
   t = static_cast<MessageType>(d.get<uint8_t>());
 
-  if (t < MessageType::sync || t > MessageType::close) {
+  if (t < MessageType::sync || t > MessageType::fec) {
     assert(0);
     d.set_error();
   }
@@ -51,6 +58,9 @@ inline std::ostream& operator<<(std::ostream& os, MessageType t) {
     case MessageType::unreliable: return os << "unreliable";
     case MessageType::reliable: return os << "reliable";
     case MessageType::close: return os << "close";
+    case MessageType::mtu_probe: return os << "mtu_probe";
+    case MessageType::stream: return os << "stream";
+    case MessageType::fec: return os << "fec";
   }
   return os << "unknown";
 }
@@ -15,15 +15,19 @@
 #ifndef CLUB_TRANSPORT_OUT_MESSAGE_H
 #define CLUB_TRANSPORT_OUT_MESSAGE_H
 
+#include <limits>
 #include <set>
 #include <club/uuid.h>
 #include <binary/encoder.h>
+#include <binary/varint.h>
 #include <club/generic/variant_tools.h>
 #include <club/transport/sequence_number.h>
 #include <club/transport/message_type.h>
 #include <club/transport/ack_set.h>
+#include <club/transport/channel.h>
 #include <club/transport/in_message_part.h>
 #include <club/transport/pending_message.h>
+#include <club/transport/shared_buffer.h>
 
 #include <club/debug/ostream_uuid.h>
 #include <club/debug/string_tools.h>
@@ -37,6 +41,15 @@ private:
    * This message may contain only a fraction of what the original poster
    * of the message sent. It is due to the message trying to fit into
    * a buffer of size min(MTU size, receiving buffer size).
+   *
+   * Encoded as:
+   *   uint8_t  type | is_fragment
+   *   varint   sequence_number
+   *   varint   chunk_size
+   *   varint   original_size    Only if is_fragment.
+   *   varint   start_position   Only if is_fragment.
+   *
+   * A fragment is a chunk which isn't the whole message.
    */
   struct Header {
     MessageType type;
@@ -45,17 +58,50 @@ private:
     uint16_t start_position;
     uint16_t chunk_size;
 
+    bool is_fragment() const {
+      return start_position != 0 || chunk_size != original_size;
+    }
+
+    size_t encoded_size() const {
+      using binary::varint_size;
+
+      size_t size = 1 + varint_size(sequence_number) + varint_size(chunk_size);
+
+      if (is_fragment()) {
+        size += varint_size(original_size) + varint_size(start_position);
+      }
+
+      return size;
+    }
+
     void encode(binary::encoder& e) const {
-      e.put(uint8_t(type));
-      e.put(sequence_number);
-      e.put(original_size);
-      e.put(start_position);
-      e.put(chunk_size);
+      using binary::varint;
+
+      e.put(uint8_t(uint8_t(type) | (is_fragment() ? message_fragment_flag : 0)));
+      e.put(varint<SequenceNumber>(sequence_number));
+      e.put(varint<uint16_t>(chunk_size));
+
+      if (is_fragment()) {
+        e.put(varint<uint16_t>(original_size));
+        e.put(varint<uint16_t>(start_position));
+      }
     }
   };
 
 public:
-  static constexpr size_t header_size = 11;
+  // Longest possible encoding of the header.
+  static constexpr size_t max_header_size
+    = 1 + binary::varint<SequenceNumber>::max_size
+        + 3 * binary::varint<uint16_t>::max_size;
+
+  // Header::original_size limits the payload (which includes the channel
+  // header of reliable messages) to this many bytes.
+  static constexpr size_t max_payload_size
+    = std::numeric_limits<uint16_t>::max();
+
+  // Immutable payload which may be shared with other messages (e.g. the same
+  // data being sent to many peers).
+  using SharedPayload = SharedBuffer;
 
   OutMessage( bool                   resend_until_acked
             , MessageType            type
@@ -66,8 +112,60 @@ public:
     , _data(std::move(payload))
     , _is_dirty(false)
   {
-    // Currently limited to size 65535 because of Header::original_size
-    assert(_data.size() <= std::numeric_limits<uint16_t>::max());
+    assert(_data.size() <= max_payload_size);
+  }
+
+  OutMessage( bool           resend_until_acked
+            , MessageType    type
+            , SequenceNumber sequence_number
+            , SharedPayload  payload)
+    : OutMessage( resend_until_acked
+                , type
+                , sequence_number
+                , std::vector<uint8_t>()
+                , std::move(payload))
+  {}
+
+  // The payload is `head` followed by `tail`, the two are gathered
+  // directly into the packet when encoding. This way a small header can
+  // be prepended to a (possibly shared) payload without copying it.
+  OutMessage( bool                   resend_until_acked
+            , MessageType            type
+            , SequenceNumber         sequence_number
+            , std::vector<uint8_t>&& head
+            , SharedPayload          tail)
+    : resend_until_acked(resend_until_acked)
+    , _header{ type
+             , sequence_number
+             , uint16_t(head.size() + tail.size())
+             , 0
+             , uint16_t(head.size() + tail.size())}
+    , _data(std::move(head))
+    , _shared_data(std::move(tail))
+    , _is_dirty(false)
+  {
+    assert(payload_size() <= max_payload_size);
+  }
+
+  // Reliable messages start with a channel header, it is kept inline in
+  // front of the payload so that sending one doesn't allocate.
+  OutMessage( bool                 resend_until_acked
+            , MessageType          type
+            , SequenceNumber       sequence_number
+            , const ChannelHeader& channel_header
+            , SharedPayload        tail)
+    : OutMessage( resend_until_acked
+                , type
+                , sequence_number
+                , std::vector<uint8_t>()
+                , std::move(tail))
+  {
+    _channel_header      = encode_channel_header(channel_header);
+    _channel_header_size = ChannelHeader::size;
+
+    assert(payload_size() <= max_payload_size);
+    _header.original_size = payload_size();
+    _header.chunk_size    = payload_size();
   }
 
   OutMessage(OutMessage&&) = default;
@@ -76,43 +174,133 @@ public:
 
   SequenceNumber sequence_number() const { return _header.sequence_number; }
 
-  void reset_payload(std::vector<uint8_t>&& new_payload) {
+  // Return false if a part of the message has already been sent, the
+  // arguments are left untouched in that case. The channel header (if
+  // any) is kept.
+  bool reset_payload(std::vector<uint8_t>&& new_payload) {
+    return reset_payload(std::move(new_payload), SharedPayload());
+  }
+
+  bool reset_payload(std::vector<uint8_t>&& head, SharedPayload&& tail) {
     // Only reset the _data if no part of the message has already been sent.
-    if (_is_dirty) return;
+    if (_is_dirty) return false;
+
+    _data = std::move(head);
+    _shared_data = std::move(tail);
+
+    assert(payload_size() <= max_payload_size);
+    _header.original_size = payload_size();
+    _header.chunk_size    = payload_size();
 
-    _data = std::move(new_payload);
+    return true;
   }
 
-  size_t payload_size() const { return _data.size(); }
+  size_t payload_size() const {
+    return _channel_header_size + _data.size() + _shared_data.size();
+  }
+
+  // Size of the whole message encoded in one chunk.
+  size_t encoded_size() const {
+    return _header.encoded_size() + payload_size();
+  }
+
+  // The smallest buffer into which encode() puts the next chunk (and at
+  // least one byte of its payload, unless the payload is empty).
+  size_t min_encoded_size() const {
+    auto start = fully_sent() ? 0 : bytes_already_sent;
+    auto rest  = payload_size() - start;
+
+    auto h = chunk_header(start, rest);
+    if (rest <= 1) return h.encoded_size() + rest;
+
+    return std::min( h.encoded_size() + rest
+                   , chunk_header(start, 1).encoded_size() + 1);
+  }
 
   // Return the size of the encoded payload.
   uint16_t encode_header_and_payload( binary::encoder& encoder
                                     , uint16_t start) const {
     _is_dirty = true;
 
-    if (encoder.remaining_size() < header_size) {
-      encoder.set_error();
-      return 0;
-    }
+    const size_t remaining = encoder.remaining_size();
 
-    const auto payload_size_ = std::min( _data.size() - start
-                                       , encoder.remaining_size() - header_size);
+    size_t payload_size_ = payload_size() - start;
+    Header h = chunk_header(start, payload_size_);
 
-    Header h = _header;
-    h.start_position += start;
-    h.chunk_size = payload_size_;
+    if (h.encoded_size() + payload_size_ > remaining) {
+      if (payload_size_ == 0) {
+        encoder.set_error();
+        return 0;
+      }
+
+      // Only a fragment fits. Shrinking the chunk by how much it doesn't
+      // fit makes it fit (its header can only get shorter), then we take
+      // back the bytes the shorter header may have saved.
+      auto size_with_header = [&](size_t chunk) {
+        return chunk_header(start, chunk).encoded_size() + chunk;
+      };
+
+      size_t chunk = std::min(payload_size_ - 1, remaining);
+
+      if (size_with_header(chunk) > remaining) {
+        chunk -= std::min(chunk, size_with_header(chunk) - remaining);
+      }
+
+      while (chunk + 1 < payload_size_ && size_with_header(chunk + 1) <= remaining) {
+        ++chunk;
+      }
+
+      if (chunk == 0 || size_with_header(chunk) > remaining) {
+        encoder.set_error();
+        return 0;
+      }
+
+      payload_size_ = chunk;
+      h = chunk_header(start, payload_size_);
+    }
 
     h.encode(encoder);
 
-    encoder.put_raw(_data.data() + start, payload_size_);
+    struct Segment { const uint8_t* data; size_t size; };
+
+    const Segment segments[] = { { _channel_header.data(), _channel_header_size }
+                               , { _data.data(),           _data.size() }
+                               , { _shared_data.data(),    _shared_data.size() } };
+
+    size_t skip = start;
+    size_t rest = payload_size_;
+
+    for (const auto& segment : segments) {
+      if (rest == 0) break;
+
+      if (skip >= segment.size) {
+        skip -= segment.size;
+        continue;
+      }
+
+      auto n = std::min(rest, segment.size - skip);
+      encoder.put_raw(segment.data + skip, n);
+      skip  = 0;
+      rest -= n;
+    }
 
     return payload_size_;
   }
 
   const Header& header() const { return _header; }
 
+private:
+  // Header of the chunk [start, start + chunk_size) of the payload.
+  Header chunk_header(size_t start, size_t chunk_size) const {
+    Header h = _header;
+    h.start_position = start;
+    h.chunk_size     = chunk_size;
+    return h;
+  }
+
+public:
   bool fully_sent() const {
-    return bytes_already_sent == _data.size();
+    return bytes_already_sent == payload_size();
   }
 
 public:
@@ -121,7 +309,12 @@ public:
 
 private:
   Header _header;
+  // The payload is the channel header (if _channel_header_size isn't zero)
+  // followed by _data and _shared_data.
+  EncodedChannelHeader _channel_header{};
+  uint8_t              _channel_header_size = 0;
   std::vector<uint8_t> _data;
+  SharedPayload        _shared_data;
   // Once this message or a part of it has been sent, we must not change its
   // content (using the `reset_payload` function above). We use this flag
   // for that.
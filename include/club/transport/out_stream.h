@@ -0,0 +1,104 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_OUT_STREAM_H
+#define CLUB_TRANSPORT_OUT_STREAM_H
+
+#include <functional>
+#include <club/transport/out_message.h>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Fills `buffer` with at most `max_size` bytes of the stream and returns
+// how many were written. Zero marks the end of the stream.
+using StreamSource = std::function<size_t(uint8_t* buffer, size_t max_size)>;
+
+//------------------------------------------------------------------------------
+// A reliable message of arbitrary size. Instead of a single OutMessage
+// (whose size is limited by its uint16_t header fields) it is cut into
+// frames which are sent as consecutive reliable messages of type `stream`.
+// Frames are produced lazily, so only those that fit into the congestion
+// window are ever held in memory.
+//
+// Frame payload: the channel header, uint8_t flags and then the data.
+class OutStream {
+public:
+  static constexpr size_t frame_size = 16384;
+
+  enum Flags : uint8_t { last = 1 };
+
+public:
+  OutStream(StreamSource);
+  OutStream(SharedBuffer);
+
+  bool finished() const { return _finished; }
+
+  // `head` goes in front of the flags.
+  OutMessage next_frame(SequenceNumber, std::vector<uint8_t> head);
+
+private:
+  StreamSource _source;
+  SharedBuffer _buffer;
+  size_t       _offset = 0;
+  bool         _finished = false;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline OutStream::OutStream(StreamSource source)
+  : _source(std::move(source))
+{}
+
+inline OutStream::OutStream(SharedBuffer buffer)
+  : _buffer(std::move(buffer))
+{}
+
+//------------------------------------------------------------------------------
+inline
+OutMessage OutStream::next_frame(SequenceNumber sn, std::vector<uint8_t> head) {
+  assert(!_finished);
+
+  if (!_source) {
+    // The data is already in memory so frames point into it.
+    auto size = std::min<size_t>(size_t(frame_size), _buffer.size() - _offset);
+    auto data = _buffer.slice(_offset, size);
+
+    _offset += size;
+    _finished = _offset == _buffer.size();
+
+    head.push_back(_finished ? last : 0);
+
+    return OutMessage(true, MessageType::stream, sn, std::move(head), data);
+  }
+
+  auto flags_pos = head.size();
+  head.resize(flags_pos + 1 + frame_size);
+
+  auto size = _source(head.data() + flags_pos + 1, frame_size);
+  assert(size <= frame_size);
+
+  // We only learn about the end once the source runs dry.
+  _finished = size == 0;
+
+  head[flags_pos] = _finished ? last : 0;
+  head.resize(flags_pos + 1 + size);
+
+  return OutMessage(true, MessageType::stream, sn, std::move(head));
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_OUT_STREAM_H
@@ -0,0 +1,71 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_PACER_H
+#define CLUB_TRANSPORT_PACER_H
+
+#include <algorithm>
+#include <chrono>
+
+namespace club { namespace transport {
+
+//--------------------------------------------------------------------
+// Spreads packets in time so that they leave at a given rate instead
+// of in line-rate bursts. To keep the number of timer wake-ups low,
+// packets whose send time falls within QUANTUM from now are sent
+// right away, so bursts are at most QUANTUM worth of data.
+class Pacer {
+  using clock = std::chrono::steady_clock;
+
+public:
+  static clock::duration QUANTUM() { return std::chrono::microseconds(500); }
+
+public:
+  // Return how long to wait before the next packet may be sent,
+  // zero if it may be sent now.
+  clock::duration delay(clock::time_point now) const;
+
+  // Record that `bytes` were sent at `now` and schedule the next packet
+  // according to `rate` (in bytes per second).
+  void on_sent(size_t bytes, float rate, clock::time_point now);
+
+  void reset() { _next_send_time = clock::time_point(); }
+
+private:
+  clock::time_point _next_send_time;
+};
+
+//--------------------------------------------------------------------
+// Implementation
+//--------------------------------------------------------------------
+inline Pacer::clock::duration Pacer::delay(clock::time_point now) const {
+  if (_next_send_time <= now + QUANTUM()) return clock::duration(0);
+  return _next_send_time - now;
+}
+
+//--------------------------------------------------------------------
+inline void Pacer::on_sent(size_t bytes, float rate, clock::time_point now) {
+  using namespace std::chrono;
+
+  if (rate <= 0) return;
+
+  // Don't let an idle period accumulate credit for a large burst.
+  _next_send_time = std::max(_next_send_time, now - QUANTUM());
+  _next_send_time += duration_cast<clock::duration>(
+      duration<float>(bytes / rate));
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_PACER_H
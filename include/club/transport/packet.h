@@ -15,6 +15,11 @@
 #ifndef CLUB_TRANSPORT_PACKET_H
 #define CLUB_TRANSPORT_PACKET_H
 
+#include <cstring>
+#include <club/transport/connection_id.h>
+#include <club/transport/fec.h>
+#include <club/transport/wire_format.h>
+
 namespace club { namespace transport {
 
 //------------------------------------------------------------------------------
@@ -24,18 +29,55 @@ private:
   binary::decoder _decoder;
   uint16_t _next_message_i = 0;
   boost::optional<uint16_t> _message_count;
+  boost::optional<uint32_t> _sequence_number;
+  const uint8_t* _messages = nullptr;
+  bool _unsupported_version = false;
 
 public:
   bool error() const { return _decoder.error(); }
 
+  // The packet is of a wire format version we don't understand (error()
+  // is set as well).
+  bool unsupported_version() const { return _unsupported_version; }
+
+  // Only packets carrying messages have a sequence number.
+  boost::optional<uint32_t> sequence_number() const { return _sequence_number; }
+
+  uint16_t message_count() const { return _message_count.value_or(0); }
+
+  // The encoded messages, complete once all of them have been decoded.
+  boost::asio::const_buffer messages() const {
+    return boost::asio::const_buffer( _messages
+                                    , _decoder.current() - _messages);
+  }
+
   void decode_header() {
-    _qos.decode_header(_decoder);
+    // The connection id is only used by club::Multiplexer to find the
+    // receiving connection.
+    _decoder.get<ConnectionId>();
 
-    _message_count = _decoder.get<uint16_t>();
+    auto version_and_flags = _decoder.get<uint8_t>();
 
-    if (*_message_count) {
-      _qos.decode_payload_header(_decoder);
+    if (_decoder.error()) return;
+
+    if ((version_and_flags >> 4) != wire::version) {
+      _unsupported_version = true;
+      return _decoder.set_error();
+    }
+
+    auto flags = version_and_flags & 0x0f;
+
+    _qos.decode_header(_decoder, flags);
+
+    if (flags & wire::has_payload) {
+      _sequence_number = _qos.decode_payload_header(_decoder);
+      _message_count = _decoder.get<binary::varint<uint16_t>>().value;
+    }
+    else {
+      _message_count = 0;
     }
+
+    _messages = _decoder.current();
   }
 
   boost::optional<InMessagePart> decode_message() {
@@ -55,50 +97,100 @@ public:
 inline
 boost::optional<size_t> encode_packet( QualityOfService& qos
                                      , TransmitQueue& transmit_queue
-                                     , AckSet received_message_ids
+                                     , FecEncoder& fec
+                                     , const AckSet& received_message_ids
+                                     , ConnectionId connection_id
                                      , std::vector<uint8_t>& out_packet) {
-  // TODO: Remove the magic constants.
-  size_t minimum_size = qos.encoded_acks_size()
-                      + 2*8 /* qos.encode_header */
-                      // Additional bytes added by encode_acks()
-                      + 3 + binary::encoded<AckSet>::size();
+  using binary::varint;
+
+  size_t minimum_size = sizeof(ConnectionId)
+                      + 1 /* version and flags */
+                      + qos.max_header_size(received_message_ids);
+
+  size_t max_size = qos.next_packet_max_size();
 
-  size_t next_packet_size = std::max( minimum_size
-                                    , qos.next_packet_max_size());
+  if (fec.enabled()) {
+    // Leave room for the parity so that it fits into a packet of the
+    // same size.
+    max_size -= std::min(max_size, FecEncoder::OVERHEAD());
+    fec.on_packet_stats(qos.packets_acked(), qos.packets_lost());
+  }
+
+  size_t next_packet_size = std::max(minimum_size, max_size);
 
   out_packet.resize(next_packet_size);
   binary::encoder encoder(out_packet);
 
-  bool has_acks = qos.encode_header(encoder, received_message_ids);
+  encoder.put(connection_id);
+
+  auto flags_encoder = encoder;
+  encoder.skip(1);
 
-  auto count_encoder = encoder;
-  encoder.skip(sizeof(uint16_t));
+  uint8_t flags = qos.encode_header(encoder, received_message_ids);
 
   if (encoder.error()) {
     assert(0);
     return boost::none;
   }
 
-  // We can only encode qos header after we've known the
-  // total size of this packet, so we do it below.
-  binary::encoder qos_encoder = encoder;
-  encoder.skip(qos.payload_header_size());
+  // The sequence number and the message count are only known once the
+  // messages are encoded, so we leave room for the longest encoding of
+  // the two and move the messages right behind them afterwards.
+  auto payload_header_start = encoder.written();
+  auto max_payload_header_size = qos.payload_header_size()
+                               + varint<uint16_t>::max_size;
+
+  encoder.skip(max_payload_header_size);
+
+  auto messages_start = encoder.written();
+
+  auto timeouts = transmit_queue.retransmit_timeouts();
 
   auto count = transmit_queue.encode_payload( encoder
                                             , qos._received_message_ids_by_peer
-                                            , qos.rtt() * 2);
+                                            , qos.rto()
+                                            , qos.lost_before());
+
+  if (transmit_queue.retransmit_timeouts() != timeouts) {
+    qos.on_retransmit_timeout();
+  }
 
-  count_encoder.put<uint16_t>(count);
+  if (count == 0) {
+    if (!(flags & wire::has_acks)) {
+      return boost::none;
+    }
 
-  if (count) {
-    qos.encode_payload_header(qos_encoder, encoder.written());
+    flags_encoder.put(wire::version_and_flags(flags));
+    return payload_header_start;
   }
 
-  if (count == 0 && !has_acks) {
-    return boost::none;
+  flags_encoder.put(wire::version_and_flags(flags | wire::has_payload));
+
+  auto messages_size = encoder.written() - messages_start;
+  auto payload_header_size = qos.payload_header_size()
+                           + binary::varint_size(count);
+
+  auto unused = max_payload_header_size - payload_header_size;
+  auto packet_size = encoder.written() - unused;
+
+  binary::encoder payload_header_encoder( out_packet.data() + payload_header_start
+                                        , payload_header_size);
+
+  auto sn = qos.encode_payload_header(payload_header_encoder, packet_size);
+  payload_header_encoder.put(varint<uint16_t>(count));
+
+  assert(!payload_header_encoder.error());
+
+  uint8_t* messages = out_packet.data() + payload_header_start
+                    + payload_header_size;
+
+  if (unused) {
+    std::memmove(messages, messages + unused, messages_size);
   }
 
-  return encoder.written();
+  fec.add(sn, count, messages, messages_size);
+
+  return packet_size;
 }
 
 //------------------------------------------------------------------------------
@@ -106,22 +198,134 @@ inline
 boost::optional<size_t> encode_packet_with_one_message
     ( QualityOfService& qos
     , OutMessage& m
-    , AckSet received_message_ids
+    , const AckSet& received_message_ids
+    , ConnectionId connection_id
     , std::vector<uint8_t>& out_packet) {
   binary::encoder encoder(out_packet);
 
-  qos.encode_header(encoder, received_message_ids);
+  encoder.put(connection_id);
+
+  auto flags_encoder = encoder;
+  encoder.skip(1);
+
+  auto flags = qos.encode_header(encoder, received_message_ids);
 
   assert(!encoder.error());
-  encoder.put<uint16_t>(1); // We're sending just one message.
+  flags_encoder.put(wire::version_and_flags(flags | wire::has_payload));
 
   // We can only encode qos header after we've known the
   // total size of this packet, so we do it below.
   binary::encoder qos_encoder = encoder;
   encoder.skip(qos.payload_header_size());
 
+  encoder.put(binary::varint<uint16_t>(1)); // We're sending just one message.
+  encoder.put(m);
+
+  if (encoder.error()) {
+    assert(0 && "Shouldn't happen");
+    return boost::none;
+  }
+
+  qos.encode_payload_header(qos_encoder, encoder.written());
+  out_packet.resize(encoder.written());
+
+  return encoder.written();
+}
+
+//------------------------------------------------------------------------------
+// Encode a packet of exactly `size` bytes carrying a single padding
+// message. It is acked like any other packet, which confirms that
+// packets of this size get through.
+inline
+boost::optional<size_t> encode_probe_packet
+    ( QualityOfService& qos
+    , const AckSet& received_message_ids
+    , ConnectionId connection_id
+    , size_t size
+    , std::vector<uint8_t>& out_packet) {
+  out_packet.resize(size);
+  binary::encoder encoder(out_packet);
+
+  encoder.put(connection_id);
+
+  auto flags_encoder = encoder;
+  encoder.skip(1);
+
+  auto flags = qos.encode_header(encoder, received_message_ids, false);
+  flags_encoder.put(wire::version_and_flags(flags | wire::has_payload));
+
+  binary::encoder qos_encoder = encoder;
+  encoder.skip(qos.payload_header_size());
+
+  encoder.put(binary::varint<uint16_t>(1));
+
+  if (encoder.error() || encoder.written() + OutMessage::max_header_size > size) {
+    assert(0);
+    return boost::none;
+  }
+
+  // The padding message must fill the rest exactly, but the size of its
+  // header depends on the size of the padding.
+  auto rest = size - encoder.written();
+  auto padding_size = rest - OutMessage::max_header_size;
+
+  auto padding_message = [](size_t padding_size) {
+    return OutMessage( false
+                     , MessageType::mtu_probe
+                     , 0
+                     , std::vector<uint8_t>(padding_size));
+  };
+
+  while (padding_message(padding_size + 1).encoded_size() <= rest) {
+    ++padding_size;
+  }
+
+  OutMessage m = padding_message(padding_size);
   encoder.put(m);
 
+  // Some sizes can't be hit exactly (when the header grows by a byte just
+  // as the padding does), the packet is a byte smaller then.
+  out_packet.resize(encoder.written());
+
+  assert(!encoder.error());
+
+  qos.encode_payload_header(qos_encoder, encoder.written(), true);
+
+  return encoder.written();
+}
+
+//------------------------------------------------------------------------------
+// Encode a packet carrying just the parity message (see FecEncoder). Like
+// probes, it doesn't carry acks so that its size is known in advance.
+inline
+boost::optional<size_t> encode_parity_packet
+    ( QualityOfService& qos
+    , OutMessage& parity
+    , ConnectionId connection_id
+    , std::vector<uint8_t>& out_packet) {
+  out_packet.resize( sizeof(ConnectionId)
+                   + 1 /* version and flags */
+                   + qos.max_header_size(AckSet())
+                   + qos.payload_header_size()
+                   + 1 /* message count */
+                   + parity.encoded_size());
+
+  binary::encoder encoder(out_packet);
+
+  encoder.put(connection_id);
+
+  auto flags_encoder = encoder;
+  encoder.skip(1);
+
+  auto flags = qos.encode_header(encoder, AckSet(), false);
+  flags_encoder.put(wire::version_and_flags(flags | wire::has_payload));
+
+  binary::encoder qos_encoder = encoder;
+  encoder.skip(qos.payload_header_size());
+
+  encoder.put(binary::varint<uint16_t>(1));
+  encoder.put(parity);
+
   if (encoder.error()) {
     assert(0 && "Shouldn't happen");
     return boost::none;
@@ -30,6 +30,9 @@ public:
 
   void add_part(size_t start, size_t size);
 
+  // True if [start, end) has been added already.
+  bool contains(size_t start, size_t end) const;
+
   const_iterator begin() const { return _info.begin(); }
   const_iterator end()   const { return _info.end(); }
 
@@ -44,6 +47,16 @@ private:
 
 //------------------------------------------------------------------------------
 // Implementation
+//------------------------------------------------------------------------------
+inline bool PartInfo::contains(size_t start, size_t end) const {
+  // Intervals are kept disjoint, so only the last one starting no later
+  // than `start` may contain it.
+  auto i = _info.upper_bound(start);
+  if (i == _info.begin()) return false;
+  --i;
+  return end <= i->second;
+}
+
 //------------------------------------------------------------------------------
 inline void PartInfo::add_part(size_t start, size_t end) {
   if (end <= start) return;
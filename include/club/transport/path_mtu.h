@@ -0,0 +1,256 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_PATH_MTU_H
+#define CLUB_TRANSPORT_PATH_MTU_H
+
+#include <chrono>
+#include <boost/optional.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#if defined(__linux__)
+#  include <netinet/in.h>
+#  define CLUB_HAS_PMTUDISC_PROBE 1
+#else
+#  define CLUB_HAS_PMTUDISC_PROBE 0
+#endif
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Packetization layer path MTU discovery in the spirit of DPLPMTUD:
+// https://tools.ietf.org/html/rfc8899
+//
+// Sizes here are sizes of UDP payloads. We start from DEFAULT() and
+// binary search towards MAX() by sending padded probe packets, a size is
+// confirmed once a probe of that size is acked. If packets of the
+// confirmed size start disappearing while none of them gets through
+// (a black hole, e.g. after a route change onto a tunnel), we fall back
+// to MIN() and search again from there.
+class PathMtu {
+  using clock = std::chrono::steady_clock;
+
+public:
+  // Fits into IPv6 minimum MTU (1280) with IPv6 and UDP headers.
+  static constexpr size_t MIN()     { return 1232; }
+  // Ethernet MTU minus IPv4 and UDP headers (with some slack).
+  static constexpr size_t DEFAULT() { return 1452; }
+  // Jumbo frame minus IPv6 and UDP headers.
+  static constexpr size_t MAX()     { return 8952; }
+
+  static constexpr unsigned MAX_PROBES() { return 3; }
+  static constexpr size_t SEARCH_GRANULARITY() { return 32; }
+  static constexpr unsigned BLACKHOLE_LOSSES() { return 6; }
+
+  static clock::duration RAISE_TIMEOUT() { return std::chrono::minutes(10); }
+
+  enum class State { disabled, searching, search_complete };
+
+public:
+  // Currently confirmed packet size.
+  size_t packet_size() const { return _confirmed; }
+
+  State state() const { return _state; }
+
+  // Search stays disabled until the socket is able to prevent
+  // fragmentation, otherwise the probes would always succeed.
+  void enable();
+
+  // Return the size of a probe to send if one should be sent now.
+  boost::optional<size_t> next_probe_size(clock::time_point now, clock::duration rtt);
+
+  void on_probe_sent(size_t size, clock::time_point now);
+  void on_probe_acked(size_t size);
+  void on_probe_lost(size_t size);
+  // Sending the probe failed locally (EMSGSIZE).
+  void on_probe_too_big(size_t size);
+
+  // Data (non probe) packets.
+  void on_packet_acked(size_t size);
+  void on_packet_lost(size_t size);
+
+  // Sending a packet of this size failed locally (EMSGSIZE).
+  void on_packet_too_big(size_t size);
+
+private:
+  void start_search(clock::time_point now);
+  void next_step();
+
+private:
+  State _state = State::disabled;
+
+  size_t _confirmed = DEFAULT();
+  // Largest size known not to work (exclusive upper bound of the search).
+  size_t _too_big = MAX() + 1;
+
+  size_t _probe_size = 0;
+  unsigned _probe_count = 0;
+  boost::optional<clock::time_point> _probe_sent_time;
+
+  clock::time_point _search_complete_time;
+
+  unsigned _consecutive_losses = 0;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline void PathMtu::enable() {
+  if (_state != State::disabled) return;
+  start_search(clock::now());
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::start_search(clock::time_point) {
+  _state = State::searching;
+  _probe_sent_time = boost::none;
+  _probe_count = 0;
+  next_step();
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::next_step() {
+  if (_too_big <= _confirmed + SEARCH_GRANULARITY()) {
+    _state = State::search_complete;
+    _search_complete_time = clock::now();
+    return;
+  }
+
+  _probe_size = (_confirmed + _too_big) / 2;
+  _probe_count = 0;
+}
+
+//------------------------------------------------------------------------------
+inline
+boost::optional<size_t>
+PathMtu::next_probe_size(clock::time_point now, clock::duration rtt) {
+  using namespace std::chrono;
+
+  if (_state == State::search_complete) {
+    if (now - _search_complete_time < RAISE_TIMEOUT()) return boost::none;
+    _too_big = MAX() + 1;
+    start_search(now);
+  }
+
+  if (_state != State::searching) return boost::none;
+
+  if (_probe_sent_time) {
+    auto timeout = std::max<clock::duration>(3 * rtt, milliseconds(50));
+    if (now - *_probe_sent_time < timeout) return boost::none;
+    on_probe_lost(_probe_size);
+    if (_state != State::searching) return boost::none;
+  }
+
+  return _probe_size;
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_probe_sent(size_t size, clock::time_point now) {
+  if (size != _probe_size) return;
+  _probe_sent_time = now;
+  ++_probe_count;
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_probe_acked(size_t size) {
+  if (_state != State::searching || size != _probe_size) return;
+
+  _probe_sent_time = boost::none;
+  _confirmed = size;
+  next_step();
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_probe_lost(size_t size) {
+  if (_state != State::searching || size != _probe_size) return;
+  if (!_probe_sent_time) return;
+
+  _probe_sent_time = boost::none;
+
+  if (_probe_count < MAX_PROBES()) return;
+
+  _too_big = size;
+  next_step();
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_probe_too_big(size_t size) {
+  if (_state != State::searching || size != _probe_size) return;
+
+  _probe_sent_time = boost::none;
+  _too_big = size;
+  next_step();
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_packet_acked(size_t size) {
+  if (size > MIN()) _consecutive_losses = 0;
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_packet_lost(size_t size) {
+  if (_state == State::disabled) return;
+  if (size <= MIN() || _confirmed <= MIN()) return;
+
+  if (++_consecutive_losses < BLACKHOLE_LOSSES()) return;
+
+  on_packet_too_big(_confirmed);
+}
+
+//------------------------------------------------------------------------------
+inline void PathMtu::on_packet_too_big(size_t size) {
+  _consecutive_losses = 0;
+
+  if (_confirmed <= MIN()) return;
+
+  _too_big = std::min(_too_big, std::max(size, MIN() + 1));
+  _confirmed = MIN();
+
+  if (_state != State::disabled) {
+    start_search(clock::now());
+  }
+}
+
+//------------------------------------------------------------------------------
+// Set the don't-fragment bit on outgoing packets without having the
+// kernel limit their size by its own path MTU estimate. Returns false
+// where this isn't supported.
+inline bool set_dont_fragment(boost::asio::ip::udp::socket& socket) {
+#if CLUB_HAS_PMTUDISC_PROBE
+  boost::system::error_code ec;
+  auto ep = socket.local_endpoint(ec);
+  if (ec) return false;
+
+  int value = IP_PMTUDISC_PROBE;
+  int r;
+
+  if (ep.address().is_v4()) {
+    r = ::setsockopt( socket.native_handle(), IPPROTO_IP, IP_MTU_DISCOVER
+                    , &value, sizeof(value));
+  }
+  else {
+    value = IPV6_PMTUDISC_PROBE;
+    r = ::setsockopt( socket.native_handle(), IPPROTO_IPV6, IPV6_MTU_DISCOVER
+                    , &value, sizeof(value));
+  }
+
+  return r == 0;
+#else
+  return false;
+#endif
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_PATH_MTU_H
@@ -0,0 +1,37 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_PRIORITY_H
+#define CLUB_TRANSPORT_PRIORITY_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Classes of outgoing messages. The transmit queue serves them strictly
+// in this order: a message is only put into a packet when no message of
+// a higher class is waiting to be sent.
+enum class Priority : uint8_t {
+  high,   // Control messages (sync, keep alive).
+  normal, // Default for user messages.
+  low     // Bulk transfers.
+};
+
+static constexpr size_t priority_count = 3;
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_PRIORITY_H
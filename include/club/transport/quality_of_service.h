@@ -15,8 +15,15 @@
 #ifndef CLUB_TRANSPORT_QUALITY_OF_SERVICE_H
 #define CLUB_TRANSPORT_QUALITY_OF_SERVICE_H
 
+#include <algorithm>
 #include <club/debug/log.h>
+#include <club/generic/ring_buffer.h>
 #include <club/transport/ack_set.h>
+#include <club/transport/congestion_control.h>
+#include <club/transport/path_mtu.h>
+#include <club/transport/rtt_estimator.h>
+#include <club/transport/windowed_min.h>
+#include <club/transport/wire_format.h>
 
 namespace club { namespace transport {
 
@@ -28,8 +35,6 @@ class QualityOfService {
   using clock = std::chrono::steady_clock;
 
 public:
-  // Sender Maximum Segment Size
-  static constexpr int32_t MSS() { return 1452; }
   static constexpr int32_t MIN_CWND() { return 2; }
 
 public:
@@ -38,8 +43,13 @@ public:
   boost::asio::steady_timer::duration
     next_sleep_duration(udp::endpoint);
 
+  // Size of the sequence number of the next packet (see
+  // encode_packet_number).
   size_t payload_header_size() const;
 
+  // Upper bound on what encode_header writes.
+  size_t max_header_size(const AckSet&) const;
+
   // Acks are being encoded/decoded separately from the header because
   // header always contains and increments the sequence number. But
   // if only acks are sent then the sequence number must not be
@@ -48,24 +58,84 @@ public:
   void encode_acks(binary::encoder&);
   void decode_acks(binary::decoder&);
 
-  bool encode_header(binary::encoder&, AckSet);
-  void decode_header(binary::decoder&);
+  // Probes are more likely to get lost, so they don't carry acks
+  // (with_acks unset). Returns the wire::flags describing what was
+  // encoded, decode_header must be given the same.
+  uint8_t encode_header(binary::encoder&, const AckSet&, bool with_acks = true);
+  void decode_header(binary::decoder&, uint8_t flags);
+
+  // Returns the sequence number of the packet.
+  uint32_t encode_payload_header( binary::encoder&
+                                , size_t packet_size
+                                , bool is_probe = false);
+  // Returns the sequence number of the received packet.
+  uint32_t decode_payload_header(binary::decoder&);
+
+  const std::vector<uint32_t>& acks() const { return _acks; }
+
+  int32_t bytes_in_flight() const { return _bytes_in_flight; }
+  void clear_in_flight_info();
 
-  void encode_payload_header(binary::encoder&, size_t packet_size);
-  void decode_payload_header(binary::decoder&);
+  size_t cwnd() const { return _congestion_controller->cwnd(); }
 
-  const std::set<uint32_t>& acks() const { return _acks; }
+  // Sender Maximum Segment Size, follows the discovered path MTU.
+  size_t mss() const { return _path_mtu.packet_size(); }
 
-  int32_t bytes_in_flight() const;
-  void clear_in_flight_info() { _in_flight.clear(); }
+  PathMtu& path_mtu() { return _path_mtu; }
+  const PathMtu& path_mtu() const { return _path_mtu; }
+
+  void congestion_controller(std::unique_ptr<CongestionController> cc) {
+    assert(cc);
+    _congestion_controller = std::move(cc);
+    _congestion_controller->set_mss(mss());
+  }
+
+  const CongestionController& congestion_controller() const {
+    return *_congestion_controller;
+  }
 
-  size_t cwnd() const { return _cwnd; }
+  // Smoothed round trip time, its variation and the retransmission
+  // timeout (RFC 6298).
+  clock::duration rtt()    const { return _rtt_estimator.srtt(); }
+  clock::duration rttvar() const { return _rtt_estimator.rttvar(); }
+  clock::duration rto()    const { return _rtt_estimator.rto(); }
 
-  clock::duration rtt() const { return _rtt; }
+  // Minimum round trip time seen during the last ten seconds.
+  boost::optional<clock::duration> min_rtt() const { return _min_rtt.get(); }
+
+  // Unacked data had to be resent after rto() passed.
+  void on_retransmit_timeout() { _rtt_estimator.on_timeout(); }
+
+  // Messages last sent no later than this were in a packet deemed lost.
+  clock::time_point lost_before() const { return _lost_before; }
+
+  // Let the next packet through even if the congestion window is full.
+  void allow_tail_loss_probe() { _tail_loss_probe = true; }
+
+  // Totals of data packets (i.e. not probes) which were acked and which
+  // were deemed lost.
+  uint64_t packets_acked() const { return _packets_acked; }
+  uint64_t packets_lost()  const { return _packets_lost; }
+
+  // Number of received headers whose acks revealed lost packets.
+  uint64_t loss_events() const { return _loss_events; }
+
+  // Bytes per second at which packets should leave when paced.
+  float pacing_rate() const;
 
 private:
   uint64_t time_since_start_mks() const;
-  void update_rtt(clock::duration last_rtt);
+
+  // Call f(first, last) for each range of consecutive sequence numbers
+  // in _acks, from the highest one down.
+  template<class F> void for_each_ack_range(F&&) const;
+  void update_rtt(clock::duration last_rtt, clock::time_point now);
+
+  // Forget packets with sequence numbers lower than `seq_nr`, those
+  // still in flight are considered lost. Returns true if any of them
+  // carried data (i.e. was not an MTU probe).
+  bool erase_in_flight_before(uint32_t seq_nr);
+  void pop_acked_in_flight();
 
 private:
   friend std::ostream& operator<<(std::ostream&, const QualityOfService&);
@@ -74,26 +144,51 @@ private:
 
   const clock::time_point _time_started = clock::now();
   int64_t _last_recv_packet_time = invalid_ts;
-  int64_t _base_delay = invalid_ts;
   int32_t _next_seq_nr = 0;
   int32_t _ack_nr = 0;
-  int32_t _cwnd = MIN_CWND() * MSS();
-  float _bytes_newly_acked = 0;
+  size_t _bytes_newly_acked = 0;
+  bool _loss_detected = false;
+  boost::optional<clock::duration> _last_rtt_sample;
   int64_t _bytes_sent_total = 0;
+  uint64_t _packets_acked = 0;
+  uint64_t _packets_lost = 0;
+  uint64_t _loss_events = 0;
+  clock::time_point _lost_before = clock::time_point::min();
+  bool _tail_loss_probe = false;
   boost::optional<uint32_t> _last_received_ack;
+  boost::optional<uint32_t> _largest_received_seq_nr;
+
+  RttEstimator _rtt_estimator;
+  WindowedMin<clock::duration, 10> _min_rtt{std::chrono::seconds(1)};
 
-  clock::duration _rtt = std::chrono::milliseconds(500);
+  std::unique_ptr<CongestionController> _congestion_controller
+    = make_congestion_controller(CongestionControl::ledbat, PathMtu::DEFAULT());
+
+  PathMtu _path_mtu;
 
   struct PacketInfo {
     uint32_t size;
     clock::time_point send_time;
+    bool is_in_flight;
+    // Probes are neither counted in _bytes_in_flight nor reported
+    // to the congestion controller.
+    bool is_probe;
   };
 
-  //          +--> seq_num
-  //          |
-  //          |
-  std::map<uint32_t, PacketInfo> _in_flight;
-  std::set<uint32_t> _acks;
+  // Packets are sent with consecutive sequence numbers, so _in_flight[i]
+  // describes the packet with sequence number _in_flight_first + i.
+  // Packets acked out of order stay in the ring (with is_in_flight unset)
+  // until all packets before them are acked as well.
+  RingBuffer<PacketInfo> _in_flight;
+  uint32_t _in_flight_first = 0;
+  size_t   _in_flight_count = 0;
+  int32_t  _bytes_in_flight = 0;
+
+  // Sequence numbers of received packets yet to be acked, sorted.
+  std::vector<uint32_t> _acks;
+
+  // Scratch space for decode_acks.
+  std::vector<uint32_t> _decoded_acks;
 
 public:
   // TODO: Not too happy that this variable is here (and that it is
@@ -104,9 +199,10 @@ public:
 //--------------------------------------------------------------------
 // Implementation
 //--------------------------------------------------------------------
-inline void QualityOfService::update_rtt(clock::duration last_rtt) {
-  using namespace std::chrono;
-  _rtt = duration_cast<clock::duration>(0.75 * _rtt + 0.25 * last_rtt);
+inline void QualityOfService::update_rtt( clock::duration last_rtt
+                                        , clock::time_point now) {
+  _rtt_estimator.on_sample(last_rtt);
+  _min_rtt.update(last_rtt, now);
 }
 
 //--------------------------------------------------------------------
@@ -117,191 +213,381 @@ QualityOfService::time_since_start_mks() const {
 }
 
 //--------------------------------------------------------------------
-inline int32_t
-QualityOfService::bytes_in_flight() const {
-  uint32_t retval = 0;
-  for (auto p : _in_flight) retval += p.second.size;
-  return retval;
+inline void QualityOfService::clear_in_flight_info() {
+  _in_flight.clear();
+  _in_flight_first = _next_seq_nr;
+  _in_flight_count = 0;
+  _bytes_in_flight = 0;
+}
+
+//--------------------------------------------------------------------
+inline bool QualityOfService::erase_in_flight_before(uint32_t seq_nr) {
+  bool data_lost = false;
+
+  while (!_in_flight.empty() && _in_flight_first < seq_nr) {
+    auto& p = _in_flight.front();
+
+    if (p.is_in_flight) {
+      --_in_flight_count;
+
+      if (p.is_probe) {
+        _path_mtu.on_probe_lost(p.size);
+      }
+      else {
+        _bytes_in_flight -= p.size;
+        _path_mtu.on_packet_lost(p.size);
+        ++_packets_lost;
+        _lost_before = std::max(_lost_before, p.send_time);
+        data_lost = true;
+      }
+    }
+
+    _in_flight.pop_front();
+    ++_in_flight_first;
+  }
+
+  return data_lost;
+}
+
+//--------------------------------------------------------------------
+inline void QualityOfService::pop_acked_in_flight() {
+  while (!_in_flight.empty() && !_in_flight.front().is_in_flight) {
+    _in_flight.pop_front();
+    ++_in_flight_first;
+  }
+}
+
+//--------------------------------------------------------------------
+template<class F>
+inline void QualityOfService::for_each_ack_range(F&& f) const {
+  auto i = _acks.rbegin();
+
+  while (i != _acks.rend()) {
+    auto last  = *i;
+    auto first = last;
+
+    while (++i != _acks.rend() && *i == first - 1) {
+      first = *i;
+    }
+
+    f(first, last);
+  }
 }
 
 //--------------------------------------------------------------------
+// Acks are encoded as ranges of consecutive sequence numbers, from the
+// highest one down:
+//
+//   varint  number of ranges
+//   varint  highest sequence number
+//   varint  length of the first range - 1
+//   and for each other range:
+//     varint  number of sequence numbers between it and the previous
+//             range - 1
+//     varint  length - 1
 inline size_t QualityOfService::encoded_acks_size() const {
-  return 2 + _acks.size() * 4;
+  using binary::varint_size;
+
+  size_t size = 0;
+  size_t count = 0;
+  boost::optional<uint32_t> previous_first;
+
+  for_each_ack_range([&](uint32_t first, uint32_t last) {
+      size += previous_first ? varint_size(*previous_first - last - 2)
+                             : varint_size(last);
+      size += varint_size(last - first);
+      previous_first = first;
+      ++count;
+    });
+
+  return varint_size(count) + size;
 }
 
 //--------------------------------------------------------------------
 inline void QualityOfService::encode_acks(binary::encoder& e) {
-  e.put(uint16_t(_acks.size()));
-  for (auto i = _acks.begin(); i != _acks.end();) {
-    e.put(*i);
-    i = _acks.erase(i);
-  }
+  using binary::varint;
+
+  uint32_t count = 0;
+  for_each_ack_range([&](uint32_t, uint32_t) { ++count; });
+
+  e.put(varint<uint32_t>(count));
+
+  boost::optional<uint32_t> previous_first;
+
+  for_each_ack_range([&](uint32_t first, uint32_t last) {
+      e.put(varint<uint32_t>(previous_first ? *previous_first - last - 2
+                                            : last));
+      e.put(varint<uint32_t>(last - first));
+      previous_first = first;
+    });
+
+  // Keeps the capacity.
+  _acks.clear();
 }
 
 //--------------------------------------------------------------------
 inline void QualityOfService::decode_acks(binary::decoder& d) {
-  if (!d.get<uint8_t>() || d.error()) return;
+  using binary::varint;
 
-  _bytes_newly_acked = 0;
+  // More than a sender could have received since its previous ack.
+  static constexpr uint32_t MAX_ACKS = 65535;
+
+  auto range_count = d.get<varint<uint32_t>>().value;
+
+  _decoded_acks.clear();
+
+  uint32_t previous_first = 0;
+
+  for (uint32_t r = 0; r < range_count && !d.error(); ++r) {
+    auto v   = d.get<varint<uint32_t>>().value;
+    auto len = d.get<varint<uint32_t>>().value;
+
+    if (r != 0 && uint64_t(v) + 2 > previous_first) return d.set_error();
 
-  bool data_loss_detected = false;
+    uint32_t last = r == 0 ? v : previous_first - v - 2;
+
+    if (len > last || _decoded_acks.size() + len >= MAX_ACKS) {
+      return d.set_error();
+    }
+
+    for (uint32_t sn = last; sn != last - len - 1; --sn) {
+      _decoded_acks.push_back(sn);
+    }
+
+    previous_first = last - len;
+  }
+
+  if (d.error()) return;
 
   auto now = clock::now();
-  auto count = d.get<uint16_t>();
-  for (uint16_t _i = 0; _i < count; ++_i) {
-    auto sn = d.get<uint32_t>();
-    assert(!d.error());
+
+  for (auto i = _decoded_acks.rbegin(); i != _decoded_acks.rend(); ++i) {
+    auto sn = *i;
 
     if (_last_received_ack) {
       auto expected = *_last_received_ack + 1;
 
       if (sn != expected) {
-        _in_flight.erase(_in_flight.begin(), _in_flight.upper_bound(sn));
+        if (erase_in_flight_before(sn)) {
+          _loss_detected = true;
+        }
 
         if (sn < expected) {
           continue;
         }
-        else /* (sn > expected) */ {
-          data_loss_detected = true;
-        }
       }
     }
 
     _last_received_ack = sn;
 
-    auto i = _in_flight.find(sn);
-    if (i != _in_flight.end()) {
-      _bytes_newly_acked += i->second.size;
-      update_rtt(now - i->second.send_time);
-      _in_flight.erase(i);
+    if (sn >= _in_flight_first && sn - _in_flight_first < _in_flight.size()) {
+      auto& p = _in_flight[sn - _in_flight_first];
+
+      if (p.is_in_flight) {
+        _last_rtt_sample = now - p.send_time;
+        update_rtt(*_last_rtt_sample, now);
+        p.is_in_flight = false;
+        --_in_flight_count;
+
+        if (p.is_probe) {
+          _path_mtu.on_probe_acked(p.size);
+        }
+        else {
+          _bytes_newly_acked += p.size;
+          _bytes_in_flight -= p.size;
+          ++_packets_acked;
+          _path_mtu.on_packet_acked(p.size);
+        }
+
+        pop_acked_in_flight();
+      }
     }
   }
 
-  if (data_loss_detected) {
-    _cwnd = std::min(_cwnd, std::max(_cwnd/2, MIN_CWND() * MSS()));
-  }
+  _congestion_controller->set_mss(mss());
 
-  // TODO: We should implement an AckSet union and use that one. That
-  // is, if this packet got reordered and is actually older than
-  // a packet we received in the past, then this ack_set will destroy
-  // information.
+  // This packet may have been reordered and be older than one we've
+  // received in the past, so we merge instead of replacing.
   auto ack_set = d.get<AckSet>();
-  _received_message_ids_by_peer = ack_set;
+  _received_message_ids_by_peer.merge(ack_set);
 }
 
 //--------------------------------------------------------------------
 inline size_t
 QualityOfService::payload_header_size() const {
-  return sizeof(_next_seq_nr);
+  return packet_number_size(_next_seq_nr, _last_received_ack);
+}
+
+//--------------------------------------------------------------------
+inline size_t
+QualityOfService::max_header_size(const AckSet& received_message_ids) const {
+  return 2 * binary::varint<uint64_t>::max_size
+       + encoded_acks_size()
+       + received_message_ids.encoded_size();
 }
 
 //--------------------------------------------------------------------
 inline size_t
 QualityOfService::next_packet_max_size() const {
-  auto diff = _cwnd - bytes_in_flight();
+  if (_tail_loss_probe) return mss();
+
+  auto diff = int32_t(cwnd()) - bytes_in_flight();
   if (diff <= 0) return 0;
-  auto ret = std::min(MSS(), diff);
+  auto ret = std::min<int32_t>(mss(), diff);
   return ret;
 }
 
+//--------------------------------------------------------------------
+inline float QualityOfService::pacing_rate() const {
+  // Pace slightly faster than cwnd per RTT so that pacing alone
+  // doesn't prevent the window from growing.
+  constexpr float PACING_GAIN = 1.25;
+
+  if (auto rate = _congestion_controller->pacing_rate()) {
+    return rate;
+  }
+
+  float rtt = std::chrono::duration<float>(this->rtt()).count();
+  if (rtt <= 0) return 0;
+  return PACING_GAIN * cwnd() / rtt;
+}
+
 //--------------------------------------------------------------------
 inline
-void QualityOfService::encode_payload_header(binary::encoder& e, size_t packet_size) {
+uint32_t QualityOfService::encode_payload_header( binary::encoder& e
+                                                , size_t packet_size
+                                                , bool is_probe) {
   _bytes_sent_total += packet_size;
   auto seq_nr = _next_seq_nr++;
-  _in_flight[seq_nr] = PacketInfo{ uint32_t(packet_size)
-                                 , clock::now() };
-  e.put(seq_nr);
+
+  if (!is_probe) _tail_loss_probe = false;
+
+  if (_in_flight.empty()) {
+    _in_flight_first = seq_nr;
+  }
+
+  assert(uint32_t(seq_nr) == _in_flight_first + _in_flight.size());
+
+  _in_flight.push_back(PacketInfo{ uint32_t(packet_size)
+                                 , clock::now()
+                                 , true
+                                 , is_probe });
+  ++_in_flight_count;
+
+  if (is_probe) {
+    _path_mtu.on_probe_sent(packet_size, clock::now());
+  }
+  else {
+    _bytes_in_flight += packet_size;
+  }
+
+  encode_packet_number(e, seq_nr, _last_received_ack);
+  return seq_nr;
 }
 
 //--------------------------------------------------------------------
 inline
-void QualityOfService::decode_payload_header(binary::decoder& d) {
-  auto seq_nr = d.get<uint32_t>();
-  if (d.error()) { assert(0); return; }
-  _acks.insert(seq_nr);
+uint32_t QualityOfService::decode_payload_header(binary::decoder& d) {
+  auto seq_nr = decode_packet_number(d, _largest_received_seq_nr);
+  if (d.error()) return 0;
+
+  if (!_largest_received_seq_nr
+      || int32_t(seq_nr - *_largest_received_seq_nr) > 0) {
+    _largest_received_seq_nr = seq_nr;
+  }
+
+  // Packets mostly arrive in order, so this is mostly a push_back.
+  auto i = std::lower_bound(_acks.begin(), _acks.end(), seq_nr);
+
+  if (i == _acks.end() || *i != seq_nr) {
+    _acks.insert(i, seq_nr);
+  }
+
+  return seq_nr;
 }
 
 //--------------------------------------------------------------------
 inline
-bool QualityOfService::encode_header(binary::encoder& e, AckSet received_message_ids) {
-  using namespace std::chrono;
+uint8_t QualityOfService::encode_header( binary::encoder& e
+                                       , const AckSet& received_message_ids
+                                       , bool with_acks) {
+  using binary::varint;
 
+  uint8_t flags = 0;
   auto now = time_since_start_mks();
 
-  int64_t timestamp_difference_mks
-    = _last_recv_packet_time != invalid_ts ? now - _last_recv_packet_time
-                                           : invalid_ts;
+  e.put(varint<uint64_t>(now));
 
-  e.put(now);
-  e.put(timestamp_difference_mks);
-
-  if (_acks.empty()) {
-    e.put<uint8_t>(0);
-    return false;
+  if (_last_recv_packet_time != invalid_ts) {
+    flags |= wire::has_delay;
+    int64_t timestamp_difference_mks = now - _last_recv_packet_time;
+    e.put(varint<uint64_t>(binary::zigzag_encode(timestamp_difference_mks)));
   }
-  else {
-    e.put<uint8_t>(1);
+
+  if (!_acks.empty() && with_acks) {
+    flags |= wire::has_acks;
     encode_acks(e);
     e.put(received_message_ids);
-    return true;
   }
+
+  return flags;
 }
 
 //--------------------------------------------------------------------
 inline
-void QualityOfService::decode_header(binary::decoder& d) {
-  using namespace std::chrono;
+void QualityOfService::decode_header(binary::decoder& d, uint8_t flags) {
+  using binary::varint;
+
+  _last_recv_packet_time = d.get<varint<uint64_t>>().value;
 
-  _last_recv_packet_time = d.get<int64_t>();
-  auto timestamp_difference_mks = d.get<int64_t>();
+  boost::optional<int64_t> timestamp_difference_mks;
+
+  if (flags & wire::has_delay) {
+    auto v = d.get<varint<uint64_t>>().value;
+    timestamp_difference_mks = binary::zigzag_decode(v);
+  }
 
-  assert(!d.error());
+  if (d.error()) return;
+
+  CongestionController::AckSample sample;
 
   // As per LEBDAT documentation:
   // # flightsize is the amount of data outstanding before this ACK
   // #    was received and is updated later;
   // So we must set it *before* we read the acks.
-  auto flight_size = bytes_in_flight();
-
-  decode_acks(d);
+  sample.flight_size = bytes_in_flight();
 
-  if (timestamp_difference_mks == invalid_ts) {
-    return;
-  }
+  _bytes_newly_acked = 0;
+  _loss_detected = false;
+  _last_rtt_sample = boost::none;
 
-  if (timestamp_difference_mks < _base_delay) {
-    _base_delay = timestamp_difference_mks;
+  if (flags & wire::has_acks) {
+    decode_acks(d);
+    if (d.error()) return;
   }
 
-  float our_delay
-    = microseconds(timestamp_difference_mks - _base_delay).count()
-    / 1'000'000.f;
+  sample.now = clock::now();
+  sample.bytes_newly_acked = _bytes_newly_acked;
+  sample.loss_detected = _loss_detected;
+  sample.rtt = _last_rtt_sample;
+  sample.srtt = rtt();
+  sample.min_rtt = min_rtt();
 
-  constexpr float TARGET = 0.01; // 10ms
-  constexpr float GAIN = 1;
-  constexpr float ALLOWED_INCREASE = 1;
+  sample.delay_mks = timestamp_difference_mks;
 
-  float off_target = (TARGET - our_delay) / TARGET;
-  float window_factor = _bytes_newly_acked * MSS() / _cwnd;
-
-  auto scaled_gain = GAIN * off_target * window_factor;
-  auto max_allowed_cwnd = flight_size + ALLOWED_INCREASE * MSS();
-
-  //club::log(">>> off_target: ", off_target);
-  //club::log(">>> window_factor: ", window_factor);
-  //club::log(">>> flight_size: ", flight_size);
-  //club::log(">>> _cwnd + scaled_gain: ", (_cwnd + scaled_gain), " max_allowed_cwnd:", max_allowed_cwnd);
-  _cwnd = std::min(_cwnd + scaled_gain, max_allowed_cwnd);
-  _cwnd = std::max<decltype(_cwnd)>(_cwnd, MIN_CWND() * MSS());
+  if (sample.loss_detected) {
+    ++_loss_events;
+    _congestion_controller->on_loss(sample);
+  }
 
+  _congestion_controller->on_ack(sample);
 }
 
 //--------------------------------------------------------------------
 inline std::ostream& operator<<(std::ostream& os, const QualityOfService& qos) {
   os << "(in_flight: " << qos.bytes_in_flight()
-                       << " cwnd:" << qos._cwnd
-                       << " in_flight.size:" << qos._in_flight.size()
+                       << " cwnd:" << qos.cwnd()
+                       << " in_flight.size:" << qos._in_flight_count
                        << ")";
   return os;
 }
@@ -0,0 +1,100 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_RTT_ESTIMATOR_H
+#define CLUB_TRANSPORT_RTT_ESTIMATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <boost/optional.hpp>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Smoothed round trip time, its variation and the retransmission timeout
+// as per RFC 6298.
+//
+// Karn's algorithm is not needed: RTT samples are taken from packets and
+// those are never retransmitted (resent messages go out in new packets
+// with new sequence numbers).
+//
+// Deviations from the RFC: the minimum RTO is lower than one second,
+// which would be far too long for interactive traffic, and the SRTT
+// reads 500ms (half of the initial RTO) until the first sample arrives.
+class RttEstimator {
+  using clock = std::chrono::steady_clock;
+
+public:
+  static clock::duration INITIAL_RTO() { return std::chrono::seconds(1); }
+  static clock::duration MIN_RTO()     { return std::chrono::milliseconds(50); }
+  static clock::duration MAX_RTO()     { return std::chrono::seconds(60); }
+  static clock::duration GRANULARITY() { return std::chrono::milliseconds(1); }
+
+  void on_sample(clock::duration rtt);
+
+  // A message had to be resent because the RTO passed, back off
+  // exponentially until the next sample (RFC 6298, section 5.5).
+  void on_timeout();
+
+  bool has_sample() const { return bool(_srtt); }
+
+  clock::duration srtt() const { return _srtt.value_or(INITIAL_RTO() / 2); }
+  clock::duration rttvar() const { return _rttvar; }
+  clock::duration rto() const;
+
+private:
+  static constexpr unsigned MAX_BACKOFF = 6;
+
+  boost::optional<clock::duration> _srtt;
+  clock::duration _rttvar = clock::duration(0);
+  clock::duration _rto = INITIAL_RTO();
+  unsigned _backoff = 0;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+inline void RttEstimator::on_sample(clock::duration r) {
+  using std::chrono::duration_cast;
+
+  if (!_srtt) {
+    // (2.2)
+    _srtt   = r;
+    _rttvar = r / 2;
+  }
+  else {
+    // (2.3) with alpha = 1/8 and beta = 1/4
+    auto err = *_srtt > r ? *_srtt - r : r - *_srtt;
+    _rttvar = duration_cast<clock::duration>(0.75 * _rttvar + 0.25 * err);
+    _srtt   = duration_cast<clock::duration>(0.875 * *_srtt + 0.125 * r);
+  }
+
+  _rto = *_srtt + std::max(GRANULARITY(), 4 * _rttvar);
+  _backoff = 0;
+}
+
+//------------------------------------------------------------------------------
+inline void RttEstimator::on_timeout() {
+  _backoff = std::min(_backoff + 1, unsigned(MAX_BACKOFF));
+}
+
+//------------------------------------------------------------------------------
+inline RttEstimator::clock::duration RttEstimator::rto() const {
+  auto rto = std::max(_rto, MIN_RTO()) * (1 << _backoff);
+  return std::min(rto, MAX_RTO());
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_RTT_ESTIMATOR_H
@@ -0,0 +1,72 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_SHARED_BUFFER_H
+#define CLUB_TRANSPORT_SHARED_BUFFER_H
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Immutable bytes kept alive by a reference counted owner. Copying it
+// doesn't copy the bytes, which makes it possible to send the same data
+// to many peers (or to put it behind another buffer) without copying.
+class SharedBuffer {
+public:
+  SharedBuffer() {}
+
+  SharedBuffer( const uint8_t*              data
+              , size_t                      size
+              , std::shared_ptr<const void> owner)
+    : _data(data)
+    , _size(size)
+    , _owner(std::move(owner))
+  {}
+
+  template<class T>
+  SharedBuffer(std::shared_ptr<const std::vector<T>> v)
+    : _data(reinterpret_cast<const uint8_t*>(v->data()))
+    , _size(v->size())
+    , _owner(std::move(v))
+  {
+    static_assert(sizeof(T) == 1, "Only vectors of bytes are supported");
+  }
+
+  template<class T>
+  SharedBuffer(std::shared_ptr<std::vector<T>> v)
+    : SharedBuffer(std::shared_ptr<const std::vector<T>>(std::move(v)))
+  {}
+
+  const uint8_t* data() const { return _data; }
+  size_t         size() const { return _size; }
+  bool          empty() const { return _size == 0; }
+
+  // Return a part of this buffer sharing the same owner.
+  SharedBuffer slice(size_t start, size_t size) const {
+    assert(start + size <= _size);
+    return SharedBuffer(_data + start, size, _owner);
+  }
+
+private:
+  const uint8_t*              _data = nullptr;
+  size_t                      _size = 0;
+  std::shared_ptr<const void> _owner;
+};
+
+}} // club::transport namespace
+
+#endif // ifndef CLUB_TRANSPORT_SHARED_BUFFER_H
@@ -0,0 +1,100 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_SOCKET_STATS_H
+#define CLUB_TRANSPORT_SOCKET_STATS_H
+
+#include <chrono>
+#include <ostream>
+#include <boost/optional.hpp>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Snapshot of what a socket's transport is doing. Counters are totals
+// since the socket was created, the rest is the state at the time the
+// snapshot was taken.
+struct SocketStats {
+  using clock = std::chrono::steady_clock;
+
+  // Datagrams (and their bytes) that went through the UDP socket.
+  uint64_t packets_sent     = 0;
+  uint64_t packets_received = 0;
+  uint64_t bytes_sent       = 0;
+  uint64_t bytes_received   = 0;
+
+  // Message bytes (headers included) that had been sent before.
+  uint64_t bytes_retransmitted = 0;
+
+  // Chunks of reliable messages which had already been received.
+  uint64_t duplicate_chunks_received = 0;
+
+  clock::duration                  srtt = clock::duration(0);
+  boost::optional<clock::duration> min_rtt;
+  clock::duration                  rto  = clock::duration(0);
+
+  size_t  cwnd            = 0;
+  // Signed like the counter in QualityOfService, so that a negative value
+  // (a bug in its accounting) shows up as such.
+  int32_t bytes_in_flight = 0;
+
+  // Messages waiting to be sent or acked.
+  size_t transmit_queue_size  = 0;
+  size_t transmit_queue_bytes = 0;
+
+  // Received parts of reliable messages that can't be delivered yet.
+  size_t pending_reassembly_bytes = 0;
+
+  // Acks that revealed lost packets, and the number of those packets.
+  uint64_t loss_events  = 0;
+  uint64_t packets_lost = 0;
+
+  uint64_t keepalives_sent     = 0;
+  uint64_t keepalives_received = 0;
+};
+
+//------------------------------------------------------------------------------
+inline std::ostream& operator<<(std::ostream& os, const SocketStats& s) {
+  using std::chrono::microseconds;
+  using std::chrono::duration_cast;
+
+  auto us = [](SocketStats::clock::duration d) {
+    return duration_cast<microseconds>(d).count();
+  };
+
+  os << "(SocketStats"
+     << " tx:" << s.packets_sent << "/" << s.bytes_sent
+     << " rx:" << s.packets_received << "/" << s.bytes_received
+     << " retransmitted:" << s.bytes_retransmitted
+     << " duplicates:" << s.duplicate_chunks_received
+     << " srtt_us:" << us(s.srtt);
+
+  if (s.min_rtt) os << " min_rtt_us:" << us(*s.min_rtt);
+
+  return os << " rto_us:" << us(s.rto)
+            << " cwnd:" << s.cwnd
+            << " in_flight:" << s.bytes_in_flight
+            << " queue:" << s.transmit_queue_size
+                  << "/" << s.transmit_queue_bytes
+            << " pending:" << s.pending_reassembly_bytes
+            << " loss_events:" << s.loss_events
+            << " lost:" << s.packets_lost
+            << " keepalives:" << s.keepalives_sent
+                       << "/" << s.keepalives_received
+            << ")";
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_SOCKET_STATS_H
@@ -15,97 +15,383 @@
 #ifndef CLUB_TRANSMIT_QUEUE_H
 #define CLUB_TRANSMIT_QUEUE_H
 
-#include <list>
+#include <array>
 #include <chrono>
-#include <boost/variant.hpp>
-#include <club/generic/cyclic_queue.h>
+#include <limits>
+#include <unordered_map>
+#include <club/generic/ring_buffer.h>
 #include <club/transport/out_message.h>
+#include <club/transport/priority.h>
 
 namespace club { namespace transport {
 
+// Messages waiting to be sent or acknowledged. Choosing what goes into the
+// next packet is O(number of messages encoded) regardless of how many
+// messages are in the queue:
+//
+// * Entries live in a slab and the queues below hold indices into it.
+// * `_ready` holds the entries that may be sent right away, one queue per
+//   priority class, each in round robin order. A class is only served when
+//   all the classes above it are empty.
+// * `_in_flight` holds the reliable entries that have been fully sent,
+//   ordered by the time they were sent. Since the retransmission threshold
+//   is the same for all of them, that is also the order of their
+//   retransmission deadlines, so only its front needs to be examined.
+// * `_reliable` maps sequence numbers of reliable entries to their index so
+//   that acknowledged entries are removed without searching for them.
+// * `_keyed` maps keys of unreliable entries to their index so that a newer
+//   value replaces an unsent one instead of being queued behind it.
+//
+// Removed entries become tombstones until they are popped from whichever
+// of the above queues they are in.
 class TransmitQueue {
+public:
+  using Key = uint32_t;
+
+private:
   using clock = std::chrono::steady_clock;
+  using Index = uint32_t;
 
-  struct Entry {
-    Entry(OutMessage m) : message(std::move(m)) {}
+  static constexpr Index no_index = std::numeric_limits<Index>::max();
 
-    boost::optional<clock::time_point> last_sent_time;
+  struct Entry {
+    Entry(OutMessage m, Priority p, clock::time_point now)
+      : priority(p), inserted_time(now), message(std::move(m)) {}
+
+    Priority             priority;
+    boost::optional<Key> key;
+    bool                 was_sent = false;
+    bool                 was_fully_sent = false;
+    clock::time_point    inserted_time;
+    clock::time_point    last_sent_time;
     OutMessage message;
   };
 
-  using Queue = CyclicQueue<Entry>;
 public:
-  //----------------------------------------------------------------------------
-  void insert(OutMessage m) {
-    _bytes_in += m.header().original_size;
-    _queue.insert(Entry(std::move(m)));
-  }
+  // Per priority class counters. Wait time is measured from insertion
+  // until the first part of the message is put into a packet.
+  struct ClassStats {
+    size_t          depth = 0; // Messages currently in the queue.
+    uint64_t        sent  = 0; // Messages that went out at least once.
+    clock::duration total_wait = clock::duration(0);
+    clock::duration max_wait   = clock::duration(0);
+  };
 
-  bool empty() const { return _queue.empty(); }
-  size_t size() const { return _queue.size(); }
+public:
+  //----------------------------------------------------------------------------
+  void insert(OutMessage m, Priority = Priority::normal);
+
+  // Same as above, but any entry inserted with `key` before is replaced
+  // by this one if it is still in the queue. The message must not be
+  // resent until acked.
+  void insert(Key key, OutMessage m, Priority = Priority::normal);
+
+  // Replace the payload of the entry with `key` in place. Returns false
+  // if there is no such entry or if a part of it has already been sent,
+  // in the latter case the entry is removed as it's already outdated.
+  // The arguments are only moved from if true is returned.
+  bool reset_payload( Key
+                    , std::vector<uint8_t>&&      head
+                    , OutMessage::SharedPayload&& tail);
+
+  bool empty() const { return _size == 0; }
+  size_t size() const { return _size; }
   size_t size_in_bytes() const { return _bytes_in; }
 
-  size_t encode_payload(binary::encoder&, AckSet acked, clock::duration);
+  // Reliable entries are resent once `duration` has passed since they were
+  // last sent, or right away if they were last sent no later than
+  // `lost_before` (i.e. they were in a packet known to be lost).
+  size_t encode_payload( binary::encoder&
+                       , const AckSet& acked
+                       , clock::duration
+                       , clock::time_point lost_before = clock::time_point::min());
+
+  // Make the most recently sent unacked entry ready to be sent again (in
+  // front of others of its class). Returns false if there is none.
+  bool retransmit_last();
+
+  // Total of entries that became ready again because `duration` passed
+  // without them being acked (as opposed to being known lost).
+  uint64_t retransmit_timeouts() const { return _retransmit_timeouts; }
+
+  // Total of encoded bytes (headers included) of entries being resent.
+  uint64_t bytes_retransmitted() const { return _bytes_retransmitted; }
+
+  const ClassStats& stats(Priority p) const { return _stats[size_t(p)]; }
 
 private:
   bool try_encode(binary::encoder&, Entry&) const;
 
+  RingBuffer<Index>& ready(Priority p) { return _ready[size_t(p)]; }
+
+  void remove_acked(const AckSet&);
+  void remove_reliable(SequenceNumber);
+  void remove(Index);
+
+  // Pop the front of `queue` if it is a tombstone.
+  bool pop_tombstone(RingBuffer<Index>& queue);
+
 private:
   size_t _bytes_in = 0;
-  Queue _queue;
+  size_t _size = 0;
+  uint64_t _retransmit_timeouts = 0;
+  uint64_t _bytes_retransmitted = 0;
+
+  std::vector<boost::optional<Entry>> _entries;
+  std::vector<Index>                  _free_entries;
+
+  std::array<RingBuffer<Index>, priority_count> _ready;
+  RingBuffer<Index>                             _in_flight;
+
+  std::array<ClassStats, priority_count> _stats;
+
+  std::unordered_map<Key, Index> _keyed;
+
+  // _reliable[i] is the index of the entry with sequence number
+  // _reliable_base + i (or no_index).
+  SequenceNumber    _reliable_base = 0;
+  RingBuffer<Index> _reliable;
 };
 
 //------------------------------------------------------------------------------
-inline size_t TransmitQueue::encode_payload( binary::encoder& encoder
-                                           , AckSet acked
-                                           , clock::duration duration_threshold) {
-  size_t count = 0;
+// Implementation
+//------------------------------------------------------------------------------
+inline void TransmitQueue::insert(OutMessage m, Priority priority) {
+  Index i;
 
-  auto cycle = _queue.cycle();
+  if (_free_entries.empty()) {
+    i = _entries.size();
+    _entries.emplace_back();
+  }
+  else {
+    i = _free_entries.back();
+    _free_entries.pop_back();
+  }
 
-  using namespace std::chrono_literals;
-  auto now = clock::now();
-  clock::time_point time_threshold = now - duration_threshold;
+  _bytes_in += m.header().original_size;
+  ++_size;
 
-  for (auto mi = cycle.begin(); mi != cycle.end();) {
-    auto& m = mi->message;
-    if (m.resend_until_acked && acked.is_in(m.sequence_number())) {
-      _bytes_in -= m.payload_size();
-      mi.erase();
-      continue;
-    }
+  if (m.resend_until_acked) {
+    auto sn = m.sequence_number();
 
-    if (mi->last_sent_time && *mi->last_sent_time > time_threshold) {
-      ++mi;
-      continue;
+    if (_reliable.empty()) {
+      _reliable_base = sn;
     }
 
-    if (!try_encode(encoder, *mi)) {
-      break;
+    // Sequence numbers of reliable messages are mostly inserted in
+    // increasing order, but e.g. the sync message may come late.
+    while (sn < _reliable_base) {
+      _reliable.push_front(no_index);
+      --_reliable_base;
     }
 
-    if (m.fully_sent()) {
-      mi->last_sent_time = now;
+    while (sn - _reliable_base >= _reliable.size()) {
+      _reliable.push_back(no_index);
     }
 
-    ++count;
+    _reliable[sn - _reliable_base] = i;
+  }
+
+  _entries[i].emplace(std::move(m), priority, clock::now());
+  ready(priority).push_back(i);
+  ++_stats[size_t(priority)].depth;
+}
+
+//------------------------------------------------------------------------------
+inline void TransmitQueue::insert(Key key, OutMessage m, Priority priority) {
+  assert(!m.resend_until_acked);
+
+  auto k = _keyed.find(key);
+
+  if (k != _keyed.end()) {
+    remove(k->second);
+  }
+
+  insert(std::move(m), priority);
+
+  // The new entry is at the back of its ready queue.
+  auto i = ready(priority).back();
+  _entries[i]->key = key;
+  _keyed[key] = i;
+}
+
+//------------------------------------------------------------------------------
+inline bool TransmitQueue::reset_payload( Key                         key
+                                        , std::vector<uint8_t>&&      head
+                                        , OutMessage::SharedPayload&& tail) {
+  auto k = _keyed.find(key);
+
+  if (k == _keyed.end()) return false;
+
+  auto& m = _entries[k->second]->message;
+  auto old_size = m.payload_size();
+
+  if (!m.reset_payload(std::move(head), std::move(tail))) {
+    remove(k->second);
+    return false;
+  }
+
+  _bytes_in = _bytes_in - old_size + m.payload_size();
+  return true;
+}
+
+//------------------------------------------------------------------------------
+inline size_t TransmitQueue::encode_payload( binary::encoder& encoder
+                                           , const AckSet& acked
+                                           , clock::duration duration_threshold
+                                           , clock::time_point lost_before) {
+  size_t count = 0;
+
+  remove_acked(acked);
+
+  auto now = clock::now();
+  clock::time_point time_threshold = std::max(now - duration_threshold
+                                             , lost_before);
+
+  // Entries whose retransmission deadline has passed become ready again.
+  while (!_in_flight.empty()) {
+    if (pop_tombstone(_in_flight)) continue;
+
+    auto i = _in_flight.front();
+
+    auto last_sent = _entries[i]->last_sent_time;
+
+    if (last_sent > time_threshold) break;
+    if (last_sent > lost_before) ++_retransmit_timeouts;
+
+    _in_flight.pop_front();
+    ready(_entries[i]->priority).push_back(i);
+  }
+
+  for (auto& queue : _ready) {
+    while (!queue.empty()) {
+      if (pop_tombstone(queue)) continue;
+
+      auto i = queue.front();
+      auto& e = *_entries[i];
+      auto& m = e.message;
+
+      auto written = encoder.written();
+
+      if (!try_encode(encoder, e)) {
+        return count;
+      }
 
-    if (m.bytes_already_sent != m.payload_size()) {
-      // It means we've exhausted the buffer in encoder.
-      break;
+      if (e.was_fully_sent) {
+        _bytes_retransmitted += encoder.written() - written;
+      }
+
+      ++count;
+
+      if (!e.was_sent) {
+        e.was_sent = true;
+
+        auto& stats = _stats[size_t(e.priority)];
+        auto wait = now - e.inserted_time;
+
+        ++stats.sent;
+        stats.total_wait += wait;
+        stats.max_wait = std::max(stats.max_wait, wait);
+      }
+
+      if (!m.fully_sent()) {
+        // It means we've exhausted the buffer in encoder, the rest of the
+        // message shall be sent first in the next packet (unless a message
+        // of a higher class preempts it).
+        return count;
+      }
+
+      queue.pop_front();
+
+      // Unreliable entries are sent only once.
+      if (!m.resend_until_acked) {
+        remove(i);
+        _free_entries.push_back(i);
+        continue;
+      }
+
+      e.was_fully_sent = true;
+      e.last_sent_time = now;
+      _in_flight.push_back(i);
     }
+  }
+
+  return count;
+}
+
+//------------------------------------------------------------------------------
+inline bool TransmitQueue::retransmit_last() {
+  while (!_in_flight.empty()) {
+    auto i = _in_flight.back();
+    _in_flight.pop_back();
 
-    // Unreliable entries are sent only once.
-    if (!m.resend_until_acked) {
-      _bytes_in -= m.payload_size();
-      mi.erase();
+    if (!_entries[i]) {
+      _free_entries.push_back(i);
       continue;
     }
-    
-    ++mi;
+
+    ready(_entries[i]->priority).push_front(i);
+    return true;
   }
 
-  return count;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+inline void TransmitQueue::remove_acked(const AckSet& acked) {
+  if (acked.empty()) return;
+
+  while (!_reliable.empty() && _reliable_base < acked.cumulative()) {
+    remove_reliable(_reliable_base);
+  }
+
+  acked.for_each_selective([this](SequenceNumber sn) {
+      remove_reliable(sn);
+    });
+}
+
+//------------------------------------------------------------------------------
+inline void TransmitQueue::remove_reliable(SequenceNumber sn) {
+  if (sn < _reliable_base) return;
+  if (sn - _reliable_base >= _reliable.size()) return;
+
+  auto& i = _reliable[sn - _reliable_base];
+
+  if (i != no_index) {
+    remove(i);
+    i = no_index;
+  }
+
+  while (!_reliable.empty() && _reliable.front() == no_index) {
+    _reliable.pop_front();
+    ++_reliable_base;
+  }
+}
+
+//------------------------------------------------------------------------------
+// The entry's index stays reserved until it is popped from _ready
+// or _in_flight.
+inline void TransmitQueue::remove(Index i) {
+  auto& e = _entries[i];
+  assert(e);
+  _bytes_in -= e->message.payload_size();
+  --_size;
+  --_stats[size_t(e->priority)].depth;
+
+  if (e->key) {
+    _keyed.erase(*e->key);
+  }
+
+  e = boost::none;
+}
+
+//------------------------------------------------------------------------------
+inline bool TransmitQueue::pop_tombstone(RingBuffer<Index>& queue) {
+  auto i = queue.front();
+  if (_entries[i]) return false;
+  queue.pop_front();
+  _free_entries.push_back(i);
+  return true;
 }
 
 //------------------------------------------------------------------------------
@@ -113,13 +399,9 @@ inline
 bool
 TransmitQueue::try_encode(binary::encoder& encoder, Entry& entry) const {
 
-  auto minimal_encoded_size
-      = OutMessage::header_size
-      // We'd want to send at least one byte of the payload,
-      // otherwise what's the point.
-      + std::min<size_t>(1, entry.message.payload_size()) ;
-
-  if (minimal_encoded_size > encoder.remaining_size()) {
+  // We'd want to send at least one byte of the payload,
+  // otherwise what's the point.
+  if (entry.message.min_encoded_size() > encoder.remaining_size()) {
     return false;
   }
 
@@ -135,4 +417,3 @@ TransmitQueue::try_encode(binary::encoder& encoder, Entry& entry) const {
 }}
 
 #endif // ifndef CLUB_TRANSMIT_QUEUE_H
-
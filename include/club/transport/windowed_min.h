@@ -0,0 +1,104 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_WINDOWED_MIN_H
+#define CLUB_TRANSPORT_WINDOWED_MIN_H
+
+#include <array>
+#include <chrono>
+#include <boost/optional.hpp>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Minimum of the values seen during the last N intervals (the current,
+// partially elapsed one included). Each interval keeps its own minimum
+// and the oldest one is forgotten when a new interval starts, so the
+// result follows increases of the underlying value (e.g. after a route
+// change) within N intervals. LEDBAT's base delay history (RFC 6817,
+// section 2.4.2) works the same way.
+template<class T, size_t N>
+class WindowedMin {
+  using clock = std::chrono::steady_clock;
+
+public:
+  explicit WindowedMin(clock::duration interval) : _interval(interval) {}
+
+  void update(T value, clock::time_point now);
+
+  boost::optional<T> get() const;
+
+  clock::duration window() const { return N * _interval; }
+
+private:
+  void roll_over(clock::time_point now);
+
+private:
+  const clock::duration _interval;
+
+  // Ring of per-interval minima, _intervals[_current] is the current one.
+  std::array<boost::optional<T>, N> _intervals;
+  size_t _current = 0;
+  boost::optional<clock::time_point> _current_start;
+};
+
+//------------------------------------------------------------------------------
+// Implementation
+//------------------------------------------------------------------------------
+template<class T, size_t N>
+inline void WindowedMin<T, N>::update(T value, clock::time_point now) {
+  roll_over(now);
+
+  auto& m = _intervals[_current];
+
+  if (!m || value < *m) {
+    m = value;
+  }
+}
+
+//------------------------------------------------------------------------------
+template<class T, size_t N>
+inline boost::optional<T> WindowedMin<T, N>::get() const {
+  boost::optional<T> ret;
+
+  for (auto& m : _intervals) {
+    if (m && (!ret || *m < *ret)) ret = m;
+  }
+
+  return ret;
+}
+
+//------------------------------------------------------------------------------
+template<class T, size_t N>
+inline void WindowedMin<T, N>::roll_over(clock::time_point now) {
+  if (!_current_start) {
+    _current_start = now;
+    return;
+  }
+
+  // No need to roll more than N times, everything is forgotten by then.
+  for (size_t i = 0; i < N && now - *_current_start >= _interval; ++i) {
+    _current = (_current + 1) % N;
+    _intervals[_current] = boost::none;
+    *_current_start += _interval;
+  }
+
+  if (now - *_current_start >= _interval) {
+    _current_start = now;
+  }
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_WINDOWED_MIN_H
@@ -0,0 +1,134 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_TRANSPORT_WIRE_FORMAT_H
+#define CLUB_TRANSPORT_WIRE_FORMAT_H
+
+#include <boost/optional.hpp>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+#include <binary/varint.h>
+
+namespace club { namespace transport {
+
+//------------------------------------------------------------------------------
+// Packet layout:
+//
+//   uint32_t connection id     Read by club::Multiplexer, so it stays fixed.
+//   uint8_t  version << 4 | flags
+//   varint   send time         Microseconds since the sender started.
+//   varint   zigzag(delay)     If has_delay, see QualityOfService.
+//   acks                       If has_acks, see QualityOfService.
+//   packet number              If has_payload, see encode_packet_number.
+//   varint   message count     If has_payload.
+//   messages                   See OutMessage.
+//
+// Packets of the previous (fixed size) format had the top byte of a 64-bit
+// timestamp, always zero, where the version is now.
+namespace wire {
+
+static constexpr uint8_t version = 1;
+
+enum flags : uint8_t {
+  has_delay   = 1 << 0,
+  has_acks    = 1 << 1,
+  has_payload = 1 << 2,
+};
+
+inline uint8_t version_and_flags(uint8_t flags) {
+  return uint8_t(version << 4) | flags;
+}
+
+} // wire namespace
+
+//------------------------------------------------------------------------------
+// Packet sequence numbers are sent truncated to their lowest 6, 14 or 22
+// bits (or in full), whichever lets the receiver restore them given the
+// largest sequence number it has received, which is at least the largest
+// one it has acked (as in QUIC, RFC 9000 section 17.1). The top two bits
+// of the first byte tell the length.
+inline size_t packet_number_size( uint32_t sequence_number
+                                , boost::optional<uint32_t> largest_acked) {
+  if (!largest_acked) return 5;
+
+  uint64_t range = 2 * uint64_t(uint32_t(sequence_number - *largest_acked));
+
+  if (range < (uint64_t(1) << 6))  return 1;
+  if (range < (uint64_t(1) << 14)) return 2;
+  if (range < (uint64_t(1) << 22)) return 3;
+  return 5;
+}
+
+//------------------------------------------------------------------------------
+inline void encode_packet_number( binary::encoder& e
+                                , uint32_t sequence_number
+                                , boost::optional<uint32_t> largest_acked) {
+  auto sn = sequence_number;
+
+  switch (packet_number_size(sn, largest_acked)) {
+    case 1:
+      e.put(uint8_t(sn & 0x3f));
+      break;
+    case 2:
+      e.put(uint8_t(0x40 | ((sn >> 8) & 0x3f)));
+      e.put(uint8_t(sn));
+      break;
+    case 3:
+      e.put(uint8_t(0x80 | ((sn >> 16) & 0x3f)));
+      e.put(uint8_t(sn >> 8));
+      e.put(uint8_t(sn));
+      break;
+    default:
+      e.put(uint8_t(0xc0));
+      e.put(sn);
+  }
+}
+
+//------------------------------------------------------------------------------
+inline uint32_t decode_packet_number( binary::decoder& d
+                                    , boost::optional<uint32_t> largest_received) {
+  auto first = d.get<uint8_t>();
+
+  uint64_t truncated = first & 0x3f;
+  unsigned bits;
+
+  switch (first >> 6) {
+    case 0: bits = 6; break;
+    case 1: bits = 14; truncated = truncated << 8 | d.get<uint8_t>(); break;
+    case 2: bits = 22; truncated = truncated << 8 | d.get<uint8_t>();
+                       truncated = truncated << 8 | d.get<uint8_t>(); break;
+    default: return d.get<uint32_t>();
+  }
+
+  // The candidate closest to the expected one. Computed in 64 bits, the
+  // result wraps around correctly when truncated to 32 bits.
+  uint64_t expected = largest_received ? uint64_t(*largest_received) + 1 : 0;
+  uint64_t window   = uint64_t(1) << bits;
+  uint64_t half     = window / 2;
+
+  uint64_t candidate = (expected & ~(window - 1)) | truncated;
+
+  if (candidate + half <= expected) {
+    candidate += window;
+  }
+  else if (candidate > expected + half && candidate >= window) {
+    candidate -= window;
+  }
+
+  return uint32_t(candidate);
+}
+
+}} // namespaces
+
+#endif // ifndef CLUB_TRANSPORT_WIRE_FORMAT_H
@@ -20,9 +20,12 @@
 #include "node.h"
 #include "binary/encoder.h"
 #include "binary/dynamic_encoder.h"
+#include "binary/varint.h"
+#include "binary/lz.h"
 #include "binary/serialize/uuid.h"
 #include "binary/serialize/list.h"
 #include "message.h"
+#include "message_view.h"
 #include "protocol_versions.h"
 #include "stun_client.h"
 #include <chrono>
@@ -84,6 +87,57 @@ shared_ptr<vector<uint8_t>> encode_message(const LogMessage& msg) {
               , [](const UserData& m)       { return encode_message(m); });
 }
 
+// -----------------------------------------------------------------------------
+// A compressed message starts with a byte which isn't a MessageType,
+// followed by the size of the original message (a varint) and the
+// original message compressed with binary::lz.
+static const uint8_t COMPRESSED_MESSAGE = 0xff;
+
+// Bits of the features byte exchanged in hub::fuse.
+static const uint8_t COMPRESSION_FEATURE = 1 << 0;
+
+// Returns nullptr if compression doesn't make the message any smaller.
+static
+shared_ptr<vector<uint8_t>> compress_message(const vector<uint8_t>& data) {
+  using binary::varint;
+
+  auto ret = make_shared<vector<uint8_t>>
+      ( 1 + varint<uint32_t>::max_size
+      + binary::lz::max_compressed_size(data.size()));
+
+  binary::encoder e(ret->data(), ret->size());
+  e.put(COMPRESSED_MESSAGE);
+  e.put(varint<uint32_t>(data.size()));
+
+  auto size = binary::lz::compress( data.data()
+                                  , data.size()
+                                  , ret->data() + e.written()
+                                  , ret->size() - e.written());
+
+  if (size == 0 || e.written() + size >= data.size()) {
+    return nullptr;
+  }
+
+  ret->resize(e.written() + size);
+  return ret;
+}
+
+// Returns false if the compressed message is malformed.
+static bool decompress_message( boost::asio::const_buffer buffer
+                              , vector<uint8_t>& out) {
+  binary::decoder d( boost::asio::buffer_cast<const uint8_t*>(buffer)
+                   , boost::asio::buffer_size(buffer));
+
+  d.get<uint8_t>(); // COMPRESSED_MESSAGE
+  auto size = d.get<binary::varint<uint32_t>>().value;
+
+  if (d.error() || size > MAX_DATAGRAM_SIZE) return false;
+
+  out.resize(size);
+
+  return binary::lz::decompress(d.current(), d.size(), out.data(), size);
+}
+
 // -----------------------------------------------------------------------------
 static Graph<uuid> single_node_graph(const uuid& id) {
   Graph<uuid> g;
@@ -182,11 +236,16 @@ void hub::fuse(Socket&& xsocket, const OnFused& on_fused) {
 
   auto socket = make_shared<Socket>(move(xsocket));
 
-  static const size_t buffer_size = sizeof(NET_PROTOCOL_VERSION) + sizeof(_id);
+  static const size_t buffer_size = sizeof(NET_PROTOCOL_VERSION)
+                                  + sizeof(_id)
+                                  + sizeof(uint8_t);
+
+  uint8_t features = _compress_min_size ? COMPRESSION_FEATURE : 0;
 
   binary::dynamic_encoder<uint8_t> e(buffer_size);
   e.put(NET_PROTOCOL_VERSION);
   e.put(_id);
+  e.put(features);
 
   auto was_destroyed = _was_destroyed;
 
@@ -209,6 +268,8 @@ void hub::fuse(Socket&& xsocket, const OnFused& on_fused) {
 
         auto his_protocol_version = d.get<decltype(NET_PROTOCOL_VERSION)>();
         auto his_id               = d.get<uuid>();
+        // Nodes which don't know about features don't send them.
+        auto his_features         = d.size() ? d.get<uint8_t>() : uint8_t(0);
 
         if (d.error()) {
           return fusion_failed(connection_refused, "invalid data");
@@ -235,6 +296,9 @@ void hub::fuse(Socket&& xsocket, const OnFused& on_fused) {
           n = &insert_node(his_id, move(socket));
         }
 
+        n->compress = _compress_min_size
+                   && (his_features & COMPRESSION_FEATURE);
+
         auto fuse_msg = construct_ackable<Fuse>(his_id);
         broadcast(fuse_msg);
         add_log_entry(move(fuse_msg));
@@ -397,7 +461,9 @@ void hub::on_commit_fuse(LogEntry entry) {
 }
 
 // -----------------------------------------------------------------------------
-template<class Message> void hub::on_recv(Node& IF_USE_LOG(proxy), Message msg) {
+template<class View> void hub::on_recv(Node& IF_USE_LOG(proxy), View view) {
+  using Message = decltype(materialize(std::move(view)));
+
 #if USE_LOG
 # define ON_RECV_LOG(...) \
    if (true || Message::type() == port_offer) { \
@@ -407,18 +473,22 @@ template<class Message> void hub::on_recv(Node& IF_USE_LOG(proxy), Message msg)
 # define ON_RECV_LOG(...) do {} while(0)
 #endif // if USE_LOG
 
+  //LOG_("Received ", view);
+  //debug("received: ", view);
+  if (_seen->is_in(message_id(view))) {
+    ON_RECV_LOG(view, " (ignored: already seen ", message_id(view), ")");
+    return;
+  }
+
+  // Each message arrives from every neighbor, only the first copy is
+  // worth taking out of the receive buffer.
+  Message msg = materialize(std::move(view));
+
   msg.header.visited.insert(_id);
 
   auto op_id = original_poster(msg);
   auto op = find_node(op_id);
 
-  //LOG_("Received ", msg);
-  //debug("received: ", msg);
-  if (_seen->is_in(message_id(msg))) {
-    ON_RECV_LOG(msg, " (ignored: already seen ", message_id(msg), ")");
-    return;
-  }
-
   _seen->insert(message_id(msg));
 
   _time_stamp = std::max(_time_stamp, msg.header.time_stamp);
@@ -450,17 +520,30 @@ template<class Message> void hub::on_recv(Node& IF_USE_LOG(proxy), Message msg)
 // -----------------------------------------------------------------------------
 template<class Message>
 void hub::parse_message(Node& proxy, binary::decoder& decoder) {
-  auto msg = decoder.get<Message>();
+  auto msg = decoder.get<typename Decoded<Message>::type>();
   if (decoder.error()) return;
   ASSERT(!msg.header.visited.empty());
-  on_recv<Message>(proxy, move(msg));
-  ASSERT(msg.header.visited.empty());
+  on_recv(proxy, move(msg));
 }
 
 // -----------------------------------------------------------------------------
 void hub::on_recv_raw(Node& proxy, boost::asio::const_buffer& buffer) {
-  binary::decoder decoder( boost::asio::buffer_cast<const uint8_t*>(buffer)
-                         , boost::asio::buffer_size(buffer));
+  using boost::asio::buffer_cast;
+  using boost::asio::buffer_size;
+
+  auto data = buffer;
+  vector<uint8_t> decompressed;
+
+  if (buffer_size(data) && *buffer_cast<const uint8_t*>(data) == COMPRESSED_MESSAGE) {
+    if (!decompress_message(data, decompressed)) {
+      ASSERT(0 && "Error decompressing message");
+      return proxy.disconnect();
+    }
+    data = boost::asio::buffer(decompressed);
+  }
+
+  binary::decoder decoder( buffer_cast<const uint8_t*>(data)
+                         , buffer_size(data));
 
   auto msg_type = decoder.get<MessageType>();
 
@@ -684,6 +767,10 @@ template<class Message> void hub::broadcast(const Message& msg) {
 
   auto data = encode_message(msg);
 
+  // Compressed lazily, only if there is someone to send it to.
+  shared_ptr<vector<uint8_t>> compressed;
+  bool compression_tried = false;
+
   for (auto& node : _nodes | map_values | indirected) {
     if (node.id == _id) continue;
     if (!node.is_connected()) {
@@ -700,39 +787,57 @@ template<class Message> void hub::broadcast(const Message& msg) {
     ASSERT(original_poster(msg) != node.id &&
            "Why are we sending the message back?");
 
+    if (node.compress && data->size() >= *_compress_min_size) {
+      if (!compression_tried) {
+        compressed = compress_message(*data);
+        compression_tried = true;
+      }
+
+      if (compressed) {
+        node.send(compressed);
+        continue;
+      }
+    }
+
     node.send(data);
   }
 }
 
 // -----------------------------------------------------------------------------
 void hub::unreliable_broadcast(Bytes payload, std::function<void()> handler) {
-  using std::make_pair;
-  using boost::asio::const_buffer;
-
-  // Encoding std::vector adds 4 bytes for size.
-  auto bytes   = make_shared<Bytes>(uuid::static_size() + payload.size() + 4);
-  auto counter = make_shared<size_t>(0);
+  // The message is our id followed by the payload encoded as std::vector
+  // (4 bytes for size followed by the data). Only the small prefix is
+  // encoded here, the payload is shared by all the nodes.
+  std::vector<uint8_t> prefix(uuid::static_size() + 4);
 
-  // TODO: Unfortunately, ConnectedSocket doesn't support sending multiple
-  // buffers at once (yet?), so we need to *copy* the payload into one buffer.
-  binary::encoder e(reinterpret_cast<uint8_t*>(bytes->data()), bytes->size());
+  binary::encoder e(prefix.data(), prefix.size());
   e.put(_id);
-  e.put(payload);
+  e.put<uint32_t>(payload.size());
   ASSERT(!e.error());
 
+  struct Pending {
+    size_t                counter = 0;
+    std::function<void()> handler;
+  };
+
+  auto shared_payload = make_shared<const Bytes>(move(payload));
+  auto pending        = make_shared<Pending>();
+
+  pending->handler = move(handler);
+
   for (auto& node : _nodes | map_values | indirected) {
     if (node.id == _id || !node.is_connected()) continue;
-    ++(*counter);
-
-    const_buffer b(bytes->data(), bytes->size());
+    ++pending->counter;
 
-    node.send_unreliable(b, [counter, bytes, handler](auto /* error */) {
-        if (--(*counter) == 0) handler();
+    // Only the shared state is captured so that the handler is not
+    // copied for each node.
+    node.send_unreliable(prefix, shared_payload, [pending](auto) {
+        if (--pending->counter == 0) pending->handler();
       });
   }
 
-  if (*counter == 0) {
-    get_io_service().post(move(handler));
+  if (pending->counter == 0) {
+    get_io_service().post(move(pending->handler));
   }
 }
 
@@ -752,7 +857,7 @@ void hub::node_received_unreliable_broadcast(boost::asio::const_buffer buffer) {
     return;
   }
 
-  auto shared_bytes = make_shared<Bytes>(start, start + size);
+  auto shared_bytes = make_shared<const Bytes>(start, start + size);
 
   // Rebroadcast
   for (const auto& id : _broadcast_routing_table->get_targets(source)) {
@@ -760,9 +865,7 @@ void hub::node_received_unreliable_broadcast(boost::asio::const_buffer buffer) {
 
     if (!node || !node->is_connected()) continue;
 
-    node->send_unreliable( const_buffer( shared_bytes->data()
-                                       , shared_bytes->size() )
-                         , [shared_bytes](auto /* error */) {});
+    node->send_unreliable({}, shared_bytes, [](auto /* error */) {});
   }
 
   _callbacks->on_receive_unreliable( source
@@ -983,6 +1086,11 @@ void hub::on_direct_connect(OnDirectConnect f) {
   _callbacks->_on_direct_connect.reset(std::move(f));
 }
 
+// -----------------------------------------------------------------------------
+void hub::enable_compression(size_t min_size) {
+  _compress_min_size = min_size;
+}
+
 // -----------------------------------------------------------------------------
 template<class T>
 inline
@@ -0,0 +1,208 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CLUB_MESSAGE_VIEW_H
+#define CLUB_MESSAGE_VIEW_H
+
+#include <cstring>
+#include <boost/asio/buffer.hpp>
+#include "message.h"
+
+// Hub messages decoded without copying: the user data and the uuid sets
+// point into the buffer they were decoded from, so a view must not
+// outlive it (the receive buffer is only valid during the socket's
+// receive callback). A message that has to be kept, e.g. in the Log, is
+// turned into its owning counterpart with `materialize`.
+namespace club {
+
+//------------------------------------------------------------------------------
+class UuidSetView {
+public:
+  UuidSetView() : _data(nullptr), _size(0) {}
+
+  size_t size()  const { return _size; }
+  bool   empty() const { return _size == 0; }
+
+  uuid operator[](size_t i) const {
+    uuid id;
+    std::memcpy(id.data, _data + i * uuid::static_size(), uuid::static_size());
+    return id;
+  }
+
+  size_t count(const uuid& id) const {
+    size_t n = 0;
+    for (size_t i = 0; i < _size; ++i) {
+      if (std::memcmp(_data + i * uuid::static_size()
+                     , id.data
+                     , uuid::static_size()) == 0) ++n;
+    }
+    return n;
+  }
+
+  friend void decode(binary::decoder&, UuidSetView&, size_t max_size);
+
+private:
+  const uint8_t* _data;
+  size_t         _size;
+};
+
+inline void decode(binary::decoder& d, UuidSetView& set, size_t max_size) {
+  auto size = d.get<uint32_t>();
+
+  if (size > max_size || size_t(size) * uuid::static_size() > d.size()) {
+    return d.set_error();
+  }
+
+  set._data = d.current();
+  set._size = size;
+
+  d.skip(size * uuid::static_size());
+}
+
+inline boost::container::flat_set<uuid> materialize(const UuidSetView& view) {
+  boost::container::flat_set<uuid> set;
+  set.reserve(view.size());
+  // Sets are encoded in order, which makes the insertion O(1).
+  for (size_t i = 0; i < view.size(); ++i) set.insert(set.end(), view[i]);
+  return set;
+}
+
+//------------------------------------------------------------------------------
+struct HeaderView {
+  uuid        original_poster;
+  TimeStamp   time_stamp;
+  MessageId   config_id;
+  UuidSetView visited;
+};
+
+inline void decode(binary::decoder& d, HeaderView& msg) {
+  msg.original_poster = d.get<uuid>();
+  msg.time_stamp      = d.get<decltype(msg.time_stamp)>();
+  msg.config_id       = d.get<decltype(msg.config_id)>();
+  msg.visited         = d.get<UuidSetView>(MAX_NODE_COUNT);
+}
+
+inline Header materialize(const HeaderView& v) {
+  return Header{ v.original_poster
+               , v.time_stamp
+               , v.config_id
+               , materialize(v.visited) };
+}
+
+inline std::ostream& operator<<(std::ostream& os, const HeaderView& h) {
+  return os << "OP:" << h.original_poster << ":" << h.time_stamp
+            << " C:" << h.config_id;
+}
+
+//------------------------------------------------------------------------------
+struct AckDataView {
+  MessageId   acked_message_id;
+  MessageId   prev_message_id;
+  UuidSetView neighbors;
+};
+
+inline void decode(binary::decoder& d, AckDataView& msg) {
+  msg.acked_message_id = d.get<MessageId>();
+  msg.prev_message_id  = d.get<MessageId>();
+  msg.neighbors        = d.get<UuidSetView>(MAX_NODE_COUNT);
+}
+
+inline AckData materialize(const AckDataView& v) {
+  return AckData{ v.acked_message_id
+                , v.prev_message_id
+                , materialize(v.neighbors) };
+}
+
+//------------------------------------------------------------------------------
+struct UserDataView {
+  HeaderView                header;
+  AckDataView               ack_data;
+  boost::asio::const_buffer data;
+
+  static MessageType type() { return user_data; }
+};
+
+inline void decode(binary::decoder& d, UserDataView& msg) {
+  msg.header   = d.get<HeaderView>();
+  msg.ack_data = d.get<AckDataView>();
+
+  auto size = d.get<uint32_t>();
+
+  if (size > MAX_DATAGRAM_SIZE || size > d.size()) {
+    return d.set_error();
+  }
+
+  msg.data = boost::asio::const_buffer(d.current(), size);
+  d.skip(size);
+}
+
+inline UserData materialize(const UserDataView& v) {
+  auto data = boost::asio::buffer_cast<const char*>(v.data);
+
+  UserData msg;
+  msg.header   = materialize(v.header);
+  msg.ack_data = materialize(v.ack_data);
+  msg.data.assign(data, data + boost::asio::buffer_size(v.data));
+  return msg;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const UserDataView& msg) {
+  return os << "(UserData " << msg.header
+            << " |data| = " << boost::asio::buffer_size(msg.data)
+            << ")";
+}
+
+//------------------------------------------------------------------------------
+struct AckView {
+  HeaderView  header;
+  AckDataView ack_data;
+
+  static MessageType type() { return ack; }
+};
+
+inline void decode(binary::decoder& d, AckView& msg) {
+  msg.header   = d.get<HeaderView>();
+  msg.ack_data = d.get<AckDataView>();
+
+  if (!(msg.ack_data.prev_message_id < msg.ack_data.acked_message_id)) {
+    ASSERT(0);
+    d.set_error();
+  }
+}
+
+inline Ack materialize(const AckView& v) {
+  Ack msg;
+  msg.header   = materialize(v.header);
+  msg.ack_data = materialize(v.ack_data);
+  return msg;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const AckView& msg) {
+  return os << "(Ack " << msg.header
+            << " Of:" << msg.ack_data.acked_message_id
+            << " Prev:" << msg.ack_data.prev_message_id << ")";
+}
+
+//------------------------------------------------------------------------------
+// Messages which are decoded as views, the rest are decoded directly.
+template<class Message> struct Decoded           { using type = Message; };
+template<>              struct Decoded<UserData> { using type = UserDataView; };
+template<>              struct Decoded<Ack>      { using type = AckView; };
+
+inline Fuse      materialize(Fuse&& msg)      { return std::move(msg); }
+inline PortOffer materialize(PortOffer&& msg) { return std::move(msg); }
+
+} // club namespace
+
+#endif // ifndef CLUB_MESSAGE_VIEW_H
@@ -106,12 +106,11 @@ struct Node {
     connect();
   }
 
-  void send(std::shared_ptr<Bytes> data) {
+  void send(std::shared_ptr<const Bytes> data) {
     if (is(ConnectState::disconnected)) return;
-    // TODO: Socket should take asio::const_buffer as an argument
-    // and a callback to preserve it's lifetime
+    // The data is shared among all the nodes we broadcast to.
     auto state = _shared_state;
-    _shared_state->socket->send_reliable(*data, [=](auto error) {
+    _shared_state->socket->send_reliable(std::move(data), [=](auto error) {
         if (state->was_destroyed) return;
         if (error) {
           return this->on_socket_error("unreliable recv", error);
@@ -119,8 +118,11 @@ struct Node {
       });
   }
 
+  // Send `head` followed by `tail`, the `tail` is not copied.
   template<class Handler>
-  void send_unreliable(boost::asio::const_buffer b, Handler handler) {
+  void send_unreliable( Bytes                   head
+                      , transport::SharedBuffer tail
+                      , Handler                 handler) {
     if (!is(ConnectState::connected)) {
       return _shared_state->socket->get_io_service().post([handler]() {
           handler(boost::asio::error::broken_pipe);
@@ -129,12 +131,9 @@ struct Node {
 
     auto state = _shared_state;
 
-    // TODO: Don't copy data
-    auto begin = boost::asio::buffer_cast<const uint8_t*>(b);
-    std::vector<uint8_t> data( begin
-                             , begin + boost::asio::buffer_size(b));
-
-    _shared_state->socket->send_unreliable(std::move(data), [=](auto error) {
+    _shared_state->socket->send_unreliable( std::move(head)
+                                          , std::move(tail)
+                                          , [=](auto error) {
         if (state->was_destroyed) return;
         handler(error);
       });
@@ -290,6 +289,9 @@ public:
 
   std::map<uuid, Peer> peers;
 
+  // Both we and the node have enabled compression (see hub::fuse).
+  bool compress = false;
+
 private:
   ConnectState connect_state;
 
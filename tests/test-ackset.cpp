@@ -26,10 +26,11 @@ using std::endl;
 using club::str;
 
 //------------------------------------------------------------------------------
-vector<uint32_t> acks_to_vector(const AckSet& acks) {
+// Return the members of the set in [begin, end).
+vector<uint32_t> members(const AckSet& acks, uint32_t begin, uint32_t end) {
   vector<uint32_t> ret;
-  for (auto s : acks) {
-    ret.push_back(s);
+  for (uint32_t i = begin; i != end; ++i) {
+    if (acks.is_in(i)) ret.push_back(i);
   }
   return ret;
 }
@@ -53,146 +54,186 @@ BOOST_AUTO_TEST_CASE(test_ack_set) {
 
   {
     AckSet acks;
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec());
+    BOOST_REQUIRE(acks.empty());
+    BOOST_REQUIRE_EQUAL(members(acks, 0, 100), Vec());
   }
 
   {
+    // Sequence numbers below the first one added are considered acked.
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(10));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({10}));
+    BOOST_REQUIRE_EQUAL(members(acks, 5, 100), vec(5, 11));
+    BOOST_REQUIRE_EQUAL(acks.cumulative(), 11);
   }
 
   {
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(10));
     BOOST_REQUIRE(acks.try_add(11));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({10, 11}));
+    BOOST_REQUIRE_EQUAL(members(acks, 10, 100), Vec({10, 11}));
   }
 
   {
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(10));
     BOOST_REQUIRE(acks.try_add(20));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({10, 20}));
-  }
+    BOOST_REQUIRE_EQUAL(members(acks, 10, 100), Vec({10, 20}));
 
-  {
-    AckSet acks;
-    BOOST_REQUIRE(acks.try_add(0));
-    BOOST_REQUIRE(acks.try_add(31));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({0, 31}));
-  }
+    // Filling the gap moves everything into the cumulative part.
+    for (uint32_t i = 11; i < 20; ++i) {
+      BOOST_REQUIRE(acks.try_add(i));
+    }
 
-  {
-    AckSet acks;
-    BOOST_REQUIRE(acks.try_add(0));
-    BOOST_REQUIRE(acks.try_add(32) == false);
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({0}));
+    BOOST_REQUIRE_EQUAL(members(acks, 10, 100), vec(10, 21));
+    BOOST_REQUIRE_EQUAL(acks.cumulative(), 21);
   }
 
   {
+    // The window is much wider than 32.
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(0));
-    BOOST_REQUIRE(acks.try_add(1));
     BOOST_REQUIRE(acks.try_add(32));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({1, 32}));
+    BOOST_REQUIRE(acks.try_add(1000));
+    BOOST_REQUIRE(acks.try_add(AckSet::max_window + 1));
+    BOOST_REQUIRE(acks.try_add(AckSet::max_window + 2) == false);
+    BOOST_REQUIRE(acks.can_add(AckSet::max_window + 2) == false);
+    BOOST_REQUIRE_EQUAL( members(acks, 0, AckSet::max_window + 10)
+                       , Vec({0, 32, 1000, AckSet::max_window + 1}));
   }
 
   {
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(0));
-    BOOST_REQUIRE(acks.try_add(1));
-    BOOST_REQUIRE(acks.try_add(32));
-    BOOST_REQUIRE(acks.try_add(2));
-    BOOST_REQUIRE(acks.try_add(33));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({2, 32, 33}));
-  }
 
-  {
-    AckSet acks;
-    BOOST_REQUIRE(acks.try_add(10));
-    BOOST_REQUIRE(acks.try_add(11));
-    BOOST_REQUIRE(acks.try_add(11+31));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({11, 11+31}));
+    for (uint32_t i = 2; i < 2000; i += 2) {
+      BOOST_REQUIRE(acks.try_add(i));
+    }
+
+    for (uint32_t i = 0; i < 2000; ++i) {
+      BOOST_REQUIRE_EQUAL(acks.is_in(i), i % 2 == 0);
+    }
+
+    Vec selective;
+    acks.for_each_selective([&](uint32_t sn) { selective.push_back(sn); });
+    BOOST_REQUIRE_EQUAL(selective.size(), 999);
+    BOOST_REQUIRE_EQUAL(selective.front(), 2);
+    BOOST_REQUIRE_EQUAL(selective.back(), 1998);
+
+    BOOST_REQUIRE(acks.try_add(1));
+    BOOST_REQUIRE_EQUAL(acks.cumulative(), 3);
   }
 
   {
-    AckSet acks;
+    for (int i = 0; i < 32; ++i) {
+      AckSet acks;
+      BOOST_REQUIRE(acks.try_add(0));
 
-    for (auto i = 0; i < 32; ++i) {
-      BOOST_REQUIRE(acks.try_add(i));
-    }
+      for (int j = 100; j < 300; ++j) {
+        if (j != 100 + i) BOOST_REQUIRE(acks.try_add(j));
+      }
 
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), vec(0, 32));
+      for (int j = 1; j < 100; ++j) {
+        BOOST_REQUIRE(acks.try_add(j));
+      }
 
-    for (auto i = 0; i < 32; ++i) {
-      BOOST_REQUIRE(acks.try_add(i));
+      BOOST_REQUIRE_EQUAL(acks.cumulative(), 100 + i);
+      BOOST_REQUIRE_EQUAL(members(acks, 0, 400).size(), 299);
     }
+  }
+}
 
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), vec(0, 32));
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_ack_set_merge) {
+  using Vec = vector<uint32_t>;
 
-    for (auto i = 32; i < 64; ++i) {
-      BOOST_REQUIRE(acks.try_add(i));
-    }
+  {
+    AckSet acks1;
+    AckSet acks2;
 
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), vec(32, 64));
+    acks1.merge(acks2);
+    BOOST_REQUIRE(acks1.empty());
+
+    acks2.try_add(5);
+    acks1.merge(acks2);
+    BOOST_REQUIRE_EQUAL(members(acks1, 0, 100), vec(0, 6));
   }
 
   {
-    // Test the order.
-    AckSet acks;
-    acks.try_add(0);
-    acks.try_add(1);
-    acks.try_add(2);
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks), Vec({0,1,2}));
+    AckSet newer;
+    AckSet older;
+
+    for (uint32_t i = 0; i < 10; ++i) newer.try_add(i);
+    newer.try_add(20);
+
+    for (uint32_t i = 0; i < 5; ++i) older.try_add(i);
+    for (uint32_t i = 10; i < 16; ++i) older.try_add(i);
+
+    auto expected = vec(0, 16);
+    expected.push_back(20);
+
+    auto acks = newer;
+    acks.merge(older);
+    BOOST_REQUIRE_EQUAL(members(acks, 0, 100), expected);
+
+    acks = older;
+    acks.merge(newer);
+    BOOST_REQUIRE_EQUAL(members(acks, 0, 100), expected);
   }
 
   {
     AckSet acks1;
     AckSet acks2;
-    for (int i = 0; i <= 32; ++i) {
-      BOOST_REQUIRE(acks1.try_add(i));
-      BOOST_REQUIRE(acks2.try_add(i));
-    }
-    BOOST_REQUIRE(acks2.try_add(33));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks1), vec(1, 33));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks2), vec(2, 34));
 
-    for (auto n : acks2) {
-      BOOST_REQUIRE(acks1.try_add(n));
-    }
+    acks1.try_add(0);
+    acks1.try_add(2);
+    acks1.try_add(300);
+
+    acks2.try_add(0);
+    acks2.try_add(1);
+    acks2.try_add(200);
 
-    BOOST_REQUIRE_EQUAL(acks_to_vector(acks1), vec(2, 34));
+    acks1.merge(acks2);
+
+    BOOST_REQUIRE_EQUAL(acks1.cumulative(), 3);
+    BOOST_REQUIRE_EQUAL(members(acks1, 0, 1000), Vec({0, 1, 2, 200, 300}));
   }
 }
 
+//------------------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_ack_set_serialize) {
   using Vec = vector<uint32_t>;
 
   auto encode_decode = [](AckSet acks) {
-    vector<uint8_t> data(binary::encoded<AckSet>::size());
+    vector<uint8_t> data(acks.encoded_size());
     binary::encoder encoder(data);
     encoder.put(acks);
+    BOOST_REQUIRE(!encoder.error());
+    BOOST_REQUIRE_EQUAL(encoder.written(), data.size());
     binary::decoder decoder(data.data(), data.size());
-    return decoder.get<AckSet>();
+    auto ret = decoder.get<AckSet>();
+    BOOST_REQUIRE(!decoder.error());
+    return ret;
   };
 
   {
     AckSet acks;
-    BOOST_REQUIRE(acks_to_vector(encode_decode(acks)) == Vec());
+    BOOST_REQUIRE(encode_decode(acks).empty());
   }
 
   {
     AckSet acks;
     BOOST_REQUIRE(acks.try_add(10));
-    BOOST_REQUIRE(acks_to_vector(encode_decode(acks)) == Vec({10}));
+    BOOST_REQUIRE_EQUAL(members(encode_decode(acks), 0, 100), vec(0, 11));
   }
 
   {
+    // Without gaps only the cumulative sequence number is sent.
     AckSet acks;
-    BOOST_REQUIRE(acks.try_add(10));
-    BOOST_REQUIRE(acks.try_add(11));
-    BOOST_REQUIRE(acks_to_vector(encode_decode(acks)) == Vec({10, 11}));
+    for (uint32_t i = 0; i < 1000; ++i) {
+      BOOST_REQUIRE(acks.try_add(i));
+    }
+    BOOST_REQUIRE_EQUAL(acks.encoded_size(), 1 + binary::varint_size(1000));
+    BOOST_REQUIRE_EQUAL(members(encode_decode(acks), 0, 2000), vec(0, 1000));
   }
 
   {
@@ -200,7 +241,8 @@ BOOST_AUTO_TEST_CASE(test_ack_set_serialize) {
     BOOST_REQUIRE(acks.try_add(10));
     BOOST_REQUIRE(acks.try_add(11));
     BOOST_REQUIRE(acks.try_add(11+31));
-    BOOST_REQUIRE_EQUAL(acks_to_vector(encode_decode(acks)), Vec({11, 11+31}));
+    BOOST_REQUIRE(acks.try_add(3000));
+    BOOST_REQUIRE_EQUAL( members(encode_decode(acks), 10, 5000)
+                       , Vec({10, 11, 11+31, 3000}));
   }
 }
-
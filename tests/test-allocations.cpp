@@ -0,0 +1,144 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <boost/asio.hpp>
+#include <club/socket.h>
+#include "async_loop.h"
+#include "util/socket.h"
+
+//------------------------------------------------------------------------------
+// Counts the heap allocations made (by any thread) while `counting` is set.
+// Replacing the global operator affects the whole test binary, but only
+// the tests in this file turn the counting on.
+static std::atomic<bool>   counting(false);
+static std::atomic<size_t> allocation_count(0);
+
+void* operator new(size_t size) {
+  if (counting) ++allocation_count;
+
+  if (auto p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+using std::vector;
+using std::shared_ptr;
+using std::make_shared;
+using boost::system::error_code;
+using club::Socket;
+using SocketPtr = shared_ptr<Socket>;
+
+namespace asio = boost::asio;
+
+//------------------------------------------------------------------------------
+// Sends reliable messages from s1 to s2 one at a time. The first half of
+// them warms up the sockets (their queues, recycled memory,...), the
+// allocations are counted while the second half is sent and received.
+struct PingPong {
+  static constexpr size_t warm_up  = 1000;
+  static constexpr size_t measured = 1000;
+
+  SocketPtr s1, s2;
+  bool use_vectors;
+
+  club::transport::SharedBuffer shared_payload;
+  // Filled beforehand so that creating them isn't counted.
+  vector<vector<uint8_t>> payloads;
+
+  size_t received = 0;
+
+  explicit PingPong(bool use_vectors)
+    : use_vectors(use_vectors)
+    , shared_payload(make_shared<const vector<uint8_t>>(100, 7))
+  {
+    for (size_t i = 0; i < warm_up + measured; ++i) {
+      payloads.emplace_back(100, 7);
+    }
+  }
+
+  void send() {
+    auto on_send = [](const error_code& err) { BOOST_REQUIRE(!err); };
+
+    if (use_vectors) {
+      s1->send_reliable(std::move(payloads[received]), on_send);
+    }
+    else {
+      s1->send_reliable(shared_payload, on_send);
+    }
+  }
+
+  void receive() {
+    s2->receive_reliable([this](const error_code& err, asio::const_buffer b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(asio::buffer_size(b), size_t(100));
+        on_receive();
+      });
+  }
+
+  void on_receive() {
+    ++received;
+
+    if (received == warm_up) {
+      allocation_count = 0;
+      counting = true;
+    }
+
+    if (received == warm_up + measured) {
+      counting = false;
+      s1->close();
+      s2->close();
+      return;
+    }
+
+    receive();
+    send();
+  }
+};
+
+//------------------------------------------------------------------------------
+static size_t count_steady_state_allocations(bool use_vectors) {
+  asio::io_service ios;
+
+  PingPong pp(use_vectors);
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+      pp.s1 = std::move(s1);
+      pp.s2 = std::move(s2);
+      pp.receive();
+      pp.send();
+    });
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(pp.received, size_t(PingPong::warm_up + PingPong::measured));
+  return allocation_count;
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_allocations_reliable_shared_payload) {
+  BOOST_REQUIRE_EQUAL(count_steady_state_allocations(false), size_t(0));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_allocations_reliable_vector_payload) {
+  BOOST_REQUIRE_EQUAL(count_steady_state_allocations(true), size_t(0));
+}
@@ -0,0 +1,111 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <debug/ASSERT.h>
+#include <binary/encoder.h>
+#include <binary/decoder.h>
+#include <binary/dynamic_encoder.h>
+#include <binary/serialize/vector.h>
+#include <binary/serialize/flat_set.h>
+#include <binary/serialize/uuid.h>
+#include <boost/uuid/random_generator.hpp>
+
+using std::vector;
+using boost::uuids::uuid;
+using UuidSet = boost::container::flat_set<uuid>;
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_binary_integers) {
+  vector<uint8_t> buffer(22);
+
+  binary::encoder e(buffer);
+  e.put(uint16_t(0x0102));
+  e.put(uint32_t(0x03040506));
+  e.put(uint64_t(0x0708090a0b0c0d0e));
+  e.put(int64_t(-2));
+
+  BOOST_REQUIRE(!e.error());
+
+  // Big endian on the wire.
+  BOOST_REQUIRE_EQUAL(buffer[0], 0x01);
+  BOOST_REQUIRE_EQUAL(buffer[1], 0x02);
+  BOOST_REQUIRE_EQUAL(buffer[2], 0x03);
+  BOOST_REQUIRE_EQUAL(buffer[5], 0x06);
+  BOOST_REQUIRE_EQUAL(buffer[6], 0x07);
+  BOOST_REQUIRE_EQUAL(buffer[13], 0x0e);
+  BOOST_REQUIRE_EQUAL(buffer[21], 0xfe);
+
+  binary::decoder d(buffer);
+  BOOST_REQUIRE_EQUAL(d.get<uint16_t>(), 0x0102);
+  BOOST_REQUIRE_EQUAL(d.get<uint32_t>(), 0x03040506u);
+  BOOST_REQUIRE_EQUAL(d.get<uint64_t>(), 0x0708090a0b0c0d0eu);
+  BOOST_REQUIRE_EQUAL(d.get<int64_t>(), -2);
+  BOOST_REQUIRE(!d.error());
+  BOOST_REQUIRE(d.empty());
+
+  // Doesn't fit.
+  e.put(uint32_t(0));
+  BOOST_REQUIRE(e.error());
+  d.get<uint32_t>();
+  BOOST_REQUIRE(d.error());
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_binary_bulk_containers) {
+  vector<char> bytes(1000);
+  for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = char(i * 7);
+
+  UuidSet ids;
+  boost::uuids::random_generator gen;
+  for (int i = 0; i < 10; ++i) ids.insert(gen());
+
+  binary::dynamic_encoder<uint8_t> de;
+  de.put(bytes);
+  de.put(ids);
+
+  auto data = de.move_data();
+  BOOST_REQUIRE_EQUAL(data.size(), 4 + bytes.size() + 4 + ids.size() * 16);
+
+  // The fixed size encoder produces the same bytes.
+  vector<uint8_t> data2(data.size());
+  binary::encoder e(data2);
+  e.put(bytes);
+  e.put(ids);
+  BOOST_REQUIRE(!e.error());
+  BOOST_REQUIRE(data == data2);
+
+  binary::decoder d(data);
+  BOOST_REQUIRE(d.get<vector<char>>() == bytes);
+  BOOST_REQUIRE(d.get<UuidSet>() == ids);
+  BOOST_REQUIRE(!d.error());
+
+  // Truncated input is an error, not an over-read.
+  for (size_t size : { size_t(3), size_t(500), data.size() - 1 }) {
+    binary::decoder d(data.data(), size);
+    d.get<vector<char>>();
+    d.get<UuidSet>();
+    BOOST_REQUIRE(d.error());
+  }
+
+  // Sizes beyond max_size are rejected.
+  binary::decoder d2(data);
+  d2.get<vector<char>>(bytes.size() - 1);
+  BOOST_REQUIRE(d2.error());
+}
+
+//------------------------------------------------------------------------------
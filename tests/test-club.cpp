@@ -1376,3 +1376,49 @@ BOOST_AUTO_TEST_CASE(club_unreliable_broadcast) {
 }
 
 // -------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(club_compression) {
+  io_service ios;
+
+  vector<HubPtr> hubs = make_hubs(ios, 3);
+
+  // The last one sends and receives messages uncompressed.
+  hubs[0]->enable_compression(100);
+  hubs[1]->enable_compression(100);
+
+  // Compressible, big and small.
+  vector<vector<char>> messages;
+
+  {
+    std::string text;
+    while (text.size() < 20000) text += "club compresses hub messages; ";
+    messages.emplace_back(text.begin(), text.end());
+    messages.emplace_back(10, 'x');
+  }
+
+  fuse_n_hubs(ios, hubs, false, [&]() {
+      WhenAll when_all;
+
+      for (auto& hub : hubs) {
+        auto received_all = when_all.make_continuation();
+        auto received     = make_shared<size_t>(0);
+
+        hub->on_receive([&messages, received, received_all]
+                        (club::uuid, const vector<char>& data) {
+            BOOST_REQUIRE(data == messages[*received]);
+            if (++(*received) == messages.size()) received_all();
+          });
+      }
+
+      for (const auto& m : messages) {
+        hubs[0]->total_order_broadcast(m);
+      }
+
+      when_all.on_complete([&hubs]() {
+          for (auto& h : hubs) h.reset();
+        });
+    });
+
+  ios.run();
+}
+
+// -------------------------------------------------------------------
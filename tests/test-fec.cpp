@@ -0,0 +1,123 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <club/transport/fec.h>
+
+using std::vector;
+using namespace club::transport;
+
+//------------------------------------------------------------------------------
+// Return the payload of the parity message.
+static vector<uint8_t> parity_payload(FecEncoder& fec) {
+  auto parity = fec.take_parity();
+  BOOST_REQUIRE(parity);
+
+  vector<uint8_t> buffer(parity->encoded_size());
+  binary::encoder e(buffer);
+  e.put(*parity);
+  BOOST_REQUIRE(!e.error());
+
+  binary::decoder d(buffer);
+  auto m = d.get<InMessagePart>();
+  BOOST_REQUIRE(!d.error());
+  BOOST_REQUIRE_EQUAL(m.type, MessageType::fec);
+
+  auto p = boost::asio::buffer_cast<const uint8_t*>(m.payload);
+  return vector<uint8_t>(p, p + boost::asio::buffer_size(m.payload));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_fec) {
+  FecEncoder encoder;
+  FecDecoder decoder;
+
+  encoder.enable(true);
+
+  auto group_size = encoder.group_size();
+
+  // Differently sized payloads.
+  vector<vector<uint8_t>> payloads;
+
+  for (size_t i = 0; i < group_size; ++i) {
+    payloads.emplace_back(10 + i * 3, uint8_t(i + 1));
+  }
+
+  // No parity until the group is complete.
+  for (size_t i = 0; i < group_size; ++i) {
+    BOOST_REQUIRE(!encoder.take_parity());
+    encoder.add(100 + i, i, payloads[i].data(), payloads[i].size());
+  }
+
+  auto parity = parity_payload(encoder);
+
+  // The decoder ignores packets until it sees the first parity.
+  for (size_t i = 0; i < group_size; ++i) {
+    decoder.on_packet(100 + i, i, payloads[i].data(), payloads[i].size());
+  }
+
+  BOOST_REQUIRE(!decoder.on_parity(boost::asio::buffer(parity)));
+
+  // Second group, packet 5 gets lost.
+  for (size_t i = 0; i < group_size; ++i) {
+    auto sn = 200 + i;
+    encoder.add(sn, i, payloads[i].data(), payloads[i].size());
+    if (i == 5) continue;
+    decoder.on_packet(sn, i, payloads[i].data(), payloads[i].size());
+  }
+
+  auto rebuilt = decoder.on_parity(boost::asio::buffer(parity_payload(encoder)));
+  BOOST_REQUIRE(rebuilt);
+
+  binary::decoder d(*rebuilt);
+  BOOST_REQUIRE_EQUAL(d.get<uint16_t>(), 5);
+  BOOST_REQUIRE(vector<uint8_t>(d.current(), d.current() + d.size()) == payloads[5]);
+
+  // Two lost packets can't be rebuilt.
+  for (size_t i = 0; i < group_size; ++i) {
+    auto sn = 300 + i;
+    encoder.add(sn, i, payloads[i].data(), payloads[i].size());
+    if (i == 1 || i == 2) continue;
+    decoder.on_packet(sn, i, payloads[i].data(), payloads[i].size());
+  }
+
+  BOOST_REQUIRE(!decoder.on_parity(boost::asio::buffer(parity_payload(encoder))));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_fec_group_size) {
+  FecEncoder fec;
+
+  BOOST_REQUIRE_EQUAL(fec.group_size(), FecEncoder::MAX_GROUP_SIZE());
+
+  uint64_t acked = 0, lost = 0;
+
+  // 10% loss.
+  for (int i = 0; i < 20; ++i) {
+    acked += 90; lost += 10;
+    fec.on_packet_stats(acked, lost);
+  }
+
+  BOOST_REQUIRE_EQUAL(fec.group_size(), 5);
+
+  // Back to no loss.
+  for (int i = 0; i < 20; ++i) {
+    acked += 100;
+    fec.on_packet_stats(acked, lost);
+  }
+
+  BOOST_REQUIRE_EQUAL(fec.group_size(), FecEncoder::MAX_GROUP_SIZE());
+}
@@ -0,0 +1,113 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <club/generic/inline_function.h>
+#include <async/handler_memory.h>
+
+using std::make_shared;
+using Function = club::InlineFunction<int(int)>;
+
+// So that containers of them move rather than copy when they grow.
+static_assert(std::is_nothrow_move_constructible<Function>::value, "");
+static_assert(std::is_nothrow_move_assignable<Function>::value, "");
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_inline_function) {
+  auto counter = make_shared<int>(0);
+
+  auto small = [counter](int x) { return *counter += x; };
+  static_assert(Function::is_inline<decltype(small)>(), "");
+
+  Function f = std::move(small);
+  BOOST_REQUIRE(f);
+  BOOST_REQUIRE_EQUAL(f(2), 2);
+  BOOST_REQUIRE_EQUAL(counter.use_count(), 2);
+
+  Function g = std::move(f);
+  BOOST_REQUIRE(!f);
+  BOOST_REQUIRE_EQUAL(g(3), 5);
+  BOOST_REQUIRE_EQUAL(counter.use_count(), 2);
+
+  g = nullptr;
+  BOOST_REQUIRE(!g);
+  BOOST_REQUIRE_EQUAL(counter.use_count(), 1);
+
+  // Too big to be stored inline.
+  std::array<int, 64> array{};
+  auto big = [counter, array](int x) mutable { return array[0] += x; };
+  static_assert(!Function::is_inline<decltype(big)>(), "");
+
+  Function h = std::move(big);
+  BOOST_REQUIRE_EQUAL(h(1), 1);
+  BOOST_REQUIRE_EQUAL(h(1), 2);
+
+  f = std::move(h);
+  BOOST_REQUIRE(!h);
+  BOOST_REQUIRE_EQUAL(f(1), 3);
+
+  f = std::function<int(int)>();
+  BOOST_REQUIRE(!f);
+  BOOST_REQUIRE_EQUAL(counter.use_count(), 1);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_inline_function_replaces_itself) {
+  club::InlineFunction<void()> f;
+
+  auto counter = make_shared<int>(0);
+
+  f = [&f, counter]() {
+    f = [counter]() {};
+  };
+
+  // The socket moves handlers out before executing them, so that they
+  // may install a new one.
+  auto g = std::move(f);
+  g();
+
+  BOOST_REQUIRE(f);
+  BOOST_REQUIRE_EQUAL(counter.use_count(), 3);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_handler_memory) {
+  using async::handler_memory;
+
+  std::unique_ptr<handler_memory> m(new handler_memory());
+
+  void* p1 = m->allocate(64);
+  // The block is in use, this one comes from the heap.
+  void* p2 = m->allocate(64);
+
+  BOOST_REQUIRE(p1 != p2);
+
+  handler_memory::deallocate(p1);
+
+  // The block is reused.
+  void* p3 = m->allocate(64);
+  BOOST_REQUIRE_EQUAL(p1, p3);
+
+  // The block outlives the handler_memory while it's in use.
+  m.reset();
+  handler_memory::deallocate(p3);
+  handler_memory::deallocate(p2);
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,100 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+#include <binary/lz.h>
+
+using std::vector;
+
+//------------------------------------------------------------------------------
+static vector<uint8_t> roundtrip(const vector<uint8_t>& data) {
+  namespace lz = binary::lz;
+
+  vector<uint8_t> compressed(lz::max_compressed_size(data.size()));
+
+  auto size = lz::compress( data.data(), data.size()
+                          , compressed.data(), compressed.size());
+
+  BOOST_REQUIRE(size);
+  compressed.resize(size);
+
+  vector<uint8_t> decompressed(data.size());
+
+  BOOST_REQUIRE(lz::decompress( compressed.data(), compressed.size()
+                              , decompressed.data(), decompressed.size()));
+
+  BOOST_REQUIRE(decompressed == data);
+
+  return compressed;
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_lz_roundtrip) {
+  std::mt19937 rand(42);
+
+  roundtrip({});
+  roundtrip({1, 2, 3});
+
+  // Runs, including matches which overlap with what they copy.
+  BOOST_REQUIRE(roundtrip(vector<uint8_t>(10000, 7)).size() < 100);
+
+  // Incompressible.
+  vector<uint8_t> noise(5000);
+  for (auto& b : noise) b = rand();
+  BOOST_REQUIRE(roundtrip(noise).size() <= binary::lz::max_compressed_size(5000));
+
+  // Repetitive text with long literal runs and matches further back than
+  // the offset can reach.
+  vector<uint8_t> text;
+  for (size_t i = 0; text.size() < 200000; ++i) {
+    auto word = std::to_string(i * 7919 % 1000);
+    text.insert(text.end(), word.begin(), word.end());
+    text.push_back(' ');
+    if (i % 1000 == 0) text.insert(text.end(), noise.begin(), noise.end());
+  }
+  BOOST_REQUIRE(roundtrip(text).size() < text.size());
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_lz_malformed) {
+  namespace lz = binary::lz;
+
+  vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = i % 13;
+
+  auto compressed = roundtrip(data);
+
+  vector<uint8_t> out(data.size());
+
+  // Wrong size.
+  BOOST_REQUIRE(!lz::decompress( compressed.data(), compressed.size()
+                               , out.data(), out.size() - 1));
+
+  // Truncated.
+  for (size_t n = 0; n < compressed.size(); ++n) {
+    BOOST_REQUIRE(!lz::decompress(compressed.data(), n, out.data(), out.size()));
+  }
+
+  // Offset pointing before the start of the output.
+  vector<uint8_t> bad = { 0x10, 'a', 0x05, 0x00, 0x00 };
+  BOOST_REQUIRE(!lz::decompress(bad.data(), bad.size(), out.data(), 10));
+
+  // The output buffer is too small.
+  BOOST_REQUIRE(!lz::compress( data.data(), data.size()
+                             , out.data(), compressed.size() - 1));
+}
@@ -0,0 +1,107 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <debug/ASSERT.h>
+#include <binary/dynamic_encoder.h>
+#include <boost/uuid/random_generator.hpp>
+#include "message_view.h"
+
+using namespace club;
+using std::vector;
+
+namespace {
+  Header make_header(boost::uuids::random_generator& gen) {
+    Header h;
+    h.original_poster = gen();
+    h.time_stamp      = 42;
+    h.config_id       = MessageId(7, gen());
+    for (int i = 0; i < 3; ++i) h.visited.insert(gen());
+    return h;
+  }
+
+  template<class M> vector<uint8_t> encode_message(const M& msg) {
+    binary::dynamic_encoder<uint8_t> e;
+    e.put(msg);
+    return e.move_data();
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_message_view_user_data) {
+  boost::uuids::random_generator gen;
+
+  AckData ack_data{MessageId(2, gen()), MessageId(1, gen()), {gen(), gen()}};
+  UserData msg(make_header(gen), std::move(ack_data), vector<char>(100, 'x'));
+
+  auto bytes = encode_message(msg);
+
+  binary::decoder d(bytes);
+  auto view = d.get<UserDataView>();
+
+  BOOST_REQUIRE(!d.error());
+  BOOST_REQUIRE(d.empty());
+
+  // The data is not copied out of the buffer.
+  auto data = boost::asio::buffer_cast<const uint8_t*>(view.data);
+  BOOST_REQUIRE(data >  bytes.data());
+  BOOST_REQUIRE(data <  bytes.data() + bytes.size());
+  BOOST_REQUIRE_EQUAL(boost::asio::buffer_size(view.data), msg.data.size());
+
+  BOOST_REQUIRE(message_id(view) == message_id(msg));
+  BOOST_REQUIRE_EQUAL(view.header.visited.size(), 3);
+  BOOST_REQUIRE_EQUAL(view.header.visited.count(*msg.header.visited.begin()), 1);
+  BOOST_REQUIRE_EQUAL(view.header.visited.count(gen()), 0);
+
+  auto copy = materialize(view);
+
+  BOOST_REQUIRE(message_id(copy) == message_id(msg));
+  BOOST_REQUIRE(copy.header.config_id == msg.header.config_id);
+  BOOST_REQUIRE(copy.header.visited == msg.header.visited);
+  BOOST_REQUIRE(copy.ack_data.acked_message_id == msg.ack_data.acked_message_id);
+  BOOST_REQUIRE(copy.ack_data.prev_message_id == msg.ack_data.prev_message_id);
+  BOOST_REQUIRE(copy.ack_data.neighbors == msg.ack_data.neighbors);
+  BOOST_REQUIRE(copy.data == msg.data);
+
+  // Any truncation is detected.
+  for (size_t size = 0; size < bytes.size(); ++size) {
+    binary::decoder d(bytes.data(), size);
+    d.get<UserDataView>();
+    BOOST_REQUIRE(d.error());
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_message_view_ack) {
+  boost::uuids::random_generator gen;
+
+  Ack msg(make_header(gen), MessageId(2, gen()), MessageId(1, gen()), {gen()});
+
+  auto bytes = encode_message(msg);
+
+  binary::decoder d(bytes);
+  auto view = d.get<AckView>();
+
+  BOOST_REQUIRE(!d.error());
+  BOOST_REQUIRE(d.empty());
+
+  auto copy = materialize(view);
+
+  BOOST_REQUIRE(message_id(copy) == message_id(msg));
+  BOOST_REQUIRE(copy.header.visited == msg.header.visited);
+  BOOST_REQUIRE(copy.ack_data.acked_message_id == msg.ack_data.acked_message_id);
+  BOOST_REQUIRE(copy.ack_data.neighbors == msg.ack_data.neighbors);
+}
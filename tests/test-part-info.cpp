@@ -159,3 +159,20 @@ BOOST_AUTO_TEST_CASE(test_part_info) {
     BOOST_REQUIRE_EQUAL(parts_to_vector(pi), PartV({ {0, 1000} }));
   }
 }
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_part_info_contains) {
+  PartInfo pi;
+  BOOST_REQUIRE(!pi.contains(0, 1));
+
+  pi.add_part(2, 5);
+  pi.add_part(8, 10);
+
+  BOOST_REQUIRE(pi.contains(2, 5));
+  BOOST_REQUIRE(pi.contains(3, 4));
+  BOOST_REQUIRE(pi.contains(8, 10));
+  BOOST_REQUIRE(!pi.contains(0, 3));
+  BOOST_REQUIRE(!pi.contains(4, 6));
+  BOOST_REQUIRE(!pi.contains(5, 8));
+  BOOST_REQUIRE(!pi.contains(9, 11));
+}
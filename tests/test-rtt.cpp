@@ -0,0 +1,103 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <club/transport/rtt_estimator.h>
+#include <club/transport/windowed_min.h>
+
+using namespace club::transport;
+using namespace std::chrono;
+using clock_type = steady_clock;
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_rtt_estimator) {
+  RttEstimator e;
+
+  BOOST_REQUIRE(!e.has_sample());
+  BOOST_REQUIRE(e.rto() == seconds(1));
+
+  e.on_sample(milliseconds(100));
+
+  // SRTT = R, RTTVAR = R/2, RTO = SRTT + 4*RTTVAR
+  BOOST_REQUIRE(e.srtt() == milliseconds(100));
+  BOOST_REQUIRE(e.rttvar() == milliseconds(50));
+  BOOST_REQUIRE(e.rto() == milliseconds(300));
+
+  e.on_sample(milliseconds(200));
+
+  // RTTVAR = 3/4 * 50 + 1/4 * |100 - 200|
+  // SRTT   = 7/8 * 100 + 1/8 * 200
+  BOOST_REQUIRE(duration_cast<microseconds>(e.rttvar()).count() == 62500);
+  BOOST_REQUIRE(duration_cast<microseconds>(e.srtt()).count() == 112500);
+  BOOST_REQUIRE(duration_cast<microseconds>(e.rto()).count() == 362500);
+
+  // Stable samples converge to the RTT and the variation to zero, but
+  // the RTO stays above the minimum.
+  for (int i = 0; i < 200; ++i) e.on_sample(milliseconds(10));
+
+  BOOST_REQUIRE(duration_cast<milliseconds>(e.srtt()) == milliseconds(10));
+  BOOST_REQUIRE(e.rto() == RttEstimator::MIN_RTO());
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_rtt_estimator_backoff) {
+  RttEstimator e;
+
+  e.on_sample(milliseconds(100));
+  auto rto = e.rto();
+
+  e.on_timeout();
+  BOOST_REQUIRE(e.rto() == 2 * rto);
+  e.on_timeout();
+  BOOST_REQUIRE(e.rto() == 4 * rto);
+
+  for (int i = 0; i < 100; ++i) e.on_timeout();
+  BOOST_REQUIRE(e.rto() <= RttEstimator::MAX_RTO());
+
+  // A new sample collapses the backoff.
+  e.on_sample(milliseconds(100));
+  BOOST_REQUIRE(e.rto() < 2 * rto);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_windowed_min) {
+  WindowedMin<int, 3> m(seconds(1));
+
+  auto t = clock_type::now();
+
+  BOOST_REQUIRE(!m.get());
+
+  m.update(10, t);
+  m.update(20, t + milliseconds(500));
+  BOOST_REQUIRE_EQUAL(*m.get(), 10);
+
+  // The minimum is remembered for the length of the window...
+  m.update(30, t + milliseconds(1500));
+  m.update(40, t + milliseconds(2500));
+  BOOST_REQUIRE_EQUAL(*m.get(), 10);
+
+  // ...and forgotten afterwards, so increases are followed.
+  m.update(50, t + milliseconds(3500));
+  BOOST_REQUIRE_EQUAL(*m.get(), 30);
+
+  // Decreases are followed right away.
+  m.update(5, t + milliseconds(3600));
+  BOOST_REQUIRE_EQUAL(*m.get(), 5);
+
+  // A long pause forgets everything before it.
+  m.update(100, t + seconds(60));
+  BOOST_REQUIRE_EQUAL(*m.get(), 100);
+}
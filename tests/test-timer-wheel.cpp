@@ -0,0 +1,262 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <thread>
+#include <vector>
+#include <boost/asio/strand.hpp>
+#include <async/alarm.h>
+
+using std::vector;
+using std::unique_ptr;
+using namespace std::chrono;
+namespace asio = boost::asio;
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_order) {
+  asio::io_service ios;
+
+  vector<int> fired;
+
+  async::alarm a(ios, [&]() { fired.push_back(30); });
+  async::alarm b(ios, [&]() { fired.push_back(10); });
+  async::alarm c(ios, [&]() { fired.push_back(20); });
+  // Far enough to end up in a higher level of the wheel.
+  async::alarm d(ios, [&]() { fired.push_back(300); });
+
+  auto start = steady_clock::now();
+
+  d.start(milliseconds(300));
+  a.start(milliseconds(30));
+  b.start(milliseconds(10));
+  c.start(milliseconds(20));
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired.size(), 4);
+  BOOST_REQUIRE_EQUAL(fired[0], 10);
+  BOOST_REQUIRE_EQUAL(fired[1], 20);
+  BOOST_REQUIRE_EQUAL(fired[2], 30);
+  BOOST_REQUIRE_EQUAL(fired[3], 300);
+  BOOST_REQUIRE(steady_clock::now() - start >= milliseconds(300));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_stop_and_destroy) {
+  asio::io_service ios;
+
+  size_t fired = 0;
+
+  async::alarm a(ios, [&]() { ++fired; });
+  unique_ptr<async::alarm> b(new async::alarm(ios, [&]() { ++fired; }));
+  async::alarm c(ios, [&]() { ++fired; });
+
+  a.start(milliseconds(10));
+  b->start(milliseconds(10));
+  c.start(milliseconds(20));
+
+  a.stop();
+  b.reset();
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 1);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_stopped_alarms_dont_block) {
+  asio::io_service ios;
+
+  size_t fired = 0;
+
+  async::alarm a(ios, [&]() { ++fired; });
+  async::alarm b(ios, [&]() { ++fired; });
+
+  a.start(seconds(10));
+  b.start(milliseconds(10));
+  a.stop();
+
+  auto start = steady_clock::now();
+
+  // Neither the stopped alarm nor the one which already fired keep the
+  // io_service running.
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 1);
+  BOOST_REQUIRE(steady_clock::now() - start < seconds(1));
+
+  ios.reset();
+
+  a.start(seconds(10));
+  a.stop();
+
+  start = steady_clock::now();
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 1);
+  BOOST_REQUIRE(steady_clock::now() - start < seconds(1));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_lazy_restart) {
+  asio::io_service ios;
+
+  auto& wheel = asio::use_service<async::timer_wheel>(ios);
+
+  size_t fired = 0;
+  steady_clock::time_point fired_at;
+
+  async::alarm a(ios, [&]() { ++fired; fired_at = steady_clock::now(); });
+
+  a.start(milliseconds(20));
+
+  auto waits = wheel.wait_count();
+
+  // Pushing the deadline back doesn't touch the underlying timer.
+  steady_clock::time_point last_start;
+  for (int i = 0; i < 1000; ++i) {
+    last_start = steady_clock::now();
+    a.start(milliseconds(40));
+  }
+
+  BOOST_REQUIRE_EQUAL(wheel.wait_count(), waits);
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 1);
+  BOOST_REQUIRE(fired_at - last_start >= milliseconds(40));
+
+  // Bringing it forward does.
+  ios.reset();
+  fired = 0;
+
+  a.start(seconds(10));
+  a.start(milliseconds(5));
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 1);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_restart_from_handler) {
+  asio::io_service ios;
+
+  size_t fired = 0;
+  unique_ptr<async::alarm> a;
+
+  a.reset(new async::alarm(ios, [&]() {
+        if (++fired < 3) return a->start(milliseconds(1));
+        // Destroying the alarm from its own handler is fine.
+        a.reset();
+      }));
+
+  a->start(milliseconds(0));
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(fired, 3);
+  BOOST_REQUIRE(!a);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_lateness) {
+  asio::io_service ios;
+
+  // Deadlines spread over 60..140ms (with sub-tick offsets) so that some
+  // of them sit right before and after slot boundaries of the first two
+  // levels of the wheel.
+  const size_t count = 3200;
+
+  vector<unique_ptr<async::alarm>> alarms;
+  vector<steady_clock::time_point> deadlines(count);
+  vector<steady_clock::time_point> fired_at(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    alarms.emplace_back(new async::alarm(ios, [&fired_at, i]() {
+          fired_at[i] = steady_clock::now();
+        }));
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    auto d = milliseconds(60) + microseconds(25 * i);
+    deadlines[i] = steady_clock::now() + d;
+    alarms[i]->start(d);
+  }
+
+  ios.run();
+
+  steady_clock::duration max_lateness(0);
+
+  for (size_t i = 0; i < count; ++i) {
+    BOOST_REQUIRE(fired_at[i] >= deadlines[i]);
+    max_lateness = std::max(max_lateness, fired_at[i] - deadlines[i]);
+  }
+
+  // A late slot would show up as seconds.
+  BOOST_REQUIRE(max_lateness < milliseconds(100));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_timer_wheel_multiple_threads) {
+  asio::io_service ios;
+
+  // Two peers serializing their work through their own strands, like
+  // sockets do, while the io_service is run by several threads. Each
+  // peer keeps restarting and stopping a keepalive-like alarm and is
+  // driven by a second one.
+  struct Peer {
+    asio::io_service::strand strand;
+    async::alarm             keepalive;
+    async::alarm             tick;
+    size_t                   ticks = 0;
+
+    Peer(asio::io_service& ios)
+      : strand(ios)
+      , keepalive(ios, []() {})
+      , tick(ios, [this]() { strand.post([this]() { on_tick(); }); })
+    {}
+
+    void on_tick() {
+      if (++ticks == 200) return keepalive.stop();
+
+      for (int i = 0; i < 100; ++i) {
+        keepalive.start(milliseconds(20 + i % 7));
+        if (i % 10 == 0) keepalive.stop();
+      }
+
+      tick.start(milliseconds(1));
+    }
+  };
+
+  Peer p1(ios), p2(ios);
+
+  p1.strand.post([&]() { p1.tick.start(milliseconds(0)); });
+  p2.strand.post([&]() { p2.tick.start(milliseconds(0)); });
+
+  vector<std::thread> threads;
+
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&ios]() { ios.run(); });
+  }
+
+  for (auto& t : threads) t.join();
+
+  BOOST_REQUIRE_EQUAL(p1.ticks, 200);
+  BOOST_REQUIRE_EQUAL(p2.ticks, 200);
+}
+
+//------------------------------------------------------------------------------
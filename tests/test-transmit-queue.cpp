@@ -18,6 +18,9 @@
 #include <club/debug/string_tools.h>
 #include <iostream>
 #include <club/generic/cyclic_queue.h>
+#include <club/transport/transmit_queue.h>
+#include <club/transport/in_message_part.h>
+#include <binary/decoder.h>
 
 using std::cout;
 using std::endl;
@@ -188,3 +191,241 @@ BOOST_AUTO_TEST_CASE(test_transmit_queue) {
     BOOST_REQUIRE(result == std::vector<int>({0,2,4}));
   }
 }
+
+BOOST_AUTO_TEST_CASE(test_transmit_queue_acks) {
+  using namespace club::transport;
+  using namespace std::chrono_literals;
+
+  TransmitQueue tq;
+
+  for (SequenceNumber sn = 0; sn < 3; ++sn) {
+    tq.insert(OutMessage(true, MessageType::reliable, sn, std::vector<uint8_t>(10)));
+  }
+
+  tq.insert(OutMessage(false, MessageType::unreliable, 1, std::vector<uint8_t>(10)));
+
+  BOOST_REQUIRE_EQUAL(tq.size(), 4);
+  BOOST_REQUIRE_EQUAL(tq.size_in_bytes(), 40);
+
+  std::vector<uint8_t> buffer(1000);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 4);
+  }
+
+  // The unreliable message is sent only once.
+  BOOST_REQUIRE_EQUAL(tq.size(), 3);
+
+  // Reliable ones are not resent before the threshold.
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 0);
+  }
+
+  // But are once it has passed.
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 0s), 3);
+  }
+
+  AckSet acks;
+  acks.try_add(0);
+  acks.try_add(1);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, acks, 0s), 1);
+  }
+
+  BOOST_REQUIRE_EQUAL(tq.size(), 1);
+  BOOST_REQUIRE_EQUAL(tq.size_in_bytes(), 10);
+
+  acks.try_add(2);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, acks, 0s), 0);
+  }
+
+  BOOST_REQUIRE(tq.empty());
+  BOOST_REQUIRE_EQUAL(tq.size_in_bytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_transmit_queue_priority) {
+  using namespace club::transport;
+  using namespace std::chrono_literals;
+
+  TransmitQueue tq;
+
+  OutMessage normal(true, MessageType::reliable, 1, std::vector<uint8_t>(100));
+  OutMessage keep_alive(false, MessageType::keep_alive, 0, std::vector<uint8_t>());
+
+  // Room for the keep alive and the normal message only.
+  std::vector<uint8_t> buffer(normal.encoded_size() + keep_alive.encoded_size());
+
+  tq.insert( OutMessage(true, MessageType::reliable, 0, std::vector<uint8_t>(100))
+           , Priority::low);
+
+  tq.insert(std::move(normal), Priority::normal);
+  tq.insert(std::move(keep_alive), Priority::high);
+
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::low).depth,    1);
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::normal).depth, 1);
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::high).depth,   1);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 2);
+  }
+
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::high).depth,   0);
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::high).sent,    1);
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::normal).sent,  1);
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::low).sent,     0);
+
+  {
+    binary::decoder d(buffer);
+    BOOST_REQUIRE_EQUAL(d.get<InMessagePart>().type, MessageType::keep_alive);
+  }
+
+  OutMessage higher(true, MessageType::reliable, 2, std::vector<uint8_t>(40));
+
+  // A higher class message preempts the rest of a partially sent one.
+  std::vector<uint8_t> small_buffer(higher.encoded_size());
+
+  {
+    binary::encoder e(small_buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 1);
+  }
+
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::low).sent, 1);
+
+  tq.insert(std::move(higher), Priority::normal);
+
+  {
+    binary::encoder e(small_buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 1);
+  }
+
+  {
+    binary::decoder d(small_buffer);
+    BOOST_REQUIRE_EQUAL(d.get<InMessagePart>().sequence_number, 2);
+  }
+
+  BOOST_REQUIRE_EQUAL(tq.stats(Priority::normal).depth, 2);
+  BOOST_REQUIRE(tq.stats(Priority::normal).max_wait
+                  <= tq.stats(Priority::normal).total_wait);
+}
+
+BOOST_AUTO_TEST_CASE(test_transmit_queue_keyed) {
+  using namespace club::transport;
+  using namespace std::chrono_literals;
+
+  TransmitQueue tq;
+
+  auto value = [](uint8_t v, size_t size) {
+    return std::vector<uint8_t>(size, v);
+  };
+
+  tq.insert(7, OutMessage(false, MessageType::unreliable, 0, value(0, 10)));
+
+  // Unsent, so replaced in place and keeps its sequence number.
+  BOOST_REQUIRE(tq.reset_payload(7, value(1, 20), OutMessage::SharedPayload()));
+  BOOST_REQUIRE(!tq.reset_payload(8, value(1, 20), OutMessage::SharedPayload()));
+
+  BOOST_REQUIRE_EQUAL(tq.size(), 1);
+  BOOST_REQUIRE_EQUAL(tq.size_in_bytes(), 20);
+
+  // Only a part of it fits.
+  std::vector<uint8_t> buffer(OutMessage::max_header_size + 5);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 1);
+  }
+
+  {
+    binary::decoder d(buffer);
+    auto m = d.get<InMessagePart>();
+    BOOST_REQUIRE(!d.error());
+    BOOST_REQUIRE_EQUAL(m.type, MessageType::unreliable);
+    BOOST_REQUIRE_EQUAL(m.sequence_number, 0);
+    BOOST_REQUIRE_EQUAL(m.original_size, 20);
+  }
+
+  // Partially sent ones can't be changed, they are dropped instead.
+  auto head = value(2, 10);
+  BOOST_REQUIRE(!tq.reset_payload(7, std::move(head), OutMessage::SharedPayload()));
+  BOOST_REQUIRE_EQUAL(head.size(), 10);
+  BOOST_REQUIRE(tq.empty());
+
+  tq.insert(7, OutMessage(false, MessageType::unreliable, 1, value(2, 10)));
+  tq.insert(7, OutMessage(false, MessageType::unreliable, 2, value(3, 10)));
+
+  BOOST_REQUIRE_EQUAL(tq.size(), 1);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, AckSet(), 1h), 1);
+  }
+
+  {
+    binary::decoder d(buffer);
+    BOOST_REQUIRE_EQUAL(d.get<InMessagePart>().sequence_number, 2);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_transmit_queue_fast_retransmit) {
+  using namespace club::transport;
+  using namespace std::chrono_literals;
+  using clock = std::chrono::steady_clock;
+
+  TransmitQueue tq;
+
+  std::vector<uint8_t> buffer(1000);
+
+  auto encode = [&](clock::time_point lost_before) {
+    binary::encoder e(buffer);
+    return tq.encode_payload(e, AckSet(), 1h, lost_before);
+  };
+
+  tq.insert(OutMessage(true, MessageType::reliable, 0, std::vector<uint8_t>(10)));
+  BOOST_REQUIRE_EQUAL(encode(clock::time_point::min()), 1);
+
+  auto first_sent = clock::now();
+
+  tq.insert(OutMessage(true, MessageType::reliable, 1, std::vector<uint8_t>(10)));
+  BOOST_REQUIRE_EQUAL(encode(clock::time_point::min()), 1);
+
+  // Only the message sent before the loss is resent, without waiting
+  // for the threshold.
+  BOOST_REQUIRE_EQUAL(encode(first_sent), 1);
+
+  {
+    binary::decoder d(buffer);
+    BOOST_REQUIRE_EQUAL(d.get<InMessagePart>().sequence_number, 0);
+  }
+
+  BOOST_REQUIRE_EQUAL(encode(first_sent), 0);
+
+  // Tail loss probe resends the most recently sent one.
+  BOOST_REQUIRE(tq.retransmit_last());
+  BOOST_REQUIRE_EQUAL(encode(clock::time_point::min()), 1);
+
+  {
+    binary::decoder d(buffer);
+    BOOST_REQUIRE_EQUAL(d.get<InMessagePart>().sequence_number, 0);
+  }
+
+  AckSet acks;
+  acks.try_add(0);
+  acks.try_add(1);
+
+  {
+    binary::encoder e(buffer);
+    BOOST_REQUIRE_EQUAL(tq.encode_payload(e, acks, 1h), 0);
+  }
+
+  BOOST_REQUIRE(!tq.retransmit_last());
+}
@@ -15,10 +15,13 @@
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 
+#include <future>
 #include <boost/asio.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/functional/hash.hpp>
 #include <club/socket.h>
+#include <club/sharded_multiplexer.h>
+#include <binary/dynamic_encoder.h>
 #include <club/debug/string_tools.h>
 #include "when_all.h"
 #include "async_loop.h"
@@ -142,6 +145,51 @@ BOOST_AUTO_TEST_CASE(test_transport_unreliable_one_big_message) {
   BOOST_REQUIRE_EQUAL(counter, 2);
 }
 
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_unreliable_gathered_message) {
+  asio::io_service ios;
+
+  vector<uint8_t> head{1, 2, 3, 4, 5};
+  auto tail = make_shared<vector<uint8_t>>(3*Socket::packet_size);
+
+  for (size_t i = 0; i < tail->size(); i++) {
+    (*tail)[i] = i;
+  }
+
+  auto expected = head;
+  expected.insert(expected.end(), tail->begin(), tail->end());
+
+  int counter = 0;
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+      WhenAll when_all;
+
+      s2->receive_unreliable(when_all.make_continuation([&](auto c, auto err, auto b) {
+        ++counter;
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), expected);
+        c();
+      }));
+
+      auto on_flush = when_all.make_continuation();
+
+      s1->send_unreliable(head, tail, [=](auto err) {
+          BOOST_REQUIRE(!err);
+          s1->flush(on_flush);
+        });
+
+      when_all.on_complete([&, s1, s2]() {
+          ++counter;
+          s1->close();
+          s2->close();
+        });
+    });
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(counter, 2);
+}
+
 //------------------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_transport_unreliable_two_messages) {
   asio::io_service ios;
@@ -412,6 +460,59 @@ BOOST_AUTO_TEST_CASE(test_transport_reliable_two_messages) {
   BOOST_REQUIRE_EQUAL(test_count, 3);
 }
 
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_shared_payload) {
+  asio::io_service ios;
+
+  int test_count = 0;
+
+  vector<uint8_t> message(3*Socket::packet_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  auto shared = make_shared<const vector<uint8_t>>(message);
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    s2->receive_reliable([&, when_all_recv, s2](auto err, auto b) {
+      ++test_count;
+      BOOST_REQUIRE(!err);
+      BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+
+      s2->receive_reliable([&, s2, when_all_recv](auto err, auto b) {
+        ++test_count;
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        s2->flush(when_all_recv);
+      });
+    });
+
+    auto on_flush = when_all.make_continuation();
+
+    // Both messages reference the same bytes.
+    s1->send_reliable(shared, [](auto err) { BOOST_REQUIRE(!err); });
+    s1->send_reliable(shared, [](auto err) { BOOST_REQUIRE(!err); });
+    s1->flush(on_flush);
+
+    when_all.on_complete([s1, s2, &test_count, &shared]() {
+        ++test_count;
+        // Acknowledged messages no longer reference the payload.
+        BOOST_REQUIRE_EQUAL(shared.use_count(), 1);
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(test_count, 3);
+}
+
 //------------------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_transport_reliable_big_messages) {
   asio::io_service ios;
@@ -468,6 +569,209 @@ BOOST_AUTO_TEST_CASE(test_transport_reliable_big_messages) {
   BOOST_REQUIRE_EQUAL(test_count, N + 2);
 }
 
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_max_message_size) {
+  asio::io_service ios;
+
+  vector<uint8_t> message(Socket::max_reliable_message_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  int test_count = 0;
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    s2->receive_reliable([&, when_all_recv, s2](auto err, auto b) {
+      ++test_count;
+      BOOST_REQUIRE(!err);
+      BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+      s2->flush(when_all_recv);
+    });
+
+    auto on_refused = when_all.make_continuation();
+
+    // One byte too many is refused without anything being sent.
+    auto too_big = message;
+    too_big.push_back(0);
+
+    s1->send_reliable(std::move(too_big), [&, on_refused](auto err) {
+        ++test_count;
+        BOOST_REQUIRE_EQUAL(err, asio::error::message_size);
+        on_refused();
+      });
+
+    auto on_flush = when_all.make_continuation();
+
+    s1->send_reliable(message, [=](auto err) {
+        BOOST_REQUIRE(!err);
+        s1->flush(on_flush);
+      });
+
+    when_all.on_complete([s1, s2, &test_count]() {
+        ++test_count;
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, 3);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_stream) {
+  asio::io_service ios;
+
+  // Bigger than what fits into a single message.
+  auto data = make_shared<vector<uint8_t>>(1000*1000);
+
+  for (size_t i = 0; i < data->size(); ++i) {
+    (*data)[i] = i * 7;
+  }
+
+  int test_count = 0;
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+    WhenAll when_all;
+
+    auto on_flush = when_all.make_continuation();
+
+    // First from a source, then from memory with a regular reliable
+    // message in between.
+    auto read = make_shared<size_t>(0);
+    s1->send_stream([read, data](uint8_t* buf, size_t max) {
+          auto n = std::min(max, data->size() - *read);
+          std::copy_n(data->data() + *read, n, buf);
+          *read += n;
+          return n;
+        },
+        [](auto err) { BOOST_REQUIRE(!err); });
+
+    s1->send_reliable(vector<uint8_t>{1, 2, 3}, [](auto err) {
+        BOOST_REQUIRE(!err);
+      });
+
+    s1->send_stream(club::transport::SharedBuffer(data), [=](auto err) {
+        BOOST_REQUIRE(!err);
+        s1->flush(on_flush);
+      });
+
+    auto on_received = when_all.make_continuation();
+
+    auto received = make_shared<vector<uint8_t>>();
+
+    auto receive_stream = [=, &test_count](auto cont) {
+      received->clear();
+      async_loop([=, &test_count](auto, auto next) {
+          s2->receive_stream([=, &test_count](auto err, auto b, bool is_last) {
+              BOOST_REQUIRE(!err);
+              auto part = buf_to_vector(b);
+              received->insert(received->end(), part.begin(), part.end());
+              if (!is_last) return next();
+              ++test_count;
+              BOOST_REQUIRE(*received == *data);
+              cont();
+            });
+        });
+    };
+
+    receive_stream([=, &test_count]() {
+        s2->receive_reliable([=, &test_count](auto err, auto b) {
+            BOOST_REQUIRE(!err);
+            BOOST_REQUIRE_EQUAL(buf_to_vector(b), (vector<uint8_t>{1, 2, 3}));
+            ++test_count;
+            receive_stream(on_received);
+          });
+      });
+
+    when_all.on_complete([s1, s2]() {
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, 3);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_channels) {
+  asio::io_service ios;
+
+  auto data = make_shared<vector<uint8_t>>(1000*1000);
+
+  for (size_t i = 0; i < data->size(); ++i) {
+    (*data)[i] = i * 7;
+  }
+
+  int test_count = 0;
+
+  make_connected_sockets(ios, [&](SocketPtr s1, SocketPtr s2) {
+    WhenAll when_all;
+
+    auto on_flush = when_all.make_continuation();
+
+    s1->send_stream(1, club::transport::SharedBuffer(data), [](auto err) {
+        BOOST_REQUIRE(!err);
+      });
+
+    s1->send_reliable(2, vector<uint8_t>{1, 2, 3}, [](auto err) {
+        BOOST_REQUIRE(!err);
+      });
+
+    s1->send_reliable(2, vector<uint8_t>{4, 5, 6}, [=](auto err) {
+        BOOST_REQUIRE(!err);
+        s1->flush(on_flush);
+      });
+
+    auto on_received = when_all.make_continuation();
+
+    auto received = make_shared<vector<uint8_t>>();
+
+    auto receive_stream = [=, &test_count]() {
+      async_loop([=, &test_count](auto, auto next) {
+          s2->receive_stream(1, [=, &test_count](auto err, auto b, bool is_last) {
+              BOOST_REQUIRE(!err);
+              auto part = buf_to_vector(b);
+              received->insert(received->end(), part.begin(), part.end());
+              if (!is_last) return next();
+              ++test_count;
+              BOOST_REQUIRE(*received == *data);
+              on_received();
+            });
+        });
+    };
+
+    // Nobody reads channel 1 until both messages from channel 2 are
+    // received, so a single ordering would never get to them.
+    s2->receive_reliable(2, [=, &test_count](auto err, auto b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), (vector<uint8_t>{1, 2, 3}));
+        ++test_count;
+
+        s2->receive_reliable(2, [=, &test_count](auto err, auto b) {
+            BOOST_REQUIRE(!err);
+            BOOST_REQUIRE_EQUAL(buf_to_vector(b), (vector<uint8_t>{4, 5, 6}));
+            ++test_count;
+            receive_stream();
+          });
+      });
+
+    when_all.on_complete([s1, s2]() {
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, 3);
+}
+
 //------------------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_transport_reliable_two_messages_causal) {
   asio::io_service ios;
@@ -579,6 +883,664 @@ BOOST_AUTO_TEST_CASE(test_transport_unreliable_and_reliable) {
   BOOST_REQUIRE(diff < milliseconds(50));
 }
 
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_batched_io) {
+  asio::io_service ios;
+
+  size_t N = 64;
+
+  int test_count = 0;
+
+  vector<uint8_t> message(2*Socket::packet_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  make_connected_sockets(ios, [&test_count, N, &message](SocketPtr s1, SocketPtr s2) {
+    s1->io_batch_size(16);
+    s2->io_batch_size(16);
+
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    async_loop([&test_count, s2, N, &message, when_all_recv](auto i, auto cont) {
+      ++test_count;
+      if (i == N) {
+        return s2->flush(when_all_recv);
+      }
+
+      s2->receive_reliable([&, cont, s2](auto err, auto b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        cont();
+      });
+    });
+
+    auto on_flush = when_all.make_continuation();
+
+    async_loop([=](auto i, auto cont) {
+        if (i == N) {
+          return s1->flush(on_flush);
+        }
+
+        s1->send_reliable(message, [=](auto err) {
+            BOOST_REQUIRE(!err);
+            cont();
+          });
+      });
+
+    when_all.on_complete([s1, s2, &test_count]() {
+        ++test_count;
+
+        auto c1 = s1->io_counters();
+        auto c2 = s2->io_counters();
+
+        BOOST_REQUIRE(c1.tx_syscalls <= c1.tx_packets);
+        BOOST_REQUIRE(c2.rx_syscalls <= 2 * c2.rx_packets);
+        BOOST_REQUIRE(c2.rx_packets > 0);
+
+        auto st1 = s1->stats();
+        auto st2 = s2->stats();
+
+        BOOST_REQUIRE_EQUAL(st1.packets_sent, c1.tx_packets);
+        BOOST_REQUIRE_EQUAL(st2.bytes_received, c2.rx_bytes);
+        BOOST_REQUIRE_EQUAL(st1.transmit_queue_size, 0u);
+        BOOST_REQUIRE_EQUAL(st1.transmit_queue_bytes, 0u);
+        BOOST_REQUIRE_EQUAL(st2.pending_reassembly_bytes, 0u);
+        BOOST_REQUIRE(st1.min_rtt);
+        BOOST_REQUIRE(*st1.min_rtt <= st1.srtt + st1.rto);
+        BOOST_REQUIRE(st1.cwnd > 0);
+
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, N + 2);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_congestion_control) {
+  using club::transport::CongestionControl;
+
+  for (auto cc : { CongestionControl::ledbat
+                 , CongestionControl::cubic
+                 , CongestionControl::bbr }) {
+    asio::io_service ios;
+
+    size_t N = 64;
+
+    int test_count = 0;
+
+    vector<uint8_t> message(2*Socket::packet_size);
+
+    for (size_t i = 0; i < message.size(); ++i) {
+      message[i] = i;
+    }
+
+    make_connected_sockets(ios, [&test_count, N, &message, cc](SocketPtr s1, SocketPtr s2) {
+      s1->congestion_control(cc);
+      s2->congestion_control(cc);
+
+      WhenAll when_all;
+
+      auto when_all_recv = when_all.make_continuation();
+
+      async_loop([&test_count, s2, N, &message, when_all_recv](auto i, auto cont) {
+        ++test_count;
+        if (i == N) {
+          return s2->flush(when_all_recv);
+        }
+
+        s2->receive_reliable([&, cont, s2](auto err, auto b) {
+          BOOST_REQUIRE(!err);
+          BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+          cont();
+        });
+      });
+
+      auto on_flush = when_all.make_continuation();
+
+      async_loop([=](auto i, auto cont) {
+          if (i == N) {
+            return s1->flush(on_flush);
+          }
+
+          s1->send_reliable(message, [=](auto err) {
+              BOOST_REQUIRE(!err);
+              cont();
+            });
+        });
+
+      when_all.on_complete([s1, s2, &test_count]() {
+          ++test_count;
+          BOOST_REQUIRE(s1->congestion_controller().cwnd() > 0);
+          s1->close();
+          s2->close();
+        });
+    });
+
+    ios.run();
+    BOOST_REQUIRE_EQUAL(test_count, N + 2);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_reliable_paced) {
+  asio::io_service ios;
+
+  size_t N = 64;
+
+  int test_count = 0;
+
+  vector<uint8_t> message(2*Socket::packet_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  make_connected_sockets(ios, [&test_count, N, &message](SocketPtr s1, SocketPtr s2) {
+    s1->pacing(true);
+    s2->pacing(true);
+
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    async_loop([&test_count, s2, N, &message, when_all_recv](auto i, auto cont) {
+      ++test_count;
+      if (i == N) {
+        return s2->flush(when_all_recv);
+      }
+
+      s2->receive_reliable([&, cont, s2](auto err, auto b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        cont();
+      });
+    });
+
+    auto on_flush = when_all.make_continuation();
+
+    async_loop([=](auto i, auto cont) {
+        if (i == N) {
+          return s1->flush(on_flush);
+        }
+
+        s1->send_reliable(message, [=](auto err) {
+            BOOST_REQUIRE(!err);
+            cont();
+          });
+      });
+
+    when_all.on_complete([s1, s2, &test_count]() {
+        ++test_count;
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, N + 2);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_fec) {
+  asio::io_service ios;
+
+  size_t N = 64;
+
+  int test_count = 0;
+
+  vector<uint8_t> message(2*Socket::packet_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  make_connected_sockets(ios, [&test_count, N, &message](SocketPtr s1, SocketPtr s2) {
+    s1->fec(true);
+
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    async_loop([&test_count, s2, N, &message, when_all_recv](auto i, auto cont) {
+      ++test_count;
+      if (i == N) {
+        return s2->flush(when_all_recv);
+      }
+
+      s2->receive_reliable([&, cont, s2](auto err, auto b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        cont();
+      });
+    });
+
+    auto on_flush = when_all.make_continuation();
+
+    async_loop([=](auto i, auto cont) {
+        if (i == N) {
+          return s1->flush(on_flush);
+        }
+
+        s1->send_reliable(message, [=](auto err) {
+            BOOST_REQUIRE(!err);
+            cont();
+          });
+      });
+
+    when_all.on_complete([s1, s2, &test_count]() {
+        ++test_count;
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, N + 2);
+}
+
+//------------------------------------------------------------------------------
+#if CLUB_HAS_PMTUDISC_PROBE
+BOOST_AUTO_TEST_CASE(test_transport_path_mtu_discovery) {
+  asio::io_service ios;
+
+  size_t N = 64;
+
+  int test_count = 0;
+
+  vector<uint8_t> message(4*Socket::packet_size);
+
+  make_connected_sockets(ios, [&test_count, N, &message](SocketPtr s1, SocketPtr s2) {
+    WhenAll when_all;
+
+    auto when_all_recv = when_all.make_continuation();
+
+    async_loop([&test_count, s2, N, &message, when_all_recv](auto i, auto cont) {
+      ++test_count;
+      if (i == N) {
+        return s2->flush(when_all_recv);
+      }
+
+      s2->receive_reliable([&, cont, s2](auto err, auto b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        cont();
+      });
+    });
+
+    auto on_flush = when_all.make_continuation();
+
+    async_loop([=](auto i, auto cont) {
+        if (i == N) {
+          return s1->flush(on_flush);
+        }
+
+        s1->send_reliable(message, [=](auto err) {
+            BOOST_REQUIRE(!err);
+            cont();
+          });
+      });
+
+    when_all.on_complete([s1, s2, &test_count]() {
+        ++test_count;
+        // Loopback MTU is far above the default packet size.
+        BOOST_REQUIRE_GT(s1->path_mtu(), size_t(Socket::packet_size));
+        s1->close();
+        s2->close();
+      });
+  });
+
+  ios.run();
+  BOOST_REQUIRE_EQUAL(test_count, N + 2);
+}
+#endif
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_multiplexed) {
+  using club::Multiplexer;
+
+  asio::io_service ios;
+
+  const size_t N = 4;
+
+  auto m1 = make_shared<Multiplexer>(ios);
+  auto m2 = make_shared<Multiplexer>(ios);
+
+  vector<SocketPtr> s1s, s2s;
+
+  for (size_t i = 0; i < N; ++i) {
+    s1s.push_back(make_shared<Socket>(m1));
+    s2s.push_back(make_shared<Socket>(m2));
+  }
+
+  // One more connection to a socket which owns its UDP port.
+  s1s.push_back(make_shared<Socket>(m1));
+  s2s.push_back(make_shared<Socket>(ios));
+
+  BOOST_REQUIRE_EQUAL(s2s.back()->connection_id(), club::transport::no_connection_id);
+
+  size_t received = 0;
+
+  WhenAll when_all;
+
+  for (size_t i = 0; i < s1s.size(); ++i) {
+    auto s1 = s1s[i];
+    auto s2 = s2s[i];
+
+    auto on_done = when_all.make_continuation();
+
+    auto receive = [&received, on_done, i](SocketPtr s) {
+      s->receive_reliable([&received, on_done, i, s](auto err, auto b) {
+          BOOST_REQUIRE(!err);
+          BOOST_REQUIRE_EQUAL(buf_to_vector(b), vector<uint8_t>{uint8_t(i)});
+          if (++received % 2 == 0) on_done();
+        });
+    };
+
+    receive(s1);
+    receive(s2);
+
+    auto on_connect = [i](SocketPtr s) {
+      return [i, s](error_code err) {
+        BOOST_REQUIRE(!err);
+        s->send_reliable(vector<uint8_t>{uint8_t(i)}, [](error_code) {});
+      };
+    };
+
+    // All the connections go between the same two UDP endpoints,
+    // so the sockets need to know each other's connection id.
+    auto id1 = s1->connection_id();
+    auto id2 = s2->connection_id();
+
+    s1->rendezvous_connect(s2->local_endpoint(), id2, on_connect(s1));
+    s2->rendezvous_connect(s1->local_endpoint(), id1, on_connect(s2));
+  }
+
+  BOOST_REQUIRE_EQUAL(m1->size(), N + 1);
+  BOOST_REQUIRE_EQUAL(m2->size(), N);
+
+  when_all.on_complete([&]() {
+      for (auto& s : s1s) s->close();
+      for (auto& s : s2s) s->close();
+
+      BOOST_REQUIRE_EQUAL(m1->size(), 0);
+      BOOST_REQUIRE_EQUAL(m2->size(), 0);
+    });
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(received, 2 * s1s.size());
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_multiplexed_stats) {
+  using club::Multiplexer;
+  using club::transport::SocketStats;
+  using namespace std::chrono;
+
+  asio::io_service ios;
+
+  auto m1 = make_shared<Multiplexer>(ios);
+  auto m2 = make_shared<Multiplexer>(ios);
+
+  auto s1 = make_shared<Socket>(m1);
+  auto s2 = make_shared<Socket>(m2);
+
+  // Keep keepalives out of the measured interval.
+  s1->keepalive_period(seconds(10));
+  s2->keepalive_period(seconds(10));
+
+  vector<uint8_t> message(3 * Socket::packet_size);
+
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] = i;
+  }
+
+  asio::steady_timer timer(ios);
+
+  // Execute `f` once whatever is in flight has been received.
+  auto when_quiet = [&timer](std::function<void()> f) {
+    timer.expires_from_now(milliseconds(100));
+    timer.async_wait([f](error_code) { f(); });
+  };
+
+  size_t test_count = 0;
+  SocketStats before1, before2;
+
+  auto check = [&]() {
+    ++test_count;
+
+    auto after1 = s1->stats();
+    auto after2 = s2->stats();
+
+    auto sent1     = after1.bytes_sent     - before1.bytes_sent;
+    auto sent2     = after2.bytes_sent     - before2.bytes_sent;
+    auto received1 = after1.bytes_received - before1.bytes_received;
+    auto received2 = after2.bytes_received - before2.bytes_received;
+
+    // The multiplexers receive into buffers bigger than any packet, only
+    // what was actually received counts.
+    BOOST_REQUIRE(sent1 >= message.size());
+    BOOST_REQUIRE_EQUAL(received2, sent1);
+    BOOST_REQUIRE_EQUAL(received1, sent2);
+    BOOST_REQUIRE_EQUAL( after2.packets_received - before2.packets_received
+                       , after1.packets_sent     - before1.packets_sent);
+
+    s1->close();
+    s2->close();
+  };
+
+  auto measure = [&]() {
+    before1 = s1->stats();
+    before2 = s2->stats();
+
+    WhenAll done([&]() { when_quiet(check); });
+
+    auto on_recv = done.make_continuation();
+
+    s2->receive_reliable([&message, on_recv](error_code err, const_buffer b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL(buf_to_vector(b), message);
+        on_recv();
+      });
+
+    s1->send_reliable(message, [](error_code err) { BOOST_REQUIRE(!err); });
+    s1->flush(done.make_continuation());
+  };
+
+  // Let the handshake settle before the first snapshot.
+  WhenAll connected([&]() { when_quiet(measure); });
+
+  auto on_connect = [&connected]() {
+    auto c = connected.make_continuation();
+    return [c](error_code err) { BOOST_REQUIRE(!err); c(); };
+  };
+
+  auto id1 = s1->connection_id();
+  auto id2 = s2->connection_id();
+
+  s1->rendezvous_connect(s2->local_endpoint(), id2, on_connect());
+  s2->rendezvous_connect(s1->local_endpoint(), id1, on_connect());
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(test_count, 1);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_sharded) {
+  using club::Multiplexer;
+  using club::ShardedMultiplexer;
+  using ConnectionId = club::transport::ConnectionId;
+
+  asio::io_service ios;
+
+  const size_t N = 8;
+
+  ShardedMultiplexer server(3);
+
+  // Touched only from within the strand of the shard they belong to.
+  vector<vector<SocketPtr>> server_sockets(server.size());
+
+  // All client connections come from one endpoint so the kernel delivers
+  // them to one server shard, the others get their packets passed over.
+  auto client_multiplexer = make_shared<Multiplexer>(ios);
+
+  vector<SocketPtr> clients;
+  size_t received = 0;
+
+  for (size_t i = 0; i < N; ++i) {
+    auto client = make_shared<Socket>(client_multiplexer);
+    clients.push_back(client);
+
+    auto client_id = client->connection_id();
+    auto client_ep = client->local_endpoint();
+    auto shard     = i % server.size();
+
+    std::promise<ConnectionId> server_id;
+
+    server.post(shard, [&, shard, client_id, client_ep]
+                       (std::shared_ptr<Multiplexer> m) {
+        auto s = make_shared<Socket>(m);
+        server_sockets[shard].push_back(s);
+
+        s->rendezvous_connect(client_ep, client_id, [](error_code) {});
+
+        // Checked by the client, Boost.Test isn't used from other threads.
+        s->receive_reliable([s](error_code err, const_buffer b) {
+            if (err) return;
+            auto v = buf_to_vector(b);
+            for (auto& byte : v) byte += 100;
+            s->send_reliable(std::move(v), [](error_code) {});
+          });
+
+        server_id.set_value(s->connection_id());
+      });
+
+    auto server_ep = udp::endpoint( asio::ip::address_v4::loopback()
+                                  , server.local_endpoint().port());
+
+    client->rendezvous_connect(server_ep, server_id.get_future().get(),
+        [client, i](error_code err) {
+          BOOST_REQUIRE(!err);
+          client->send_reliable(vector<uint8_t>{uint8_t(i)}, [](error_code) {});
+        });
+
+    client->receive_reliable([&, i](error_code err, const_buffer b) {
+        BOOST_REQUIRE(!err);
+        BOOST_REQUIRE_EQUAL( buf_to_vector(b)
+                           , vector<uint8_t>{uint8_t(i + 100)});
+
+        if (++received == N) {
+          for (auto& c : clients) c->close();
+          client_multiplexer->close();
+        }
+      });
+  }
+
+  ios.run();
+
+  BOOST_REQUIRE_EQUAL(received, N);
+
+  // Server sockets (and their alarms) belong to the shard threads, so
+  // make sure they are gone before leaving the scope.
+  vector<std::future<void>> closed;
+
+  for (size_t i = 0; i < server.size(); ++i) {
+    auto done = make_shared<std::promise<void>>();
+    closed.push_back(done->get_future());
+
+    server.post(i, [&, i, done](std::shared_ptr<Multiplexer>) {
+        for (auto& s : server_sockets[i]) s->close();
+        server_sockets[i].clear();
+        done->set_value();
+      });
+  }
+
+  for (auto& f : closed) f.wait();
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_transport_sharded_packet_size) {
+  using club::Multiplexer;
+  using club::ShardedMultiplexer;
+  using ConnectionId = club::transport::ConnectionId;
+
+  vector<std::promise<ConnectionId>> ids(2);
+  vector<std::promise<size_t>>       sizes(2);
+
+  ShardedMultiplexer server(2);
+
+  // One connection in each shard, each records the size of the first
+  // packet it gets.
+  for (size_t i = 0; i < server.size(); ++i) {
+    server.post(i, [&, i](std::shared_ptr<Multiplexer> m) {
+        auto got = make_shared<bool>(false);
+
+        auto id = m->add_connection([&, i, got]( const error_code& err
+                                               , const udp::endpoint&
+                                               , const vector<uint8_t>&
+                                               , size_t size) {
+            if (err || *got) return;
+            *got = true;
+            sizes[i].set_value(size);
+          });
+
+        ids[i].set_value(id);
+      });
+  }
+
+  asio::io_service ios;
+  udp::socket client(ios, udp::endpoint(udp::v4(), 0));
+
+  auto server_ep = udp::endpoint( asio::ip::address_v4::loopback()
+                                , server.local_endpoint().port());
+
+  // Both packets come from the same endpoint so they are received by the
+  // same shard: one of them is dispatched by it directly, the other one
+  // is forwarded to the other shard.
+  vector<ConnectionId> connections;
+  size_t packet_size = 0;
+
+  for (auto& id : ids) {
+    connections.push_back(id.get_future().get());
+
+    binary::dynamic_encoder<uint8_t> e;
+    e.put(connections.back());
+    auto packet = e.move_data();
+    packet.resize(packet.size() + 20, 1);
+    packet_size = packet.size();
+    client.send_to(asio::buffer(packet), server_ep);
+  }
+
+  for (auto& size : sizes) {
+    auto f = size.get_future();
+    BOOST_REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    BOOST_REQUIRE_EQUAL(f.get(), packet_size);
+  }
+
+  // The connections belong to the shard threads.
+  vector<std::future<void>> removed;
+
+  for (size_t i = 0; i < server.size(); ++i) {
+    auto done = make_shared<std::promise<void>>();
+    removed.push_back(done->get_future());
+
+    server.post(i, [&, i, done](std::shared_ptr<Multiplexer> m) {
+        m->remove_connection(connections[i]);
+        done->set_value();
+      });
+  }
+
+  for (auto& f : removed) f.wait();
+}
+
 //------------------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_transport_timeout) {
   using namespace std::chrono_literals;
@@ -711,6 +1673,8 @@ BOOST_AUTO_TEST_CASE(test_transport_keepalive) {
 
           timer.expires_from_now(2*dmax);
           timer.async_wait([s1, s2](auto /*err*/) {
+              BOOST_REQUIRE(s1->stats().keepalives_sent > 0);
+              BOOST_REQUIRE(s1->stats().keepalives_received > 0);
               s1->close();
               s2->close();
             });
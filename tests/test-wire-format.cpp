@@ -0,0 +1,174 @@
+// Copyright 2016 Peter Jankuliak
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <club/transport/wire_format.h>
+#include <club/transport/out_message.h>
+#include <club/transport/in_message_part.h>
+
+using std::vector;
+using namespace club::transport;
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_varint) {
+  using binary::varint;
+
+  vector<uint32_t> values = { 0, 1, 127, 128, 300, 16383, 16384
+                            , 0x7fffffff, 0xffffffff };
+
+  for (auto v : values) {
+    vector<uint8_t> buffer(varint<uint32_t>::max_size);
+
+    binary::encoder e(buffer);
+    e.put(varint<uint32_t>(v));
+    BOOST_REQUIRE(!e.error());
+    BOOST_REQUIRE_EQUAL(e.written(), binary::varint_size(v));
+
+    binary::decoder d(buffer.data(), e.written());
+    BOOST_REQUIRE_EQUAL(d.get<varint<uint32_t>>().value, v);
+    BOOST_REQUIRE(!d.error());
+  }
+
+  {
+    // 65536 doesn't fit into 16 bits.
+    vector<uint8_t> buffer = { 0x80, 0x80, 0x04 };
+    binary::decoder d(buffer);
+    d.get<varint<uint16_t>>();
+    BOOST_REQUIRE(d.error());
+  }
+
+  {
+    // Too many continuation bytes.
+    vector<uint8_t> buffer = { 0x80, 0x80, 0x80, 0x00 };
+    binary::decoder d(buffer);
+    d.get<varint<uint16_t>>();
+    BOOST_REQUIRE(d.error());
+  }
+
+  for (int64_t v : { 0, -1, 1, -64, 63, -1000000, 1000000 }) {
+    BOOST_REQUIRE_EQUAL(binary::zigzag_decode(binary::zigzag_encode(v)), v);
+  }
+
+  BOOST_REQUIRE_EQUAL(binary::zigzag_encode(-1), 1);
+  BOOST_REQUIRE_EQUAL(binary::zigzag_encode(1),  2);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_packet_number) {
+  auto roundtrip = [](uint32_t sn, boost::optional<uint32_t> largest_acked) {
+    vector<uint8_t> buffer(5);
+
+    binary::encoder e(buffer);
+    encode_packet_number(e, sn, largest_acked);
+    BOOST_REQUIRE_EQUAL(e.written(), packet_number_size(sn, largest_acked));
+
+    // The receiver has seen at least what it has acked.
+    binary::decoder d(buffer);
+    auto decoded = decode_packet_number(d, largest_acked);
+    BOOST_REQUIRE(!d.error());
+    BOOST_REQUIRE_EQUAL(decoded, sn);
+
+    return e.written();
+  };
+
+  BOOST_REQUIRE_EQUAL(roundtrip(0, boost::none), 5);
+  BOOST_REQUIRE_EQUAL(roundtrip(1000, 990u),     1);
+  BOOST_REQUIRE_EQUAL(roundtrip(1000, 900u),     2);
+  BOOST_REQUIRE_EQUAL(roundtrip(100000, 90000u), 3);
+  BOOST_REQUIRE_EQUAL(roundtrip(5000000, 0u),    5);
+
+  // Around the wrap of the 32-bit sequence numbers.
+  BOOST_REQUIRE_EQUAL(roundtrip(3, 0xfffffff0u), 1);
+  BOOST_REQUIRE_EQUAL(roundtrip(500, 0xffffff00u), 2);
+
+  // The receiver may have seen more than the sender knows was acked.
+  vector<uint8_t> buffer(5);
+  binary::encoder e(buffer);
+  encode_packet_number(e, 1030, 1000u);
+  binary::decoder d(buffer);
+  BOOST_REQUIRE_EQUAL(decode_packet_number(d, 1025u), 1030);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_compact_message_header) {
+  OutMessage m(true, MessageType::reliable, 1000, vector<uint8_t>(300, 7));
+
+  {
+    // A whole message has no fragment fields.
+    vector<uint8_t> buffer(m.encoded_size());
+    BOOST_REQUIRE_EQUAL(m.encoded_size(), 1 + 2 + 2 + 300);
+
+    binary::encoder e(buffer);
+    e.put(m);
+    BOOST_REQUIRE(!e.error());
+    BOOST_REQUIRE_EQUAL(e.written(), buffer.size());
+
+    binary::decoder d(buffer);
+    auto part = d.get<InMessagePart>();
+    BOOST_REQUIRE(!d.error());
+    BOOST_REQUIRE_EQUAL(part.type, MessageType::reliable);
+    BOOST_REQUIRE_EQUAL(part.sequence_number, 1000);
+    BOOST_REQUIRE(part.is_complete());
+    BOOST_REQUIRE_EQUAL(part.chunk_size, 300);
+  }
+
+  {
+    // Only a fragment fits.
+    vector<uint8_t> buffer(100);
+
+    binary::encoder e(buffer);
+    e.put(m);
+    BOOST_REQUIRE(!e.error());
+
+    binary::decoder d(buffer.data(), e.written());
+    auto part = d.get<InMessagePart>();
+    BOOST_REQUIRE(!d.error());
+    BOOST_REQUIRE(!part.is_complete());
+    BOOST_REQUIRE_EQUAL(part.sequence_number, 1000);
+    BOOST_REQUIRE_EQUAL(part.original_size, 300);
+    BOOST_REQUIRE_EQUAL(part.chunk_start, 0);
+    BOOST_REQUIRE_EQUAL(part.chunk_size, m.bytes_already_sent);
+  }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_message_fragment_sizes) {
+  // Any buffer of at least min_encoded_size() takes a chunk, even though
+  // the header of the chunk depends on its size.
+  for (size_t size = 0; size < 400; ++size) {
+    OutMessage m(true, MessageType::reliable, 1000, vector<uint8_t>(300));
+
+    vector<uint8_t> buffer(size);
+    binary::encoder e(buffer);
+
+    if (m.min_encoded_size() > size) continue;
+
+    auto whole_size = m.encoded_size();
+
+    e.put(m);
+    BOOST_REQUIRE(!e.error());
+
+    if (size < whole_size) {
+      // Nothing useful fits into what's left.
+      BOOST_REQUIRE(e.remaining_size() < 2);
+    }
+
+    binary::decoder d(buffer.data(), e.written());
+    auto part = d.get<InMessagePart>();
+    BOOST_REQUIRE(!d.error());
+    BOOST_REQUIRE_EQUAL(part.chunk_size, m.bytes_already_sent);
+  }
+}